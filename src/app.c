@@ -2,6 +2,7 @@
 #include "menu.h"
 #include "view.h"
 #include "gen.h"
+#include "tpool.h"
 #include "world.h"
 #include "stb_ds.h"
 #include "serial.h"
@@ -44,6 +45,10 @@ int app_init(struct app *app, uint32_t seed, struct vec2 size) {
     app->video_mode = WINDOWED;
     app->win_size = size;
     run_init(app);
+    sim_init(&app->sim);
+    gen_job_init(&app->gen);
+    app->minimap_row = 0;
+    tpool_init(0);
 
     /* init images */
     val = jq_find(app->json, "images", 0);
@@ -108,6 +113,10 @@ int app_init(struct app *app, uint32_t seed, struct vec2 size) {
 }
 
 void app_free(struct app *app) {
+    gen_cancel(&app->gen);
+    gen_wait(&app->gen);
+    sim_free(&app->sim);
+
     main_view_free(&shget(app->views, "main_view"));
     options_menu_free(&shget(app->views, "options_menu"));
     new_menu_free(&shget(app->views, "new_menu"));
@@ -122,16 +131,13 @@ void app_free(struct app *app) {
     shfree(app->worlds);
 
     jq_free(app->json);
+    tpool_free();
 }
 
 void app_run(struct app *app) {
     run(app);
 }
 
-void app_step(struct app *app) {
-    world_step(&app->cur_world->value);
-}
-
 void app_quit(struct app *app) {
     app->running = 0;
 }
@@ -175,12 +181,66 @@ struct vec2 get_win_size(struct app *app) {
     return rv; /* to aviod compiler warning */
 }
 
+/* starts generating cur_world in the background, the world is handed over
+ * to the main view by app_draw once it's generated and its minimap is drawn
+ */
 void app_gen_world(struct app *app, struct vec2 size) {
-    gen_world(&app->cur_world->value, size, app->seed);
-    gen_minimap(&shget(app->views, "main_view"));
+    sim_stop(&app->sim);
+    app->minimap_row = 0;
+    gen_start(&app->gen, &app->cur_world->value, size, app->seed);
+}
+
+/* per mille of the world generated, -1 if it's not being generated */
+int app_gen_progress(struct app *app) {
+    switch (SDL_AtomicGet(&app->gen.state)) {
+    case GS_RUNNING:
+        return SDL_AtomicGet(&app->gen.progress) * 9 / 10;
+    case GS_DONE:
+        return 900 + app->minimap_row * 100 / app->gen.size.y;
+    default:
+        return -1;
+    }
+}
+
+void app_gen_cancel(struct app *app) {
+    gen_cancel(&app->gen);
+}
+
+/* the minimap is drawn this many rows a frame after generation */
+#define MINIMAP_ROWS 64
+
+static void app_gen_poll(struct app *app) {
+    struct world *w = &app->cur_world->value;
+
+    switch (gen_poll(&app->gen)) {
+    case GS_DONE:
+        if (gen_minimap(&shget(app->views, "main_view"), app->minimap_row, MINIMAP_ROWS))
+            app->minimap_row = w->map.size.y;
+        else
+            app->minimap_row += MINIMAP_ROWS;
+        if (app->minimap_row < w->map.size.y)
+            break;
+
+        /* everything is ready, the simulation and the view take the world
+         * within the same frame
+         */
+        gen_job_init(&app->gen);
+        sim_start(&app->sim, w);
+        struct snapshot *snap = sim_acquire(&app->sim);
+        app_set_view(app, "main_view");
+        if (snap->player >= 0)
+            main_view_center_at(&app->cur_view->value, snap->units[snap->player].coords);
+        break;
+    case GS_CANCELLED:
+        gen_job_init(&app->gen);
+        break;
+    default:
+        break;
+    }
 }
 
 void app_draw(struct app *app) {
+    app_gen_poll(app);
     app->cur_view->value.draw(&app->cur_view->value);
 }
 
@@ -3,6 +3,8 @@
 
 #include "types.h"
 #include "rand.h"
+#include "sim.h"
+#include "gen.h"
 #ifndef NK_SDL_RENDERER_H_
   #include "nuklear_sdl_renderer.h"
 #endif
@@ -60,6 +62,9 @@ struct app {
     struct view_hash *cur_view; /* this is a hash entry */
     struct world_hash *worlds;
     struct world_hash *cur_world;
+    struct sim sim;
+    struct gen_job gen;         /* generation of cur_world started by app_gen_world */
+    int minimap_row;            /* rows of the minimap of the generated world drawn */
     struct jq_value *json;
 };
 
@@ -67,7 +72,6 @@ void app_warning(const char *format, ...);
 int app_init(struct app *app, uint32_t seed, struct vec2 size);
 void app_free(struct app *app);
 void app_run(struct app *app);
-void app_step(struct app *app);
 void app_quit(struct app *app);
 void set_video_mode(struct app *app, enum video_mode mode);
 void app_set_view(struct app *app, const char *name);
@@ -76,6 +80,8 @@ void app_scroll_map(void *userdata, int x, int y);
 struct nk_image app_get_image(struct app *app, const char *name);
 struct vec2 get_win_size(struct app *app);
 void app_gen_world(struct app *app, struct vec2 size);
+int app_gen_progress(struct app *app);
+void app_gen_cancel(struct app *app);
 void app_draw(struct app *app);
 
 #endif /* _APP_H_ */
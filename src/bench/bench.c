@@ -0,0 +1,609 @@
+/* Simulation benchmarks
+ *
+ * usage: society_bench [name [size]]
+ * runs all the benchmarks if no name is given, size overrides
+ * the default problem size of the benchmark.
+ */
+
+#include "types.h"
+#include "prod.h"
+#include "jobs.h"
+#include "ai.h"
+#include "bt.h"
+#include "res.h"
+#include "move.h"
+#include "lod.h"
+#include "events.h"
+#include "stats.h"
+#include "influence.h"
+#include "map.h"
+#include "path.h"
+#include "gen.h"
+#include "tpool.h"
+#include "rand.h"
+#include "world.h"
+#include "serial.h"
+#include "stb_ds.h"
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(_WIN32) || defined(_WIN64) || defined(__MINGW32__) || defined(__CYGWIN__)
+#undef main
+#endif
+
+typedef void (*bench_func)(int size);
+
+struct bench {
+    const char *name;
+    bench_func func;
+    int size;               /* default problem size */
+};
+
+static double
+elapsed_us(Uint64 start) {
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000000. / (double)SDL_GetPerformanceFrequency();
+}
+
+/*
+ * production
+ */
+
+static void
+bench_prod(int size) {
+    const int ticks = 1000;
+    struct production p;
+    struct receipt r;
+    mt_state mt;
+    double sum = 0, max = 0;
+
+    mt_init_state(&mt, 19650218UL);
+    prod_init(&p);
+
+    memset(&r, 0, sizeof(r));
+    r.name = "wood"; r.building = BT_SAWMILL; r.time = 20;
+    r.outputs[AT_WOOD] = 1; r.tools[TLT_AXE] = 1;
+    prod_add_receipt(&p, &r);
+
+    memset(&r, 0, sizeof(r));
+    r.name = "flour"; r.building = BT_WINDMILL; r.time = 30;
+    r.inputs[AT_WHEAT] = 3; r.outputs[AT_FLOUR] = 1;
+    prod_add_receipt(&p, &r);
+
+    memset(&r, 0, sizeof(r));
+    r.name = "bread"; r.building = BT_BAKERY; r.time = 60;
+    r.inputs[AT_FLOUR] = 2; r.outputs[AT_BREAD] = 1; r.tools[TLT_OVEN] = 1;
+    prod_add_receipt(&p, &r);
+
+    for (int i = 0; i != size; ++i) {
+        int b = prod_add(&p, mt_random_uint32(&mt) % 3);
+        prod_add_stock(&p, b, AT_WHEAT, mt_random_uint32(&mt) % 1000);
+        prod_add_stock(&p, b, AT_FLOUR, mt_random_uint32(&mt) % 100);
+        prod_add_tools(&p, b, TLT_AXE, mt_random_uint32(&mt) % 2);
+        prod_add_tools(&p, b, TLT_OVEN, mt_random_uint32(&mt) % 2);
+    }
+
+    for (int t = 0; t != ticks; ++t) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        prod_step(&p);
+        double us = elapsed_us(start);
+        sum += us;
+        if (us > max) max = us;
+    }
+
+    printf("prod: %i buildings, %i ticks, %.1f us/tick avg, %.1f us max, %lu cycles, %lld bread\n",
+        size, ticks, sum / ticks, max, p.cycles, p.totals[AT_BREAD]);
+
+    prod_free(&p);
+}
+
+/*
+ * jobs
+ */
+
+static void
+bench_jobs(int size) {
+    const int ticks = 1000, open = 20000;
+    static struct world w;
+    struct vec2 map_size = { 1024, 1024 };
+    mt_state mt;
+    double sum = 0, max = 0;
+
+    mt_init_state(&mt, 19650218UL);
+    memset(&w, 0, sizeof(w));
+    w.mt = &mt;
+    w.map.size = map_size;
+    pool_init(&w.pool);
+    prod_init(&w.prod);
+    jobs_init(&w.jobs);
+    handles_init(&w.unit_handles);
+    w.jobs.budget = 1024;
+    jobs_reset(&w.jobs, map_size);
+
+    arrsetlen(w.units, size);
+    arrsetlen(w.ais, size);
+    for (int i = 0; i != size; ++i) {
+        memset(&w.units[i], 0, sizeof(w.units[i]));
+        w.units[i].coords.x = (mt_random_uint32(&mt) % map_size.x) << TILE_SHIFT;
+        w.units[i].coords.y = (mt_random_uint32(&mt) % map_size.y) << TILE_SHIFT;
+        w.ais[i].world = &w;
+        ai_human_init(&w.ais[i]);
+        w.ais[i].job = JOB_WAITING;
+        jobs_add_idle(&w.jobs, handles_add(&w.unit_handles));
+    }
+
+    for (int t = 0; t != ticks; ++t) {
+        /* keeping the board full, jobs are done right after the assignment */
+        while (w.jobs.open < open) {
+            struct job j = { J_SUPPLY, HANDLE_NONE, AT_WOOD, 1, 1,
+                { mt_random_uint32(&mt) % map_size.x, mt_random_uint32(&mt) % map_size.y }, HANDLE_NONE, -1 };
+            jobs_post(&w.jobs, &j);
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        jobs_step(&w);
+        double us = elapsed_us(start);
+        sum += us;
+        if (us > max) max = us;
+
+        for (int i = 0; i != size; ++i) {
+            struct ai *ai = &w.ais[i];
+            if (ai->job >= 0) {
+                jobs_done(&w, ai->job);
+                ai->job = JOB_WAITING;
+                jobs_add_idle(&w.jobs, handles_at(&w.unit_handles, i));
+            }
+        }
+    }
+
+    printf("jobs: %i units, %i open jobs, %i ticks, %.1f us/tick avg, %.1f us max, %lu assignments, %.0f assignments/s\n",
+        size, open, ticks, sum / ticks, max, w.jobs.assigned, w.jobs.assigned * 1000000. / sum);
+
+    handles_free(&w.unit_handles);
+    jobs_free(&w.jobs);
+    prod_free(&w.prod);
+    pool_free(&w.pool);
+    arrfree(w.units);
+    arrfree(w.ais);
+}
+
+/*
+ * behavior trees
+ */
+
+static const char bt_json[] =
+    "{ \"worker\": { \"type\": \"selector\", \"children\": ["
+    "    { \"type\": \"work\" },"
+    "    { \"type\": \"sequence\", \"children\": ["
+    "        { \"type\": \"near_resource\", \"resource\": \"wood\", \"radius\": 8 },"
+    "        { \"type\": \"stay\", \"ticks\": 20 } ] },"
+    "    { \"type\": \"cooldown\", \"ticks\": 30, \"child\": { \"type\": \"wander\" } },"
+    "    { \"type\": \"stay\", \"ticks\": 10 } ] } }";
+
+static void
+bench_bt(int size) {
+    const int ticks = 1000;
+    static struct world w;
+    struct vec2 map_size = { 512, 512 };
+    struct jq_handler h;
+    struct jq_value *json;
+    char buf[sizeof(bt_json)];
+    mt_state mt;
+    double sum = 0, max = 0;
+
+    mt_init_state(&mt, 19650218UL);
+    memset(&w, 0, sizeof(w));
+    w.mt = &mt;
+    map_init(&w.map);
+    map_reset(&w.map, map_size);
+
+    pool_init(&w.pool);
+    move_init(&w.moves);
+    jobs_init(&w.jobs);
+    jobs_reset(&w.jobs, map_size);
+    res_init(&w.recources);
+    res_reset(&w.recources, map_size);
+    for (int i = 0; i != map_size.x * map_size.y / 64; ++i)
+        res_add(&w.recources, RT_WOOD, mt_random_uint32(&mt) % map_size.x, mt_random_uint32(&mt) % map_size.y, 100);
+
+    bt_init(&w.bt);
+    handles_init(&w.unit_handles);
+    memcpy(buf, bt_json, sizeof(buf));
+    jq_init(&h);
+    json = jq_read_buf(&h, buf, sizeof(buf) - 1);
+    if (!json || bt_read(&w.bt, json)) {
+        fprintf(stderr, "bt: can't compile the tree\n");
+        return;
+    }
+
+    arrsetlen(w.units, size);
+    arrsetlen(w.ais, size);
+    for (int i = 0; i != size; ++i) {
+        memset(&w.units[i], 0, sizeof(w.units[i]));
+        w.units[i].coords.x = (mt_random_uint32(&mt) % map_size.x) << TILE_SHIFT;
+        w.units[i].coords.y = (mt_random_uint32(&mt) % map_size.y) << TILE_SHIFT;
+        w.units[i].speed = 4;
+        w.ais[i].world = &w;
+        handles_add(&w.unit_handles);
+        ai_bt_init(&w.ais[i], 0);
+    }
+
+    for (int t = 0; t != ticks; ++t) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int i = 0; i != size; ++i)
+            w.ais[i].step(&w.ais[i]);
+        double us = elapsed_us(start);
+        sum += us;
+        if (us > max) max = us;
+
+        move_step(&w);
+        ++w.tick;
+    }
+
+    printf("bt: %i units, %i code ints, %i ticks, %.1f us/tick avg, %.1f us max, %.0f ai steps/s\n",
+        size, (int)arrlen(w.bt.code), ticks, sum / ticks, max, (double)size * ticks * 1000000. / sum);
+
+    bt_free(&w.bt);
+    handles_free(&w.unit_handles);
+    res_free(&w.recources);
+    jobs_free(&w.jobs);
+    move_free(&w.moves);
+    pool_free(&w.pool);
+    map_free(&w.map);
+    arrfree(w.units);
+    arrfree(w.ais);
+}
+
+/*
+ * forks
+ */
+
+static void
+bench_fork(int size) {
+    const int forks = 10, ticks = 10;
+    static struct world w, f;
+    struct vec2 map_size = { 1024, 1024 };
+    struct jq_handler h;
+    struct jq_value *json;
+    char buf[sizeof(bt_json)];
+    mt_state mt;
+    double fork_sum = 0, step_sum = 0, free_sum = 0;
+
+    mt_init_state(&mt, 19650218UL);
+    memset(&w, 0, sizeof(w));
+    w.mt = &mt;
+    map_init(&w.map);
+    map_reset(&w.map, map_size);
+
+    pool_init(&w.pool);
+    move_init(&w.moves);
+    lod_init(&w.lod);
+    lod_read(&w.lod, NULL);
+    prod_init(&w.prod);
+    jobs_init(&w.jobs);
+    jobs_reset(&w.jobs, map_size);
+    res_init(&w.recources);
+    res_reset(&w.recources, map_size);
+    for (int i = 0; i != map_size.x * map_size.y / 64; ++i)
+        res_add(&w.recources, RT_WOOD, mt_random_uint32(&mt) % map_size.x, mt_random_uint32(&mt) % map_size.y, 100);
+    events_init(&w.events);
+    stats_init(&w.stats);
+    influence_init(&w.influence);
+    handles_init(&w.unit_handles);
+    handles_init(&w.building_handles);
+    handles_init(&w.asset_handles);
+    handles_init(&w.tool_handles);
+
+    bt_init(&w.bt);
+    memcpy(buf, bt_json, sizeof(buf));
+    jq_init(&h);
+    json = jq_read_buf(&h, buf, sizeof(buf) - 1);
+    if (!json || bt_read(&w.bt, json)) {
+        fprintf(stderr, "fork: can't compile the tree\n");
+        return;
+    }
+
+    arrsetlen(w.units, size);
+    arrsetlen(w.ais, size);
+    for (int i = 0; i != size; ++i) {
+        memset(&w.units[i], 0, sizeof(w.units[i]));
+        w.units[i].coords.x = (mt_random_uint32(&mt) % map_size.x) << TILE_SHIFT;
+        w.units[i].coords.y = (mt_random_uint32(&mt) % map_size.y) << TILE_SHIFT;
+        w.units[i].speed = 4;
+        w.ais[i].world = &w;
+        handles_add(&w.unit_handles);
+        ai_bt_init(&w.ais[i], 0);
+    }
+
+    /* warming up, so tasks and jobs are in flight */
+    for (int t = 0; t != ticks; ++t)
+        world_step(&w);
+
+    for (int i = 0; i != forks; ++i) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        if (world_fork(&f, &w)) {
+            fprintf(stderr, "fork: can't fork\n");
+            break;
+        }
+        fork_sum += elapsed_us(start);
+
+        start = SDL_GetPerformanceCounter();
+        for (int t = 0; t != ticks; ++t)
+            world_step(&f);
+        step_sum += elapsed_us(start);
+
+        start = SDL_GetPerformanceCounter();
+        world_free(&f);
+        free_sum += elapsed_us(start);
+    }
+
+    printf("fork: %i units, %ix%i tiles, fork %.2f ms, %i ticks of the fork %.2f ms, free %.2f ms\n",
+        size, map_size.x, map_size.y, fork_sum / forks / 1000., ticks, step_sum / forks / 1000., free_sum / forks / 1000.);
+
+    world_free(&w);
+    arrfree(w.units);
+    arrfree(w.ais);
+}
+
+/*
+ * perlin noise: the scalar samples against the batch kernels on a map
+ * of size x size tiles, octaves as the map generator uses them
+ */
+
+static void
+bench_perlin(int size) {
+    struct perlin2d p;
+    mt_state mt;
+    float *grid = malloc(sizeof(float) * size * size);
+    float sum = 0, diff = 0;
+
+    mt_init_state(&mt, 19650218UL);
+    perlin2d_init(&p, &mt);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int y = 0; y != size; ++y) {
+        for (int x = 0; x != size; ++x)
+            sum += perlin2d_noise_x(&p, (float)x/64., (float)y/64., 5, .7);
+    }
+    double scalar = elapsed_us(start);
+
+    start = SDL_GetPerformanceCounter();
+    perlin2d_noise_grid(&p, 0, 0, 1/64., size, size, 5, .7, grid);
+    double batch = elapsed_us(start);
+
+    for (int y = 0; y != size; ++y) {
+        for (int x = 0; x != size; ++x) {
+            float d = fabsf(grid[y * size + x] - perlin2d_noise_x(&p, (float)x/64., (float)y/64., 5, .7));
+            if (d > diff)
+                diff = d;
+        }
+    }
+
+    printf("perlin: %ix%i samples, scalar %.2f ms, batch %.2f ms, max difference %g (epsilon %g), checksum %f\n",
+        size, size, scalar / 1000., batch / 1000., diff, PERLIN2D_EPSILON, sum);
+
+    free(grid);
+}
+
+/*
+ * random numbers: size values one by one and by blocks of both generators
+ */
+
+static void
+bench_rand(int size) {
+    static const char *names[] = { "mt", "xoshiro" };
+    uint32_t *buf = malloc(sizeof(uint32_t) * size);
+    uint32_t sum = 0;
+    mt_state mt;
+
+    for (int kind = RAND_MT; kind <= RAND_XOSHIRO; ++kind) {
+        rand_init_state(&mt, kind, 19650218UL);
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int i = 0; i != size; ++i)
+            sum += mt_random_uint32(&mt);
+        double single = elapsed_us(start);
+
+        start = SDL_GetPerformanceCounter();
+        mt_fill_uint32(&mt, buf, size);
+        double block = elapsed_us(start);
+        sum += buf[size - 1];
+
+        printf("rand: %s, %i values, one by one %.2f ms (%.0f M/s), block %.2f ms (%.0f M/s)\n",
+            names[kind], size, single / 1000., size / single, block / 1000., size / block);
+    }
+
+    printf("rand: checksum %u\n", sum);
+    free(buf);
+}
+
+/* a map with the generator of 4 tile types and no tileset, transit
+ * indexes are type * 16 + quad
+ */
+static void
+bench_map_init(struct map *m, mt_state *mt) {
+    const float parts[] = { 30, 50, 75, 100 };
+    struct tile_t tt;
+
+    map_init(m);
+    memset(&tt, 0, sizeof(tt));
+    for (int i = 0; i != sizeof(parts) / sizeof(parts[0]); ++i) {
+        arrput(m->tile_types, tt);
+        arrput(m->gen.parts, parts[i]);
+    }
+    for (int i = 0; i != (arrlen(m->tile_types) + 1) * 16; ++i)
+        arrput(m->gen.transit, i);
+    perlin2d_init(&m->gen.perlin, mt);
+}
+
+/*
+ * transitions: a size x size map built by chunks on the thread pool, then
+ * rebuilt at once, tile by tile and by small edits
+ */
+
+static void
+bench_transit(int size) {
+    const int edits = 10000;
+    struct vec2 map_size = { size, size };
+    struct map m;
+    mt_state mt;
+    long diff = 0;
+
+    tpool_init(0);
+    mt_init_state(&mt, 19650218UL);
+    bench_map_init(&m, &mt);
+    map_reset(&m, map_size);
+
+    struct recti all = { 0, 0, m.chunks.x, m.chunks.y };
+    Uint64 start = SDL_GetPerformanceCounter();
+    map_prefetch(&m, all);
+    double build = elapsed_us(start);
+
+    start = SDL_GetPerformanceCounter();
+    transit_map(&m);
+    double full = elapsed_us(start);
+
+    int *ref = malloc(sizeof(int) * size * size);
+    for (int y = 0; y != size; ++y) {
+        for (int x = 0; x != size; ++x)
+            ref[y * size + x] = map_get_tile(&m, x, y)->quad;
+    }
+
+    struct recti tiles = { 0, 0, size, size };
+    start = SDL_GetPerformanceCounter();
+    transit_update_rect(&m, tiles);
+    double scalar = elapsed_us(start);
+
+    for (int y = 0; y != size; ++y) {
+        for (int x = 0; x != size; ++x)
+            diff += map_get_tile(&m, x, y)->quad != ref[y * size + x];
+    }
+
+    start = SDL_GetPerformanceCounter();
+    for (int i = 0; i != edits; ++i) {
+        struct recti r = { mt_random_uint32(&mt) % size, mt_random_uint32(&mt) % size, 1 + mt_random_uint32(&mt) % 4, 1 + mt_random_uint32(&mt) % 4 };
+        int type = mt_random_uint32(&mt) % arrlen(m.tile_types);
+        for (int y = r.y; y < r.y + r.h && y < size; ++y) {
+            for (int x = r.x; x < r.x + r.w && x < size; ++x)
+                map_get_tile(&m, x, y)->type = type;
+        }
+        transit_update_rect(&m, r);
+    }
+    double edit = elapsed_us(start);
+
+    printf("transit: %ix%i tiles, %i threads, chunks %.2f ms, full %.2f ms, tile by tile %.2f ms, %i edits %.2f us each, %li differences\n",
+        size, size, tpool_threads(), build / 1000., full / 1000., scalar / 1000., edits, edit / edits, diff);
+
+    free(ref);
+    arrfree(m.tile_types);
+    map_free(&m);
+}
+
+/*
+ * map layouts: a size x size map generated, drawn by screens of tiles and
+ * searched for paths in every layout of the tiles within the chunks
+ */
+
+static void
+bench_layout(int size) {
+    static const char *names[] = { "rows", "blocks", "morton" };
+    const int frames = 2000, paths = 200;
+    const struct vec2 screen = { 60, 34 };
+    struct vec2 map_size = { size, size };
+    static struct world w;
+    float pass[] = { 1., .7, .5, .3, .3 };
+    struct unit_t ut;
+    mt_state mt;
+
+    tpool_init(0);
+    memset(&w, 0, sizeof(w));
+    memset(&ut, 0, sizeof(ut));
+    for (int i = 0; i != sizeof(pass) / sizeof(pass[0]); ++i)
+        arrput(ut.pass, pass[i]);
+    arrput(w.unit_types, ut);
+
+    for (int layout = ML_ROWS; layout <= ML_MORTON; ++layout) {
+        long sum = 0;
+        int steps = 0;
+
+        mt_init_state(&mt, 19650218UL);
+        bench_map_init(&w.map, &mt);
+        map_set_layout(&w.map, layout);
+        map_reset(&w.map, map_size);
+
+        struct recti all = { 0, 0, w.map.chunks.x, w.map.chunks.y };
+        Uint64 start = SDL_GetPerformanceCounter();
+        map_prefetch(&w.map, all);
+        double gen = elapsed_us(start);
+
+        /* the view draws the tiles of the screen row by row */
+        start = SDL_GetPerformanceCounter();
+        for (int i = 0; i != frames; ++i) {
+            int x0 = mt_random_uint32(&mt) % (size - screen.x);
+            int y0 = mt_random_uint32(&mt) % (size - screen.y);
+            for (int y = y0; y != y0 + screen.y; ++y) {
+                for (int x = x0; x != x0 + screen.x; ++x) {
+                    struct tile *t = map_get_tile(&w.map, x, y);
+                    sum += map_tileset_index(&w.map, t) + map_transit_index(&w.map, t);
+                }
+            }
+        }
+        double render = elapsed_us(start);
+
+        start = SDL_GetPerformanceCounter();
+        for (int i = 0; i != paths; ++i) {
+            struct unit u = { 0 };
+            struct vec2 from = { 32 + mt_random_uint32(&mt) % (size - 64), 32 + mt_random_uint32(&mt) % (size - 64) };
+            struct vec2 to = { from.x + mt_random_uint32(&mt) % 49 - 24, from.y + mt_random_uint32(&mt) % 49 - 24 };
+            u.coords.x = from.x << TILE_SHIFT;
+            u.coords.y = from.y << TILE_SHIFT;
+
+            struct path p = find_path(&w, &u, to);
+            steps += arrlen(p.steps);
+            path_free(&p);
+        }
+        double path = elapsed_us(start);
+
+        printf("layout: %s, %ix%i tiles, gen %.2f ms, %i screens %.2f ms, %i paths of %i steps %.2f ms, checksum %li\n",
+            names[layout], size, size, gen / 1000., frames, render / 1000., paths, steps, path / 1000., sum);
+
+        arrfree(w.map.tile_types);
+        map_free(&w.map);
+    }
+
+    arrfree(ut.pass);
+    arrfree(w.unit_types);
+}
+
+static struct bench benches[] = {
+    { "prod", bench_prod, 50000 },
+    { "jobs", bench_jobs, 50000 },
+    { "bt", bench_bt, 50000 },
+    { "fork", bench_fork, 100000 },
+    { "perlin", bench_perlin, 2048 },
+    { "rand", bench_rand, 10000000 },
+    { "transit", bench_transit, 2048 },
+    { "layout", bench_layout, 2048 }
+};
+
+int
+main(int argc, char *argv[]) {
+    int found = 0;
+
+    for (int i = 0; i != sizeof(benches) / sizeof(benches[0]); ++i) {
+        if (argc > 1 && strcmp(argv[1], benches[i].name))
+            continue;
+
+        benches[i].func(argc > 2 ? atoi(argv[2]) : benches[i].size);
+        found = 1;
+    }
+
+    if (!found) {
+        fprintf(stderr, "usage: %s [name [size]]\n", argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,6 +1,9 @@
 #include "types.h"
 #include "path.h"
 #include "ai.h"
+#include "move.h"
+#include "jobs.h"
+#include "bt.h"
 #include "stb_ds.h"
 #include <stddef.h>
 #include <malloc.h>
@@ -11,15 +14,21 @@ void action_init(struct action *a) {
 
 void task_init(struct task *t) {
     t->i = 0;
+    t->n = 0;
     t->actions = NULL;
 }
 
-void task_free(struct task *t) {
-    arrfree(t->actions);
+void task_free(struct world *w, struct task *t) {
+    pool_release(&w->pool, t->actions);
+    task_init(t);
 }
 
-void task_append_action(struct task *t, struct action *a) {
-    arrput(t->actions, *a);
+/* acquires a block for n actions from the world pool, the actions are not initialized */
+int task_alloc(struct world *w, struct task *t, int n) {
+    t->i = 0;
+    t->n = n;
+    t->actions = pool_acquire(&w->pool, n);
+    return t->actions == NULL;
 }
 
 /*
@@ -28,69 +37,70 @@ void task_append_action(struct task *t, struct action *a) {
 
 void
 ai_add_task_from_path(struct ai* ai, struct path p) {
-    task_free(&ai->task);
-    task_init(&ai->task);
-    struct action a = { .type = A_WALK };
-    for (int i = 0, ie = arrlenu(p.steps); i != ie; ++i) {
-        a.act.walk.to.x = p.steps[i].x * 64;
-        a.act.walk.to.y = p.steps[i].y * 64;
-        task_append_action(&ai->task, &a);
-    }
-}
+    task_free(ai->world, &ai->task);
+    if (!arrlenu(p.steps))
+        return;
 
-static void
-unit_move(struct world *w, struct unit *u, struct vec2 dir) {
-    size_t old_offset = w->map.size.x * (u->coords.y / 64) + (u->coords.x / 64);
-    size_t new_offset = w->map.size.x * ((u->coords.y + dir.y) / 64) + ((u->coords.x + dir.x) / 64);
+    if (task_alloc(ai->world, &ai->task, arrlenu(p.steps))) {
+        task_init(&ai->task);
+        return;
+    }
 
-    if (old_offset != new_offset) {
-        w->map.tiles[old_offset].units[0] = ID_NOTHING;
-        w->map.tiles[new_offset].units[0] = u - w->units;
+    for (int i = 0, ie = arrlenu(p.steps); i != ie; ++i) {
+        struct action *a = &ai->task.actions[i];
+        a->type = A_WALK;
+        a->act.walk.to.x = p.steps[i].x << TILE_SHIFT;
+        a->act.walk.to.y = p.steps[i].y << TILE_SHIFT;
     }
+}
 
-    u->coords.x += dir.x;
-    u->coords.y += dir.y;
+/* sets the action to walking to a random neighbor tile */
+void
+ai_rand_walk(struct ai *ai, struct action *a) {
+    a->type = A_WALK;
+    a->act.walk.to.x = trim(0, ai->world->map.size.x * TILE_SIZE - 1, ai_unit(ai)->coords.x + ((mt_random_uint32(ai->world->mt) % 3) - 1) * TILE_SIZE);
+    a->act.walk.to.y = trim(0, ai->world->map.size.y * TILE_SIZE - 1, ai_unit(ai)->coords.y + ((mt_random_uint32(ai->world->mt) % 3) - 1) * TILE_SIZE);
 }
 
 static void
 gen_rand_action(struct ai *ai, struct action *a) {
-    a->type = mt_random_uint32(ai->world->mt) % (A_MAX - 1) + 1;
-    switch (a->type) {
-    case A_STAY:    a->act.stay.cnt = mt_random_uint32(ai->world->mt) % 60;
-                    break;
-
-    case A_WALK:    a->act.walk.to.x = trim(0, ai->world->map.size.x * 64 - 1, ai->unit->coords.x + ((mt_random_uint32(ai->world->mt) % 3) - 1) * 64);
-                    a->act.walk.to.y = trim(0, ai->world->map.size.y * 64 - 1, ai->unit->coords.y + ((mt_random_uint32(ai->world->mt) % 3) - 1) * 64);
-                    break;
-
-    default:        break;
+    /* staying or walking, doing needs a job */
+    if (mt_random_uint32(ai->world->mt) % 2) {
+        ai_rand_walk(ai, a);
+    } else {
+        a->type = A_STAY;
+        a->act.stay.cnt = mt_random_uint32(ai->world->mt) % 60;
     }
 }
 
-static int
+/* steps the action, returns 0 when it's over */
+int
 ai_unit_step(struct ai *ai, struct action *a) {
     switch (a->type) {
     case A_NOTHING:
                     return 0;
 
-    case A_STAY:    if (--a->act.stay.cnt <= 0) {
+    case A_STAY:    a->act.stay.cnt -= ai->quantum;
+                    if (a->act.stay.cnt <= 0) {
                         a->type = A_NOTHING;
                         return 0;
                     }
                     break;
 
-    case A_WALK:    if (ai->unit->coords.x == a->act.walk.to.x && ai->unit->coords.y == a->act.walk.to.y) {
+    case A_WALK:    if (ai_unit(ai)->coords.x == a->act.walk.to.x && ai_unit(ai)->coords.y == a->act.walk.to.y) {
                         a->type = A_NOTHING;
                         return 0;
                     } else {
-                        struct vec2 dir = { 0, 0 };
-                        if (ai->unit->coords.x < a->act.walk.to.x) dir.x = 1;
-                        else if (ai->unit->coords.x > a->act.walk.to.x) dir.x = -1;
-
-                        if (ai->unit->coords.y < a->act.walk.to.y) dir.y = 1;
-                        else if (ai->unit->coords.y > a->act.walk.to.y) dir.y = -1;
+                        /* the unit is moved later in the tick with the whole batch */
+                        move_push(&ai->world->moves, ai_index(ai), ai_unit(ai)->coords, a->act.walk.to, ai_unit(ai)->speed * ai->quantum);
+                    }
+                    break;
 
-                        unit_move(ai->world, ai->unit, dir);
+    case A_DO:      a->act.work.cnt -= ai->quantum;
+                    if (a->act.work.cnt <= 0) {
+                        jobs_done(ai->world, a->act.work.job);
+                        a->type = A_NOTHING;
+                        return 0;
                     }
                     break;
 
@@ -100,6 +110,22 @@ ai_unit_step(struct ai *ai, struct action *a) {
     return 1;
 }
 
+/* steps the task of the assigned job, returns 0 when the job is done
+ * and the unit has its single action task back
+ */
+int
+ai_job_step(struct ai *ai) {
+    if (ai_unit_step(ai, &ai->task.actions[ ai->task.i ]) || ++ai->task.i != ai->task.n)
+        return 1;
+
+    ai->job = JOB_NONE;
+    task_free(ai->world, &ai->task);
+    if (!task_alloc(ai->world, &ai->task, 1))
+        action_init(ai->task.actions);
+
+    return 0;
+}
+
 /*
  * player ai
  */
@@ -110,19 +136,21 @@ static void ai_player_step(struct ai *ai);
 void
 ai_player_init(struct ai *ai) {
     ai->step = ai_player_step;
+    ai->quantum = 1;
+    ai->job = JOB_NONE;
+    ai->tree = -1;
     task_init(&ai->task);
 }
 
 static void
 ai_player_step(struct ai *ai) {
-    size_t num = arrlenu(ai->task.actions);
-    if (num) {
-        if (ai->task.i < num) {
+    if (ai->task.n) {
+        if (ai->task.i < ai->task.n) {
             if (!ai_unit_step(ai, &ai->task.actions[ ai->task.i ])) {
                 ++ai->task.i;
             }
         } else {
-            task_free(&ai->task);
+            task_free(ai->world, &ai->task);
         }
     }
 }
@@ -136,14 +164,77 @@ static void ai_human_step(struct ai *ai);
 void
 ai_human_init(struct ai *ai) {
     ai->step = ai_human_step;
+    ai->quantum = 1;
+    ai->job = JOB_NONE;
+    ai->tree = -1;
     task_init(&ai->task);
-    arrsetlen(ai->task.actions, 1);
-    action_init(ai->task.actions);
+    if (!task_alloc(ai->world, &ai->task, 1))
+        action_init(ai->task.actions);
 }
 
 static void
 ai_human_step(struct ai *ai) {
+    if (!ai->task.n)
+        return;
+
+    /* walking to the job and doing it, then wandering again */
+    if (ai->job >= 0 && (ai_job_step(ai) || !ai->task.n))
+        return;
+
+    /* wandering until the job board assigns a job */
+    if (ai->job == JOB_NONE) {
+        ai->job = JOB_WAITING;
+        jobs_add_idle(&ai->world->jobs, handles_at(&ai->world->unit_handles, ai_index(ai)));
+    }
+
     if (!ai_unit_step(ai, ai->task.actions))
         gen_rand_action(ai, ai->task.actions);
 }
 
+
+/*
+ * behavior tree ai, see bt.h
+ */
+
+static void ai_bt_step(struct ai *ai);
+
+void
+ai_bt_init(struct ai *ai, int tree) {
+    ai->step = ai_bt_step;
+    ai->quantum = 1;
+    ai->job = JOB_NONE;
+    ai->tree = tree;
+    ai->slots = bt_attach(&ai->world->bt, tree);
+    task_init(&ai->task);
+    if (!task_alloc(ai->world, &ai->task, 1))
+        action_init(ai->task.actions);
+}
+
+static void
+ai_bt_step(struct ai *ai) {
+    if (ai->task.n)
+        bt_run(ai);
+}
+
+/*
+ * coroutine ai, see co.h
+ */
+
+static void ai_co_step(struct ai *ai);
+
+void
+ai_co_init(struct ai *ai, co_func func) {
+    ai->step = ai_co_step;
+    ai->quantum = 1;
+    ai->job = JOB_NONE;
+    ai->tree = -1;
+    ai->co.func = func;
+    ai->co.line = 0;
+    action_init(&ai->co.a);
+    task_init(&ai->task);
+}
+
+static void
+ai_co_step(struct ai *ai) {
+    ai->co.func(ai);
+}
@@ -3,9 +3,25 @@
 
 struct ai;
 struct path;
+struct world;
+struct task;
+struct action;
 
+/* the unit of the ai, ais are parallel to units */
+#define ai_index(ai)    ((int)((ai) - (ai)->world->ais))
+#define ai_unit(ai)     (&(ai)->world->units[ ai_index(ai) ])
+
+void action_init(struct action *a);
+void task_init(struct task *t);
+void task_free(struct world *w, struct task *t);
+int task_alloc(struct world *w, struct task *t, int n);
+int ai_unit_step(struct ai *ai, struct action *a);
+int ai_job_step(struct ai *ai);
+void ai_rand_walk(struct ai *ai, struct action *a);
 void ai_player_init(struct ai *ai);
 void ai_human_init(struct ai *ai);
+void ai_bt_init(struct ai *ai, int tree);
+void ai_co_init(struct ai *ai, enum co_status (*func)(struct ai *ai));
 void ai_add_task_from_path(struct ai* ai, struct path p);
 
 #endif /* _AI_H_ */
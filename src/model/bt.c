@@ -0,0 +1,338 @@
+#include "bt.h"
+#include "ai.h"
+#include "jobs.h"
+#include "res.h"
+#include "app.h"
+#include "serial.h"
+#include "stb_ds.h"
+#include <string.h>
+
+/* opcodes */
+enum bt_op {
+    OP_SELECTOR = 0,
+    OP_SEQUENCE,
+    OP_INVERT,
+    OP_COOLDOWN,
+    OP_CHANCE,
+    OP_NEAR_RESOURCE,
+    OP_STAY,
+    OP_WANDER,
+    OP_WORK,
+    OP_MAX
+};
+
+static const char *op_names[OP_MAX] = {
+    "selector", "sequence", "invert", "cooldown", "chance", "near_resource", "stay", "wander", "work"
+};
+
+/* node header */
+#define N_OP    0
+#define N_SIZE  1
+#define N_SLOT  2
+#define N_ARGS  3
+
+static int compile(struct behaviors *b, struct jq_value *v, int *slots);
+static enum bt_status run_node(struct ai *ai, int *code, int pc, int *slots, int prev, int *running);
+
+void
+bt_init(struct behaviors *b) {
+    b->code = NULL;
+    b->trees = NULL;
+    b->slots = NULL;
+}
+
+void
+bt_free(struct behaviors *b) {
+    for (int i = 0, ie = arrlen(b->trees); i != ie; ++i)
+        arrfree(b->trees[i].free);
+
+    arrfree(b->code);
+    arrfree(b->trees);
+    arrfree(b->slots);
+}
+
+/* reads and compiles the 'behaviors' object of world json, v can be NULL */
+int
+bt_read(struct behaviors *b, struct jq_value *v) {
+    struct jq_pair *p;
+
+    if (!v) return 0;
+
+    if (!jq_isobject(v)) {
+        app_warning("'behaviors' should be an object");
+        return 1;
+    }
+
+    jq_foreach_object(p, v) {
+        /* slot 0 is the running leaf */
+        struct bt t = { p->key, arrlen(b->code), 1, NULL };
+        if (compile(b, &p->value, &t.slots)) {
+            app_warning("Error in behavior '%s'", p->key);
+            return 1;
+        }
+
+        arrput(b->trees, t);
+    }
+
+    return 0;
+}
+
+/* returns index of the tree, -1 if it's not found */
+int
+bt_find(struct behaviors *b, const char *name) {
+    for (int i = 0, ie = arrlen(b->trees); i != ie; ++i) {
+        if (!strcmp(b->trees[i].name, name))
+            return i;
+    }
+
+    return -1;
+}
+
+/* drops slots of all the ais */
+void
+bt_reset(struct behaviors *b) {
+    arrsetlen(b->slots, 0);
+    for (int i = 0, ie = arrlen(b->trees); i != ie; ++i)
+        arrsetlen(b->trees[i].free, 0);
+}
+
+/* takes slots for an ai running the tree, returns their offset */
+int
+bt_attach(struct behaviors *b, int tree) {
+    struct bt *t = &b->trees[tree];
+    int offset;
+
+    if (arrlen(t->free)) {
+        offset = arrpop(t->free);
+    } else {
+        offset = arrlen(b->slots);
+        arrsetlen(b->slots, offset + t->slots);
+    }
+
+    b->slots[offset] = -1;
+    for (int i = 1; i != t->slots; ++i)
+        b->slots[offset + i] = 0;
+
+    return offset;
+}
+
+/* releases slots of a removed ai, they are reused by the next ai of the tree */
+void
+bt_detach(struct behaviors *b, int tree, int offset) {
+    arrput(b->trees[tree].free, offset);
+}
+
+/* evaluates the tree of the ai once */
+enum bt_status
+bt_run(struct ai *ai) {
+    struct behaviors *b = &ai->world->bt;
+    int *slots = b->slots + ai->slots;
+    int running = -1;
+
+    enum bt_status rv = run_node(ai, b->code, b->trees[ai->tree].root, slots, slots[0], &running);
+    slots[0] = running;
+    return rv;
+}
+
+/* appends the node and its children to the code */
+static int
+compile(struct behaviors *b, struct jq_value *v, int *slots) {
+    struct jq_value *k, *c;
+    int op = OP_MAX, slot = -1, arg;
+    int pc = arrlen(b->code);
+
+    if (!jq_isobject(v)) {
+        app_warning("behavior node should be an object");
+        return 1;
+    }
+
+    k = jq_find(v, "type", 0);
+    if (k && jq_isstring(k)) {
+        for (op = 0; op != OP_MAX && strcmp(op_names[op], k->value.string); ++op);
+    }
+    if (op == OP_MAX) {
+        app_warning("'type' of behavior node is not found or unknown");
+        return 1;
+    }
+
+    if (op == OP_SEQUENCE || op == OP_COOLDOWN)
+        slot = (*slots)++;
+
+    arrput(b->code, op);
+    arrput(b->code, 0);
+    arrput(b->code, slot);
+
+    switch (op) {
+    case OP_SELECTOR:
+    case OP_SEQUENCE:
+        k = jq_find(v, "children", 0);
+        if (!k || !jq_isarray(k)) {
+            app_warning("'children' of '%s' should be an array", op_names[op]);
+            return 1;
+        }
+        arrput(b->code, jq_array_length(k));
+        jq_foreach_array(c, k) {
+            if (compile(b, c, slots)) return 1;
+        }
+        break;
+
+    case OP_COOLDOWN:
+        if (read_int(v, "behavior", "ticks", 1, INT_MAX, READ_REQUIRED, &arg)) return 1;
+        arrput(b->code, arg);
+        /* fall through */
+    case OP_INVERT:
+        k = jq_find(v, "child", 0);
+        if (!k) {
+            app_warning("'child' of '%s' is not found", op_names[op]);
+            return 1;
+        }
+        if (compile(b, k, slots)) return 1;
+        break;
+
+    case OP_CHANCE:
+        k = jq_find(v, "p", 0);
+        if (!k || !jq_isnumber(k)) {
+            app_warning("'p' of 'chance' is not found or not a number");
+            return 1;
+        }
+        /* probability in 1/65536 */
+        arrput(b->code, trim(0, 65536, (jq_isreal(k) ? k->value.real : k->value.integer) * 65536.));
+        break;
+
+    case OP_NEAR_RESOURCE:
+        k = jq_find(v, "resource", 0);
+        arg = RT_UNKNOWN;
+        if (k && jq_isstring(k)) {
+            for (int i = 1; i != RT_MAX; ++i) {
+                if (!strcmp(res_type_name(i), k->value.string))
+                    arg = i;
+            }
+        }
+        if (arg == RT_UNKNOWN) {
+            app_warning("'resource' of 'near_resource' is not found or unknown");
+            return 1;
+        }
+        arrput(b->code, arg);
+        if (read_int(v, "behavior", "radius", 0, 1024, READ_REQUIRED, &arg)) return 1;
+        arrput(b->code, arg);
+        break;
+
+    case OP_STAY:
+        if (read_int(v, "behavior", "ticks", 1, INT_MAX, READ_REQUIRED, &arg)) return 1;
+        arrput(b->code, arg);
+        break;
+
+    default:
+        break;
+    }
+
+    b->code[pc + N_SIZE] = arrlen(b->code) - pc;
+    return 0;
+}
+
+/* steps the action of the leaf, the leaf is running until the action is over */
+static enum bt_status
+run_action(struct ai *ai, struct action *a, int *running, int pc) {
+    if (ai_unit_step(ai, a)) {
+        *running = pc;
+        return BT_RUNNING;
+    }
+
+    return BT_SUCCESS;
+}
+
+static enum bt_status
+run_node(struct ai *ai, int *code, int pc, int *slots, int prev, int *running) {
+    int *n = code + pc;
+    int child = pc + N_ARGS;
+    enum bt_status rv;
+    struct action *a = ai->task.actions;
+
+    switch (n[N_OP]) {
+    case OP_SELECTOR:
+        child += 1;
+        for (int i = 0, num = n[N_ARGS]; i != num; ++i, child += code[child + N_SIZE]) {
+            if ((rv = run_node(ai, code, child, slots, prev, running)) != BT_FAILURE)
+                return rv;
+        }
+        return BT_FAILURE;
+
+    case OP_SEQUENCE: {
+        /* resuming only if the running leaf is within the sequence */
+        int i = prev > pc && prev < pc + n[N_SIZE] ? slots[ n[N_SLOT] ] : 0;
+        child += 1;
+        for (int k = 0; k != i; ++k)
+            child += code[child + N_SIZE];
+
+        rv = BT_SUCCESS;
+        for (int num = n[N_ARGS]; i != num; ++i, child += code[child + N_SIZE]) {
+            rv = run_node(ai, code, child, slots, prev, running);
+            if (rv == BT_RUNNING) {
+                slots[ n[N_SLOT] ] = i;
+                return rv;
+            }
+            if (rv == BT_FAILURE)
+                break;
+        }
+        slots[ n[N_SLOT] ] = 0;
+        return rv;
+    }
+
+    case OP_INVERT:
+        rv = run_node(ai, code, child, slots, prev, running);
+        return rv == BT_RUNNING ? rv : rv == BT_SUCCESS ? BT_FAILURE : BT_SUCCESS;
+
+    case OP_COOLDOWN:
+        /* the slot is the tick the child may run again */
+        if (ai->world->tick < (unsigned)slots[ n[N_SLOT] ])
+            return BT_FAILURE;
+        rv = run_node(ai, code, child + 1, slots, prev, running);
+        if (rv != BT_RUNNING)
+            slots[ n[N_SLOT] ] = ai->world->tick + n[N_ARGS];
+        return rv;
+
+    case OP_CHANCE:
+        return (int)(mt_random_uint32(ai->world->mt) & 0xffff) < n[N_ARGS] ? BT_SUCCESS : BT_FAILURE;
+
+    case OP_NEAR_RESOURCE: {
+        struct vec2 from = { ai_unit(ai)->coords.x >> TILE_SHIFT, ai_unit(ai)->coords.y >> TILE_SHIFT }, to;
+        return res_nearest(&ai->world->recources, n[N_ARGS], from, n[N_ARGS + 1], &to) ? BT_FAILURE : BT_SUCCESS;
+    }
+
+    case OP_STAY:
+        /* the task of an assigned job is not ours */
+        if (ai->job >= 0)
+            return BT_FAILURE;
+        if (prev != pc) {
+            a->type = A_STAY;
+            a->act.stay.cnt = n[N_ARGS];
+        }
+        return run_action(ai, a, running, pc);
+
+    case OP_WANDER:
+        if (ai->job >= 0)
+            return BT_FAILURE;
+        if (prev != pc)
+            ai_rand_walk(ai, a);
+        return run_action(ai, a, running, pc);
+
+    case OP_WORK:
+        if (ai->job >= 0) {
+            if (ai_job_step(ai)) {
+                *running = pc;
+                return BT_RUNNING;
+            }
+            return BT_SUCCESS;
+        }
+
+        /* waiting for the job board, the tree does something else meanwhile */
+        if (ai->job == JOB_NONE) {
+            ai->job = JOB_WAITING;
+            jobs_add_idle(&ai->world->jobs, handles_at(&ai->world->unit_handles, ai_index(ai)));
+        }
+        return BT_FAILURE;
+
+    default:
+        return BT_FAILURE;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef _BT_H_
+#define _BT_H_
+
+#include "types.h"
+
+/* Behavior trees
+ *
+ * Trees of world json are compiled into one flat array of ints. Every node
+ * is a header (opcode, size of the node with its children, slot) followed
+ * by its arguments and then by its children, so the next sibling is at
+ * offset + size and a node contains the offsets [offset, offset + size).
+ * Evaluation walks the array, there are no node pointers and nothing is
+ * allocated per tick.
+ *
+ * State of the nodes is held in per-ai int slots, slot 0 is the offset of
+ * the leaf which was running on the previous step. Selectors are reactive
+ * and evaluated from the first child every step, sequences resume from
+ * the running child only if the running leaf is within them.
+ *
+ * Nodes:
+ *     { "type": "selector", "children": [ ... ] }
+ *     { "type": "sequence", "children": [ ... ] }
+ *     { "type": "invert", "child": { ... } }
+ *     { "type": "cooldown", "ticks": 60, "child": { ... } }
+ *     { "type": "chance", "p": 0.1 }
+ *     { "type": "near_resource", "resource": "wood", "radius": 8 }
+ *     { "type": "stay", "ticks": 30 }
+ *     { "type": "wander" }
+ *     { "type": "work" }       takes jobs from the job board
+ *
+ * World json:
+ *     "behaviors": { "worker": { "type": "selector", "children": [ ... ] } }
+ *     "units": [ { ..., "behavior": "worker" } ]
+ */
+
+enum bt_status {
+    BT_FAILURE = 0,
+    BT_SUCCESS,
+    BT_RUNNING
+};
+
+struct jq_value;
+
+void bt_init(struct behaviors *b);
+void bt_free(struct behaviors *b);
+int bt_read(struct behaviors *b, struct jq_value *v);
+int bt_find(struct behaviors *b, const char *name);
+void bt_reset(struct behaviors *b);
+int bt_attach(struct behaviors *b, int tree);
+void bt_detach(struct behaviors *b, int tree, int offset);
+enum bt_status bt_run(struct ai *ai);
+
+#endif /* _BT_H_ */
@@ -0,0 +1,561 @@
+#include "cache.h"
+#include "gen.h"
+#include "map.h"
+#include "res.h"
+#include "tpool.h"
+#include "app.h"
+#include "serial.h"
+#include "stb_ds.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+  #include <sys/mman.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <utime.h>
+  #include <dirent.h>
+#else
+  #include <direct.h>
+#endif
+
+#define CACHE_MAGIC     "SOCWORLD"
+#define CACHE_FORMAT    1       /* to be bumped whenever the file layout changes */
+#define CACHE_ALIGN     64      /* tiles start at a cache line */
+#define CACHE_SECTIONS  (3 + 2 * RT_MAX + 1)
+#define CACHE_BATCH     64      /* chunks made and written at once, 512 KB */
+
+#define FNV_OFFSET      0xcbf29ce484222325ULL
+#define FNV_PRIME       0x100000001b3ULL
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+/* the fields up to 'units' are the key */
+struct cache_header {
+    char magic[8];
+    uint32_t format;
+    uint32_t gen_version;
+    uint64_t json_hash;
+    uint32_t seed;
+    int32_t rand;
+    struct vec2 size;
+    int32_t layout;
+    int32_t units;              /* number of units */
+    uint64_t tiles;             /* offset of the tiles of the chunks */
+    uint64_t file_size;
+};
+
+struct section {
+    void *data;
+    size_t size;
+};
+
+/* world file in the cache directory */
+struct cache_file {
+    long long used;             /* modification time */
+    long long size;
+    char name[32];              /* key.world */
+};
+
+struct cache_job {
+    struct map *map;
+    int first;                  /* chunk of the batch */
+    struct tile *tiles;         /* MAP_CHUNK_TILES per chunk of the batch */
+};
+
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t n);
+static uint64_t hash_json(uint64_t h, struct jq_value *v);
+static void make_header(struct world *w, struct vec2 size, uint32_t seed, struct cache_header *h);
+static void file_name(struct world *w, struct cache_header *h, char *buf, size_t n);
+static int sections(struct world *w, struct section *s);
+static size_t sections_size(struct world *w, struct vec2 size, int units);
+static int check_units(struct world *w, struct vec2 size, const char *p, int n);
+static int make_dir(const char *path);
+static void evict(struct world *w, const char *keep);
+#ifndef _WIN32
+static int file_cmp(const void *a, const void *b);
+#endif
+static void *map_file(const char *path, size_t *size);
+static void unmap_file(void *p, size_t size);
+
+/* reads the 'cache' key of world json, v can be NULL; the directory is
+ * made here, the cache is disabled if it can't be
+ */
+int
+cache_read(struct world *w, struct jq_value *v) {
+    struct jq_value *k;
+
+    free(w->cache);
+    w->cache = NULL;
+    w->cache_limit = 1024;
+
+    if (!v) {
+        w->cache = strdup("cache");
+    } else if (jq_isstring(v)) {
+        w->cache = strdup(v->value.string);
+    } else if (jq_isobject(v)) {
+        k = jq_find(v, "dir", 0);
+        if (k && !jq_isstring(k)) {
+            app_warning("'cache.dir' should be a directory name");
+            return 1;
+        }
+        w->cache = strdup(k ? k->value.string : "cache");
+        if (read_int(v, "cache", "limit", 1, INT_MAX, w->cache_limit, &w->cache_limit)) return 1;
+    } else if (!jq_isfalse(v)) {
+        app_warning("'cache' should be a directory name, an object or false");
+        return 1;
+    }
+
+    if (w->cache && make_dir(w->cache)) {
+        app_warning("Can't make world cache directory '%s', the cache is disabled", w->cache);
+        free(w->cache);
+        w->cache = NULL;
+    }
+
+    return 0;
+}
+
+/* takes the world generated by seed from the cache, the map is to be reset
+ * to size just before; returns 1 on a miss, nothing is changed then
+ */
+int
+cache_load(struct world *w, struct vec2 size, uint32_t seed) {
+    struct cache_header key, *h;
+    struct section s[CACHE_SECTIONS];
+    char path[4096];
+    size_t len;
+    char *base, *p;
+
+    if (!w->cache)
+        return 1;
+
+    make_header(w, size, seed, &key);
+    file_name(w, &key, path, sizeof(path));
+    base = map_file(path, &len);
+    if (!base)
+        return 1;
+
+    /* the sections are to end at the padding before the tiles, nothing is
+     * sized by the file before that's known
+     */
+    h = (struct cache_header *)base;
+    if (len < sizeof(*h) || memcmp(h, &key, offsetof(struct cache_header, units)) ||
+        h->file_size != len || h->units < 0 || h->units >= HANDLE_INDEX_MASK || h->tiles < sizeof(*h) ||
+        h->tiles + sizeof(struct tile) * MAP_CHUNK_TILES * w->map.chunks.x * w->map.chunks.y != len) {
+        app_warning("World cache '%s' doesn't match, the world is generated again", path);
+        unmap_file(base, len);
+        return 1;
+    }
+
+    size_t off = sizeof(*h) + sections_size(w, size, h->units);
+    if (off + (CACHE_ALIGN - off % CACHE_ALIGN) % CACHE_ALIGN != h->tiles ||
+        check_units(w, size, base + sizeof(*h) + sizeof(*w->mt), h->units)) {
+        app_warning("World cache '%s' doesn't match, the world is generated again", path);
+        unmap_file(base, len);
+        return 1;
+    }
+
+    /* the sections are sized first, then filled */
+    mt_state mt = *w->mt;
+    arrsetlen(w->units, h->units);
+    res_reset(&w->recources, size);
+    p = base + sizeof(*h);
+    for (int i = 0, n = sections(w, s); i != n; ++i) {
+        memcpy(s[i].data, p, s[i].size);
+        p += s[i].size;
+    }
+
+    handles_clear(&w->unit_handles);
+    for (int i = 0; i != h->units; ++i) {
+        struct unit *u = &w->units[i];
+        handle uh = handles_add(&w->unit_handles);
+
+        /* slots retired by earlier worlds may leave too few, the world is
+         * generated then as if nothing was loaded
+         */
+        if (uh == HANDLE_NONE) {
+            app_warning("No handles left for the units of world cache '%s'", path);
+            *w->mt = mt;
+            map_reset(&w->map, size);
+            handles_clear(&w->unit_handles);
+            unmap_file(base, len);
+            return 1;
+        }
+        map_set_unit(&w->map, u->coords.x >> TILE_SHIFT, u->coords.y >> TILE_SHIFT, uh);
+    }
+
+    w->map.cached = (const struct tile *)(base + h->tiles);
+    w->map.cache_base = base;
+    w->map.cache_size = len;
+
+#ifndef _WIN32
+    /* the file is used now, it's the last to be evicted */
+    utime(path, NULL);
+#endif
+    return 0;
+}
+
+static void
+save_chunks(void *data, int begin, int end) {
+    struct cache_job *job = data;
+    struct map *m = job->map;
+    struct map_chunk c;
+
+    for (int i = begin; i != end; ++i) {
+        struct tile *out = job->tiles + (size_t)i * MAP_CHUNK_TILES;
+        int k = job->first + i;
+        int cx = k % m->chunks.x, cy = k / m->chunks.x;
+
+        /* swapped chunks are read back, the rest are made again */
+        if (!m->chunk[k] && (m->flags[k] & MC_SWAPPED))
+            map_get_tile(m, cx << MAP_CHUNK_SHIFT, cy << MAP_CHUNK_SHIFT);
+
+        if (m->chunk[k]) {
+            memcpy(out, m->chunk[k]->tiles, sizeof(c.tiles));
+        } else {
+            gen_chunk(m, &c, cx, cy);
+            memcpy(out, c.tiles, sizeof(c.tiles));
+        }
+    }
+}
+
+/* saves the world just generated by seed, before ais are made and the
+ * first tick; the file is written aside and renamed, so a reader never
+ * sees a part of it. The tiles are made on the thread pool and written
+ * CACHE_BATCH chunks at a time, so the map is never held in memory whole
+ */
+int
+cache_save(struct world *w, struct vec2 size, uint32_t seed) {
+    static const char zeros[CACHE_ALIGN] = { 0 };
+    struct cache_header h;
+    struct section s[CACHE_SECTIONS];
+    struct cache_job job = { &w->map, 0, NULL };
+    char path[4096], tmp[4096 + 8];
+    int chunks = w->map.chunks.x * w->map.chunks.y;
+    size_t chunk_size = sizeof(struct tile) * MAP_CHUNK_TILES;
+    size_t off = sizeof(h), pad;
+    int n, rv = 1;
+
+    if (!w->cache)
+        return 1;
+
+    make_header(w, size, seed, &h);
+    file_name(w, &h, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    n = sections(w, s);
+    for (int i = 0; i != n; ++i)
+        off += s[i].size;
+    pad = (CACHE_ALIGN - off % CACHE_ALIGN) % CACHE_ALIGN;
+    h.units = arrlen(w->units);
+    h.tiles = off + pad;
+    h.file_size = h.tiles + chunk_size * chunks;
+
+    job.tiles = malloc(chunk_size * CACHE_BATCH);
+    if (!job.tiles) {
+        app_warning("Can't allocate %zu bytes for world cache '%s'", chunk_size * CACHE_BATCH, path);
+        return 1;
+    }
+
+    SDL_RWops *f = SDL_RWFromFile(tmp, "wb");
+    if (!f) {
+        app_warning("Can't open world cache '%s': %s", tmp, SDL_GetError());
+        free(job.tiles);
+        return 1;
+    }
+
+    if (SDL_RWwrite(f, &h, sizeof(h), 1) != 1)
+        goto done;
+    for (int i = 0; i != n; ++i) {
+        if (s[i].size && SDL_RWwrite(f, s[i].data, s[i].size, 1) != 1)
+            goto done;
+    }
+    if (pad && SDL_RWwrite(f, zeros, pad, 1) != 1)
+        goto done;
+    for (; job.first < chunks; job.first += CACHE_BATCH) {
+        int batch = min(CACHE_BATCH, chunks - job.first);
+        tpool_for(batch, 1, save_chunks, &job);
+        if (SDL_RWwrite(f, job.tiles, chunk_size * batch, 1) != 1)
+            goto done;
+    }
+    rv = 0;
+
+done:
+    if (rv)
+        app_warning("Can't write world cache '%s': %s", tmp, SDL_GetError());
+    if (SDL_RWclose(f))
+        rv = 1;
+    free(job.tiles);
+
+    if (!rv) {
+        remove(path);
+        if (rename(tmp, path)) {
+            app_warning("Can't rename world cache '%s' to '%s'", tmp, path);
+            rv = 1;
+        }
+    }
+    if (rv)
+        remove(tmp);
+    else
+        evict(w, path);
+
+    return rv;
+}
+
+/* drops the mapping of the map, called when the map is reset or freed */
+void
+cache_unmap(struct map *m) {
+    if (m->cache_base)
+        unmap_file(m->cache_base, m->cache_size);
+
+    m->cached = NULL;
+    m->cache_base = NULL;
+    m->cache_size = 0;
+}
+
+static uint64_t
+hash_bytes(uint64_t h, const void *data, size_t n) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i != n; ++i)
+        h = (h ^ p[i]) * FNV_PRIME;
+    return h;
+}
+
+/* hash of the values of json in the order they are in the file */
+static uint64_t
+hash_json(uint64_t h, struct jq_value *v) {
+    struct jq_value *c;
+    struct jq_pair *pair;
+
+    if (!v)
+        return h;
+
+    h = hash_bytes(h, &v->type, sizeof(v->type));
+    switch (v->type) {
+    case JQ_V_REAL:
+        return hash_bytes(h, &v->value.real, sizeof(v->value.real));
+    case JQ_V_INTEGER:
+        return hash_bytes(h, &v->value.integer, sizeof(v->value.integer));
+    case JQ_V_STRING:
+        return hash_bytes(h, v->value.string, strlen(v->value.string) + 1);
+    case JQ_V_ARRAY:
+        jq_foreach_array(c, v)
+            h = hash_json(h, c);
+        return h;
+    case JQ_V_OBJECT:
+        jq_foreach_object(pair, v) {
+            h = hash_bytes(h, pair->key, strlen(pair->key) + 1);
+            h = hash_json(h, &pair->value);
+        }
+        return h;
+    default:
+        return h;
+    }
+}
+
+static void
+make_header(struct world *w, struct vec2 size, uint32_t seed, struct cache_header *h) {
+    /* padding is a part of the key as well */
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, CACHE_MAGIC, sizeof(h->magic));
+    h->format = CACHE_FORMAT;
+    h->gen_version = GEN_VERSION;
+    h->json_hash = hash_json(FNV_OFFSET, w->json);
+    h->seed = seed;
+    h->rand = w->rand;
+    h->size = size;
+    h->layout = w->map.layout;
+}
+
+static void
+file_name(struct world *w, struct cache_header *h, char *buf, size_t n) {
+    uint64_t key = hash_bytes(FNV_OFFSET, h, offsetof(struct cache_header, units));
+    snprintf(buf, n, "%s/%016llx.world", w->cache, (unsigned long long)key);
+}
+
+/* makes the directory unless there is one, returns 1 if there is none then */
+static int
+make_dir(const char *path) {
+    struct stat st;
+
+#ifndef _WIN32
+    if (mkdir(path, 0777) && errno != EEXIST)
+        return 1;
+#else
+    if (_mkdir(path) && errno != EEXIST)
+        return 1;
+#endif
+
+    return stat(path, &st) || !(st.st_mode & S_IFDIR);
+}
+
+/* removes the least recently used world files of the cache directory
+ * until the rest are within the limit, keep is never removed
+ */
+static void
+evict(struct world *w, const char *keep) {
+#ifndef _WIN32
+    struct cache_file *files = NULL;
+    long long total = 0, limit = (long long)w->cache_limit << 20;
+    char path[4096];
+    struct dirent *e;
+    DIR *d = opendir(w->cache);
+
+    if (!d)
+        return;
+
+    while ((e = readdir(d))) {
+        struct cache_file f;
+        struct stat st;
+        size_t len = strlen(e->d_name);
+
+        if (len < 6 || len >= sizeof(f.name) || strcmp(e->d_name + len - 6, ".world"))
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", w->cache, e->d_name);
+        if (stat(path, &st) || !S_ISREG(st.st_mode))
+            continue;
+
+        f.used = st.st_mtime;
+        f.size = st.st_size;
+        memcpy(f.name, e->d_name, len + 1);
+        total += f.size;
+        arrput(files, f);
+    }
+    closedir(d);
+
+    if (total > limit)
+        qsort(files, arrlen(files), sizeof(struct cache_file), file_cmp);
+
+    for (int i = 0, ie = arrlen(files); i != ie && total > limit; ++i) {
+        snprintf(path, sizeof(path), "%s/%s", w->cache, files[i].name);
+        if (strcmp(path, keep) && !remove(path))
+            total -= files[i].size;
+    }
+
+    arrfree(files);
+#else
+    (void)w;
+    (void)keep;
+#endif
+}
+
+#ifndef _WIN32
+static int
+file_cmp(const void *a, const void *b) {
+    const struct cache_file *l = a, *r = b;
+    return l->used < r->used ? -1 : l->used > r->used;
+}
+#endif
+
+/* parts of the world between the header and the tiles, the units and the
+ * resource layer are to be sized already
+ */
+static int
+sections(struct world *w, struct section *s) {
+    struct resource_layer *l = &w->recources;
+    int n = 0;
+
+    s[n].data = w->mt;
+    s[n++].size = sizeof(*w->mt);
+    s[n].data = w->units;
+    s[n++].size = sizeof(struct unit) * arrlen(w->units);
+    for (int t = 0; t != RT_MAX; ++t) {
+        s[n].data = l->bits[t];
+        s[n++].size = sizeof(uint64_t) * l->words * l->size.y;
+        s[n].data = l->count[t];
+        s[n++].size = sizeof(int) * l->chunks.x * l->chunks.y;
+    }
+    s[n].data = l->total;
+    s[n++].size = sizeof(l->total);
+    s[n].data = l->amount;
+    s[n++].size = sizeof(uint16_t) * l->size.x * l->size.y;
+
+    return n;
+}
+
+/* bytes of the sections of a world of size and units, the same as the
+ * sections would have after sizing them
+ */
+static size_t
+sections_size(struct world *w, struct vec2 size, int units) {
+    size_t words = (size.x + 63) >> 6;
+    size_t chunks = (size_t)((size.x + RES_CHUNK - 1) >> RES_CHUNK_SHIFT) * ((size.y + RES_CHUNK - 1) >> RES_CHUNK_SHIFT);
+
+    return sizeof(*w->mt) + sizeof(struct unit) * (size_t)units +
+        RT_MAX * (sizeof(uint64_t) * words * size.y + sizeof(int) * chunks) +
+        sizeof(w->recources.total) + sizeof(uint16_t) * size.x * size.y;
+}
+
+/* returns 1 if any of n units at p has a type the world doesn't have or
+ * is off the map of size, the units may be unaligned in the file
+ */
+static int
+check_units(struct world *w, struct vec2 size, const char *p, int n) {
+    struct unit u;
+
+    for (int i = 0; i != n; ++i, p += sizeof(u)) {
+        memcpy(&u, p, sizeof(u));
+        if (u.type < 0 || u.type >= arrlen(w->unit_types) ||
+            u.coords.x < 0 || (u.coords.x >> TILE_SHIFT) >= size.x ||
+            u.coords.y < 0 || (u.coords.y >> TILE_SHIFT) >= size.y)
+            return 1;
+    }
+
+    return 0;
+}
+
+static void *
+map_file(const char *path, size_t *size) {
+#ifndef _WIN32
+    struct stat st;
+    void *p;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    *size = st.st_size;
+    return p;
+#else
+    /* no mmap, the file is read at once */
+    SDL_RWops *f = SDL_RWFromFile(path, "rb");
+    Sint64 sz;
+    void *p;
+
+    if (!f)
+        return NULL;
+
+    sz = SDL_RWsize(f);
+    p = sz > 0 ? malloc(sz) : NULL;
+    if (p && SDL_RWread(f, p, sz, 1) != 1) {
+        free(p);
+        p = NULL;
+    }
+    SDL_RWclose(f);
+
+    *size = sz;
+    return p;
+#endif
+}
+
+static void
+unmap_file(void *p, size_t size) {
+#ifndef _WIN32
+    munmap(p, size);
+#else
+    free(p);
+#endif
+}
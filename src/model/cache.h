@@ -0,0 +1,37 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include "types.h"
+
+/* Generated world cache
+ *
+ * A generated world is saved into one binary file: a header with the key,
+ * then the random generator state, the units, the resource layer and the
+ * tiles of every chunk in the layout of the map. The key is the hash of
+ * world json, the seed, the map size and layout, the random generator and
+ * GEN_VERSION (gen.h), so the file name is made of the key and a file of
+ * another key or version is never taken.
+ *
+ * On a hit the file is memory-mapped, units and resources are copied out
+ * of it and the map reads its chunks from the mapping instead of making
+ * them, until the map is reset. Any file which can't be read or doesn't
+ * match is a miss, the world is generated as usual and saved again.
+ *
+ * The files are kept in their own directory together with the map swap
+ * files (map.h). After a save the least recently loaded or saved files
+ * are removed until the rest are within 'limit' MB; there is no eviction
+ * on Windows yet.
+ *
+ * World json knob, optional:
+ *     "cache": "cache"         directory of the cache, false disables the cache
+ *     "cache": { "dir": "cache", "limit": 1024 }
+ */
+
+struct jq_value;
+
+int cache_read(struct world *w, struct jq_value *v);
+int cache_load(struct world *w, struct vec2 size, uint32_t seed);
+int cache_save(struct world *w, struct vec2 size, uint32_t seed);
+void cache_unmap(struct map *m);
+
+#endif /* _CACHE_H_ */
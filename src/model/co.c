@@ -0,0 +1,112 @@
+#include "co.h"
+#include "ai.h"
+#include "res.h"
+#include "prod.h"
+#include "events.h"
+#include "stb_ds.h"
+#include <string.h>
+
+#define CHOP_RADIUS     32      /* tiles to look for wood within */
+#define CHOP_TICKS      30      /* ticks per piece of wood */
+#define CHOP_CAPACITY   5       /* pieces carried at once */
+#define CHOP_REST       120     /* ticks to stay if there is no wood around */
+
+static enum co_status co_lumberjack(struct ai *ai);
+
+static struct {
+    const char *name;
+    co_func func;
+} routines[] = {
+    { "lumberjack", co_lumberjack }
+};
+
+/* returns the routine, NULL if it's not found */
+co_func
+co_find(const char *name) {
+    for (int i = 0; i != sizeof(routines) / sizeof(routines[0]); ++i) {
+        if (!strcmp(routines[i].name, name))
+            return routines[i].func;
+    }
+
+    return NULL;
+}
+
+static void
+walk_to(struct coroutine *c, struct vec2 tile) {
+    c->a.type = A_WALK;
+    c->a.act.walk.to.x = tile.x << TILE_SHIFT;
+    c->a.act.walk.to.y = tile.y << TILE_SHIFT;
+}
+
+static void
+stay(struct coroutine *c, int ticks) {
+    c->a.type = A_STAY;
+    c->a.act.stay.cnt = ticks;
+}
+
+/* returns the nearest building which receipt consumes the asset, -1 if there is none */
+static int
+find_consumer(struct world *w, enum asset_t asset, struct vec2 from) {
+    struct production *p = &w->prod;
+    int best = -1, best_d = INT_MAX;
+
+    for (int i = 0, ie = arrlen(w->buildings); i != ie && i < arrlen(p->receipt); ++i) {
+        if (!p->in[asset][ p->receipt[i] ])
+            continue;
+
+        int dx = w->buildings[i].coords.x - from.x;
+        int dy = w->buildings[i].coords.y - from.y;
+        if (dx * dx + dy * dy < best_d) {
+            best = i;
+            best_d = dx * dx + dy * dy;
+        }
+    }
+
+    return best;
+}
+
+/*
+ * lumberjack: walks to the nearest wood, chops until full or the wood is
+ * over and carries it to the nearest building which needs wood
+ */
+
+static enum co_status
+co_lumberjack(struct ai *ai) {
+    struct world *w = ai->world;
+    struct coroutine *c = &ai->co;
+    struct chop *s = &c->v.chop;
+    struct vec2 tile = { ai_unit(ai)->coords.x >> TILE_SHIFT, ai_unit(ai)->coords.y >> TILE_SHIFT };
+    int bld;
+
+    co_begin(c);
+
+    if (res_nearest(&w->recources, RT_WOOD, tile, CHOP_RADIUS, &s->wood)) {
+        stay(c, CHOP_REST);
+        co_act(c, ai);
+    } else {
+        walk_to(c, s->wood);
+        co_act(c, ai);
+
+        for (s->carry = 0; s->carry != CHOP_CAPACITY; ++s->carry) {
+            stay(c, CHOP_TICKS);
+            co_act(c, ai);
+            if (!res_take(&w->recources, RT_WOOD, s->wood.x, s->wood.y, 1))
+                break;
+            events_push(&w->events, EV_TILE_CHANGED, HANDLE_NONE, -1, s->wood);
+        }
+
+        bld = find_consumer(w, AT_WOOD, tile);
+        if (s->carry && bld >= 0) {
+            s->building = handles_at(&w->building_handles, bld);
+            walk_to(c, w->buildings[bld].coords);
+            co_act(c, ai);
+
+            /* the building may be removed meanwhile */
+            bld = handles_get(&w->building_handles, s->building);
+            if (bld >= 0)
+                prod_add_stock(&w->prod, bld, AT_WOOD, s->carry);
+        }
+    }
+
+    co_end(c);
+}
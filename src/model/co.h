@@ -0,0 +1,36 @@
+#ifndef _CO_H_
+#define _CO_H_
+
+#include "types.h"
+
+/* Coroutine behaviors
+ *
+ * A routine is a plain function written top down which yields between
+ * ticks (protothread style): co_begin is a switch on the line the routine
+ * stopped at, every yield stores __LINE__ and returns, so the next call
+ * jumps right behind it. The only state is the coroutine of the ai: the
+ * line, the current action and the locals union, nothing is allocated.
+ *
+ * Local variables of the function don't survive a yield, keep them in the
+ * locals union. A routine can't yield from within its own switch, nor use
+ * two yields on one line. Routines start over once they are done.
+ *
+ * Unit types of world json choose a routine by name:
+ *     "units": [ { ..., "routine": "lumberjack" } ]
+ */
+
+#define co_begin(c)             switch ((c)->line) { case 0:
+#define co_end(c)               } (c)->line = 0; return CO_DONE
+
+/* gives the tick away, the routine resumes here on the next step */
+#define co_yield(c)             do { (c)->line = __LINE__; return CO_RUNNING; case __LINE__:; } while (0)
+
+/* yields until cond is true, cond is checked right away as well */
+#define co_wait_until(c, cond)  do { (c)->line = __LINE__; case __LINE__: if (!(cond)) return CO_RUNNING; } while (0)
+
+/* runs the action of the coroutine until it's over */
+#define co_act(c, ai)           co_wait_until(c, !ai_unit_step((ai), &(c)->a))
+
+co_func co_find(const char *name);
+
+#endif /* _CO_H_ */
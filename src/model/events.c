@@ -0,0 +1,53 @@
+#include "events.h"
+#include "stb_ds.h"
+
+void
+events_init(struct world_events *e) {
+    for (int t = 0; t != EV_MAX; ++t) {
+        e->queued[t] = NULL;
+        e->ready[t] = NULL;
+    }
+}
+
+void
+events_free(struct world_events *e) {
+    for (int t = 0; t != EV_MAX; ++t) {
+        arrfree(e->queued[t]);
+        arrfree(e->ready[t]);
+    }
+}
+
+/* drops all the events, arrays keep their capacity */
+void
+events_reset(struct world_events *e) {
+    for (int t = 0; t != EV_MAX; ++t) {
+        arrsetlen(e->queued[t], 0);
+        arrsetlen(e->ready[t], 0);
+    }
+}
+
+void
+events_push(struct world_events *e, enum event_t type, handle unit, int unit_type, struct vec2 tile) {
+    struct event ev = { unit, unit_type, tile };
+    arrput(e->queued[type], ev);
+}
+
+/* hands the queued events over to the consumers, events of the previous
+ * tick are dropped, the arrays are swapped so nothing is reallocated
+ */
+void
+events_flush(struct world_events *e) {
+    for (int t = 0; t != EV_MAX; ++t) {
+        struct event *ready = e->ready[t];
+        e->ready[t] = e->queued[t];
+        e->queued[t] = ready;
+        arrsetlen(e->queued[t], 0);
+    }
+}
+
+/* returns events of the type handed over by the last world_step */
+struct event *
+events_get(struct world_events *e, enum event_t type, int *n) {
+    *n = arrlen(e->ready[type]);
+    return e->ready[type];
+}
@@ -0,0 +1,27 @@
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include "types.h"
+
+/* World events
+ *
+ * Changes of the world are recorded as events, one array per event type,
+ * so a consumer reads only the types it's interested in. Events pushed
+ * since the end of the previous world_step, including the ones of commands
+ * between the ticks, are handed over at the end of world_step and stay
+ * readable until the end of the next one. Consumers drain them right after
+ * world_step and update their derived data (minimap pixels, chunk caches,
+ * path costs and so on) incrementally.
+ *
+ * A new world (gen_world) drops all the events, derived data is to be
+ * rebuilt anyway.
+ */
+
+void events_init(struct world_events *e);
+void events_free(struct world_events *e);
+void events_reset(struct world_events *e);
+void events_push(struct world_events *e, enum event_t type, handle unit, int unit_type, struct vec2 tile);
+void events_flush(struct world_events *e);
+struct event *events_get(struct world_events *e, enum event_t type, int *n);
+
+#endif /* _EVENTS_H_ */
@@ -1,111 +1,410 @@
 #include "gen.h"
 #include "rand.h"
 #include "ai.h"
+#include "jobs.h"
+#include "res.h"
+#include "bt.h"
 #include "tileset.h"
+#include "world.h"
+#include "events.h"
+#include "stats.h"
+#include "influence.h"
+#include "map.h"
+#include "cache.h"
+#include "tpool.h"
+#include "app.h"
 #include "stb_ds.h"
 #include <malloc.h>
+#include <string.h>
 
-int individual_distribute(float *items, float v) {
-    int i, ie;
+/* turns weights into their running sums in place, summed in the order
+ * of the items, so every value maps to the same item as with the weights
+ */
+static void
+individual_cumulate(float *items, int n) {
     float sum = .0;
-    for (i = 0, ie = arrlenu(items); i != ie; ++i) {
+    for (int i = 0; i != n; ++i) {
         sum += items[i];
-        if (v < sum) break;
+        items[i] = sum;
+    }
+}
+
+/* returns the first item which running sum is greater than v, n if there
+ * is none; weights are not negative, so the sums are sorted
+ */
+static int
+individual_distribute(const float *sums, int n, float v) {
+    int lo = 0, hi = n;
+    while (lo != hi) {
+        int mid = (lo + hi) / 2;
+        if (v < sums[mid])
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/* tile types of n tiles of row y from x on, the noise of the row is
+ * computed at once by the batch perlin kernels; a type depends on the
+ * coordinates of the tile only, wherever the span starts
+ */
+void
+gen_types(struct map *map, int x, int y, int n, int *types) {
+    struct map_gen *g = &map->gen;
+    float noise[MAP_CHUNK];
+
+    for (int i = 0; i < n; i += MAP_CHUNK) {
+        int len = n - i < MAP_CHUNK ? n - i : MAP_CHUNK;
+        perlin2d_noise_grid(&g->perlin, (float)(x + i)/64., (float)y/64., 1/64., len, 1, 5, .7, noise);
+        for (int j = 0; j != len; ++j) {
+            float r = .5 + noise[j];
+            types[i + j] = individual_distribute(g->parts, arrlen(g->parts), r * 100.);
+        }
     }
-    return i;
 }
 
+/* types of a row are compared 64 tiles at once, bit by bit */
+#if MAP_CHUNK != 64
+#error "transitions expect chunks of 64 tiles wide"
+#endif
+
+struct transit_job {
+    struct map *map;
+    int *index;                 /* chunks to recompute */
+};
+
+/* bits of the MAP_CHUNK tiles in the middle of a row of MAP_CHUNK + 2
+ * types, ge[k] has the tiles of type k or greater; the generator may give
+ * out type n, so ge is of n + 2 words with ge[n + 1] left empty
+ */
 static void
-gen_map(struct map *map, struct mt_state *mt, struct vec2 size) {
-    map->size = size;
-    map->tiles = malloc(sizeof(struct tile) * size.x * size.y);
+transit_masks(const int *row, int n, uint64_t *ge) {
+    memset(ge, 0, sizeof(uint64_t) * (n + 2));
+    for (int i = 0; i != MAP_CHUNK; ++i)
+        ge[ row[i + 1] ] |= (uint64_t)1 << i;
+    for (int k = n; k > 0; --k)
+        ge[k] |= ge[k + 1];
+}
 
-    float *gen_parts = NULL;
-    arrsetlen(gen_parts, arrlenu(map->tile_types));
-    for (int i = 0, ie = arrlenu(map->tile_types); i != ie; ++i) {
-        gen_parts[i] = map->tile_types[i].gen_part;
-    }
-
-    struct perlin2d perlin;
-    perlin2d_init(&perlin, mt);
-    for (int i = 0, y = 0; y < size.y; ++y) {
-        for (int x = 0; x < size.x; ++x, ++i) {
-            float r = .5 + perlin2d_noise_x(&perlin, (float)x/64., (float)y/64., 5, .7);
-            struct tile tile = {
-                .type = individual_distribute(gen_parts, r * 100.),
-                .tileset_index = 0,
-                .transit_index = 0,
-                .units = { ID_NOTHING }
-            };
-
-            map->tiles[i] = tile;
+/* transitions of chunk cx, cy from types of the chunk with the tiles
+ * around it, row by row: a neighbor has a greater type if it is in ge[k]
+ * and the tile is not for some k, so all the tiles of a row are done with
+ * a few word operations per type; neighbors out of the map don't count
+ */
+static void
+transit_chunk(struct map *map, struct map_chunk *c, const int *types, int cx, int cy) {
+    enum { side = MAP_CHUNK + 2 };
+    int n = arrlen(map->tile_types);
+    int x0 = cx << MAP_CHUNK_SHIFT;
+    int y0 = cy << MAP_CHUNK_SHIFT;
+    int right_tiles = map->size.x - 1 - x0;
+    uint64_t ge[3][n + 2];
+    uint64_t *up = ge[0], *mid = ge[1], *down = ge[2];
+
+    /* tiles which have left and right neighbors on the map */
+    uint64_t left_mask = x0 > 0 ? ~(uint64_t)0 : ~(uint64_t)1;
+    uint64_t right_mask = right_tiles >= MAP_CHUNK ? ~(uint64_t)0 :
+        right_tiles > 0 ? ((uint64_t)1 << right_tiles) - 1 : 0;
+
+    transit_masks(types, n, up);
+    transit_masks(types + side, n, mid);
+
+    for (int y = 0; y != MAP_CHUNK; ++y) {
+        const int *row = types + (y + 1) * side;
+        uint64_t left = 0, above = 0, right = 0, below = 0;
+        uint64_t *tmp;
+
+        transit_masks(row + side, n, down);
+        for (int k = 1; k <= n; ++k) {
+            uint64_t less = ~mid[k];
+            left |= (mid[k] << 1 | (uint64_t)(row[0] >= k)) & less;
+            right |= (mid[k] >> 1 | (uint64_t)(row[side - 1] >= k) << 63) & less;
+            above |= up[k] & less;
+            below |= down[k] & less;
+        }
+
+        left &= left_mask;
+        right &= right_mask;
+        if (y0 + y == 0)
+            above = 0;
+        if (y0 + y >= map->size.y - 1)
+            below = 0;
+
+        struct tile *t = &c->tiles[ map->offset_y[y] ];
+        for (int i = 0; i != MAP_CHUNK; ++i) {
+            t[ map->offset_x[i] ].quad = (left >> i & 1) * neighbor_left | (above >> i & 1) * neighbor_up |
+                (right >> i & 1) * neighbor_right | (below >> i & 1) * neighbor_down;
         }
+
+        tmp = up;
+        up = mid;
+        mid = down;
+        down = tmp;
     }
+}
+
+/* types of the chunk with the tiles around it as they are on the map now,
+ * those out of the map are 0
+ */
+static void
+transit_types(struct map *map, struct map_chunk *c, int cx, int cy, int *types) {
+    enum { side = MAP_CHUNK + 2 };
+    int x0 = cx << MAP_CHUNK_SHIFT;
+    int y0 = cy << MAP_CHUNK_SHIFT;
+    int width = map->chunks.x << MAP_CHUNK_SHIFT;
+    int height = map->chunks.y << MAP_CHUNK_SHIFT;
+    int xb = x0 > 0 ? x0 - 1 : 0;
+    int xe = x0 + MAP_CHUNK < width ? x0 + MAP_CHUNK + 1 : width;
+
+    memset(types, 0, sizeof(int) * side * side);
+    for (int y = -1; y <= MAP_CHUNK; ++y) {
+        int *row = types + (y + 1) * side;
+        int gy = y0 + y;
+
+        if (gy < 0 || gy >= height) {
+            continue;
+        } else if (y < 0 || y == MAP_CHUNK) {
+            map_get_types(map, xb, gy, xe - xb, row + xb - x0 + 1);
+            continue;
+        }
 
-    arrfree(gen_parts);
+        for (int x = 0; x != MAP_CHUNK; ++x)
+            row[x + 1] = c->tiles[ map->offset_x[x] + map->offset_y[y] ].type;
+        if (x0 > 0)
+            map_get_types(map, x0 - 1, gy, 1, row);
+        if (x0 + MAP_CHUNK < width)
+            map_get_types(map, x0 + MAP_CHUNK, gy, 1, row + side - 1);
+    }
+}
+
+/* tiles of chunk cx, cy with their transitions, types of the tiles around
+ * the chunk are generated as well, so the chunk doesn't need its neighbors
+ */
+void
+gen_chunk(struct map *map, struct map_chunk *c, int cx, int cy) {
+    enum { side = MAP_CHUNK + 2 };
+    int types[side * side];
+    int x0 = cx << MAP_CHUNK_SHIFT;
+    int y0 = cy << MAP_CHUNK_SHIFT;
+
+    for (int y = 0; y != side; ++y)
+        gen_types(map, x0 - 1, y0 - 1 + y, side, types + y * side);
+
+    for (int y = 0; y != MAP_CHUNK; ++y) {
+        for (int x = 0; x != MAP_CHUNK; ++x)
+            c->tiles[ map->offset_x[x] + map->offset_y[y] ].type = types[(y + 1) * side + x + 1];
+    }
+
+    transit_chunk(map, c, types, cx, cy);
+    c->used = map->clock;
 }
 
-struct tile *
-map_get_tile(struct map *map, int x, int y) {
-    return map->tiles + map->size.x * y + x;
+static void
+transit_chunks(void *data, int begin, int end) {
+    struct transit_job *job = data;
+    struct map *map = job->map;
+    int types[(MAP_CHUNK + 2) * (MAP_CHUNK + 2)];
+
+    for (int i = begin; i != end; ++i) {
+        int k = job->index[i];
+        int cx = k % map->chunks.x, cy = k / map->chunks.x;
+        transit_types(map, map->chunk[k], cx, cy, types);
+        transit_chunk(map, map->chunk[k], types, cx, cy);
+    }
+}
+
+/* recomputes transitions of all the chunks in memory on the thread pool,
+ * the rest get theirs when they are generated or read back; it's called
+ * by the simulation thread, so no chunk is evicted meanwhile
+ */
+void
+transit_map(struct map *map) {
+    struct transit_job job = { map, NULL };
+
+    for (int i = 0, ie = map->chunks.x * map->chunks.y; i != ie; ++i) {
+        if (map->chunk[i])
+            arrput(job.index, i);
+    }
+
+    tpool_for(arrlen(job.index), 1, transit_chunks, &job);
+    arrfree(job.index);
+}
+
+static void
+transit_tile(struct map *map, int x, int y) {
+    struct tile *t = map_get_tile(map, x, y);
+    int quad = 0;
+
+    if (x > 0 && t->type < map_get_type(map, x - 1, y)) {
+        quad |= neighbor_left;
+    }
+    if (y > 0 && t->type < map_get_type(map, x, y - 1)) {
+        quad |= neighbor_up;
+    }
+    if (x < map->size.x - 1 && t->type < map_get_type(map, x + 1, y)) {
+        quad |= neighbor_right;
+    }
+    if (y < map->size.y - 1 && t->type < map_get_type(map, x, y + 1)) {
+        quad |= neighbor_down;
+    }
+
+    t->quad = quad;
+}
+
+/* recomputes transitions of the tiles of rect r which types have been
+ * changed and of their 4-neighbors, nothing else on the map is touched
+ */
+void
+transit_update_rect(struct map *map, struct recti r) {
+    int x0 = r.x > 0 ? r.x : 0;
+    int x1 = r.x + r.w < map->size.x ? r.x + r.w : map->size.x;
+    int left = r.x > 0 ? r.x - 1 : 0;
+    int right = r.x + r.w < map->size.x ? r.x + r.w + 1 : map->size.x;
+
+    for (int y = r.y - 1; y <= r.y + r.h; ++y) {
+        if (y < 0 || y >= map->size.y)
+            continue;
+
+        if (y < r.y || y == r.y + r.h) {
+            /* the rows above and below, the corners are not neighbors */
+            for (int x = x0; x < x1; ++x)
+                transit_tile(map, x, y);
+        } else {
+            for (int x = left; x < right; ++x)
+                transit_tile(map, x, y);
+        }
+    }
 }
 
+/* the map is generated lazily chunk by chunk, see map.h */
 static void
-transit_map(struct world *w) {
+gen_map(struct world *w, struct vec2 size) {
     struct map *map = &w->map;
-    /* TODO: I should check if tileset 'landset' exists */
-    struct tileset *t = &shgetp_null(w->tilesets, "landset")->value;
-    struct vec2 size = map->size;
-
-    for (int i = 0, y = 0; y < size.y; ++y) {
-        for (int x = 0; x < size.x; ++x, ++i) {
-            int quad = 0;
-            struct tile *tile = map_get_tile(map, x, y);
-            if (x > 0 && tile->type < map_get_tile(map, x - 1, y)->type) {
-                quad |= neighbor_left;
-            }
-            if (y > 0 && tile->type < map_get_tile(map, x, y - 1)->type) {
-                quad |= neighbor_up;
-            }
-            if (x < size.x - 1 && tile->type < map_get_tile(map, x + 1, y)->type) {
-                quad |= neighbor_right;
-            }
-            if (y < size.y - 1 && tile->type < map_get_tile(map, x, y + 1)->type) {
-                quad |= neighbor_down;
-            }
+    struct tileset_hash *landset = shgetp_null(w->tilesets, "landset");
+
+    map_reset(map, size);
+    perlin2d_init(&map->gen.perlin, w->mt);
+
+    arrsetlen(map->gen.parts, arrlenu(map->tile_types));
+    for (int i = 0, ie = arrlenu(map->tile_types); i != ie; ++i) {
+        map->gen.parts[i] = map->tile_types[i].gen_part;
+    }
+    individual_cumulate(map->gen.parts, arrlen(map->gen.parts));
+
+    /* transit indexes of every type and quad, the generator may give out
+     * type n as well
+     */
+    arrfree(map->gen.transit);
+    if (landset) {
+        int n = arrlen(map->tile_types);
+        arrsetlen(map->gen.transit, (n + 1) * 16);
+        for (int t = 0; t <= n; ++t) {
+            for (int quad = 0; quad != 16; ++quad)
+                map->gen.transit[t * 16 + quad] = tileset_quad_get_tile_index(&landset->value, t, quad);
+        }
+    }
+}
+
+/* reports done of total parts of a step of the generation which takes
+ * per mille from to to, returns 1 if the job is cancelled; j can be NULL
+ */
+static int
+gen_report(struct gen_job *j, int from, int to, int done, int total) {
+    if (!j)
+        return 0;
+
+    SDL_AtomicSet(&j->progress, from + (int)((long long)(to - from) * done / (total ? total : 1)));
+    return SDL_AtomicGet(&j->cancel) != 0;
+}
+
+static int
+gen_resources(struct world *w, struct gen_job *j) {
+    struct map *map = &w->map;
+    uint32_t *rnd = malloc(sizeof(uint32_t) * map->size.x);
+    int *types = malloc(sizeof(int) * map->size.x);
+    res_reset(&w->recources, map->size);
 
-            map->tiles[i].tileset_index = tileset_quad_get_tile_index(t, tile->type, 0);
-            map->tiles[i].transit_index = tileset_quad_get_tile_index(t, tile->type, quad);
+    for (int y = 0; y < map->size.y; ++y) {
+        /* a random number per tile which may have a resource, drawn at once */
+        int cnt = 0, k = 0;
+        if (!(y & (MAP_CHUNK - 1)) && gen_report(j, 0, 450, y, map->size.y)) {
+            free(rnd);
+            free(types);
+            return 1;
+        }
+        map_get_types(map, 0, y, map->size.x, types);
+        for (int x = 0; x < map->size.x; ++x)
+            cnt += map->tile_types[ types[x] ].resource != RT_UNKNOWN;
+        mt_fill_uint32(w->mt, rnd, cnt);
+
+        for (int x = 0; x < map->size.x; ++x) {
+            struct tile_t *t = &map->tile_types[ types[x] ];
+            if (t->resource != RT_UNKNOWN && (float)rnd[k++] / (float)0xffffffff < t->resource_part)
+                res_add(&w->recources, t->resource, x, y, t->resource_amount);
         }
     }
+
+    free(rnd);
+    free(types);
+    return 0;
 }
 
-static void 
-gen_units(struct world *w) {
-    float *probs = NULL;
+static int
+gen_units(struct world *w, struct gen_job *j) {
+    int types = arrlen(w->unit_types);
+    int tile_types = arrlen(w->map.tile_types);
+    float *sums = malloc(sizeof(float) * (types ? types : 1) * tile_types);
+    uint32_t *rnd = malloc(sizeof(uint32_t) * w->map.size.x);
+    int *row = malloc(sizeof(int) * w->map.size.x);
+    int full = 0;
     w->units = NULL;
-    arrsetlen(probs, arrlenu(w->unit_types));
+    handles_clear(&w->unit_handles);
+
+    /* running sums of unit probabilities per tile type, the last one is
+     * the probability of a unit at all
+     */
+    for (int k = 0; k != tile_types; ++k) {
+        float *p = sums + k * types;
+        for (int i = 0; i != types; ++i)
+            p[i] = w->unit_types[i].probs[k];
+        individual_cumulate(p, types);
+    }
 
     for (int y = 0, ye = w->map.size.y; y != ye; ++y) {
-        for (int i = y*w->map.size.x, x = 0, xe = w->map.size.x; x != xe; ++i, ++x) {
-            int tile_type = w->map.tiles[i].type;
-            float prob_sum = .0;
-            for (int i = 0, ie = arrlenu(w->unit_types); i != ie; ++i) {
-                float prob = w->unit_types[i].probs[tile_type];
-                probs[i] = prob;
-                prob_sum += prob;
-            }
+        if (!(y & (MAP_CHUNK - 1)) && gen_report(j, 450, 900, y, ye)) {
+            free(sums);
+            free(rnd);
+            free(row);
+            return 1;
+        }
+        mt_fill_uint32(w->mt, rnd, w->map.size.x);
+        map_get_types(&w->map, 0, y, w->map.size.x, row);
+        for (int x = 0, xe = w->map.size.x; x != xe; ++x) {
+            const float *p = sums + row[x] * types;
 
-            float r = (float)mt_random_uint32(w->mt) / (float)0xffffffff;
-            if (r < prob_sum) {
-                struct unit u = { individual_distribute(probs, r), UF_NONE, { x*64, y*64 }, { 0, 0 }, { 0, 0 } };
-                w->map.tiles[i].units[0] = arrlen(w->units);
+            float r = (float)rnd[x] / (float)0xffffffff;
+            if (types && r < p[types - 1]) {
+                int type = individual_distribute(p, types, r);
+                struct unit u = { type, UF_NONE, { x*64, y*64 }, { 0, 0 }, { 0, 0 }, w->unit_types[type].speed };
+                handle h = handles_add(&w->unit_handles);
+                /* the random numbers are drawn anyway, so the rest of the world is the same */
+                if (h == HANDLE_NONE) {
+                    if (!full)
+                        app_warning("There can't be more than %i units, the rest are not generated", (int)arrlen(w->units));
+                    full = 1;
+                    continue;
+                }
+                map_set_unit(&w->map, x, y, h);
                 arrput(w->units, u);
             }
         }
     }
 
-    arrfree(probs);
+    free(sums);
+    free(rnd);
+    free(row);
+    return 0;
 }
 
 static void
@@ -116,33 +415,121 @@ gen_unit_flags(struct world *w) {
 
 static void
 gen_unit_ais(struct world *w) {
-    w->ais = NULL;
+    /* tasks of the previous generation are not needed anymore */
+    arrfree(w->ais);
+    pool_free(&w->pool);
+    bt_reset(&w->bt);
     arrsetlen(w->ais, arrlenu(w->units));
-    for (int i = 0, ie = arrlenu(w->ais); i != ie; ++i) {
-        w->ais[i].world = w;
-        if (w->units[i].flags == UF_PLAYER) {
-            ai_player_init(&w->ais[i]);
-            w->player_ai = &w->ais[i];
-        } else {
-            ai_human_init(&w->ais[i]);
-        }
+    w->player = HANDLE_NONE;
+    for (int i = 0, ie = arrlenu(w->ais); i != ie; ++i)
+        world_init_ai(w, i);
 
-        w->ais[i].unit = &w->units[i];
-    }
+    arrsetlen(w->despawned, 0);
 }
 
-void gen_world(struct world *w, struct vec2 size, uint32_t seed) {
-    gen_map(&w->map, w->mt, size);
-    transit_map(w);
-    gen_units(w);
-    gen_unit_flags(w);
+/* the world depends on the seed, world json and size only, so a world
+ * generated before is taken from the cache; returns 1 if the job is
+ * cancelled, j can be NULL
+ */
+static int
+gen_run(struct world *w, struct vec2 size, uint32_t seed, struct gen_job *j) {
+    rand_init_state(w->mt, w->rand, seed);
+    gen_map(w, size);
+    if (cache_load(w, size, seed)) {
+        if (gen_resources(w, j) || gen_units(w, j))
+            return 1;
+        gen_unit_flags(w);
+        gen_report(j, 900, 950, 0, 1);
+        cache_save(w, size, seed);
+    }
+    if (gen_report(j, 950, 1000, 0, 1))
+        return 1;
     gen_unit_ais(w);
+    jobs_reset(&w->jobs, w->map.size);
+    events_reset(&w->events);
+    stats_reset(w);
+    influence_reset(w);
+    gen_report(j, 950, 1000, 1, 1);
     /*struct map map;
-    struct resource *recources;
     struct unit *units;
     struct building *buildings;
     struct asset *assets;
     struct tool *tools;
     struct receipt *receipts;*/
+    return 0;
+}
+
+void gen_world(struct world *w, struct vec2 size, uint32_t seed) {
+    gen_run(w, size, seed, NULL);
+}
+
+static int
+gen_thread(void *data) {
+    struct gen_job *j = data;
+    int cancelled = gen_run(j->world, j->size, j->seed, j);
+
+    SDL_AtomicSet(&j->state, cancelled ? GS_CANCELLED : GS_DONE);
+    return 0;
 }
 
+void
+gen_job_init(struct gen_job *j) {
+    j->world = NULL;
+    j->size.x = j->size.y = 0;
+    j->seed = 0;
+    j->thread = NULL;
+    SDL_AtomicSet(&j->state, GS_IDLE);
+    SDL_AtomicSet(&j->progress, 0);
+    SDL_AtomicSet(&j->cancel, 0);
+}
+
+/* starts generating w on the generation thread, a job still running is
+ * cancelled first; if there is no thread the world is generated right away
+ */
+int
+gen_start(struct gen_job *j, struct world *w, struct vec2 size, uint32_t seed) {
+    gen_cancel(j);
+    gen_wait(j);
+
+    j->world = w;
+    j->size = size;
+    j->seed = seed;
+    SDL_AtomicSet(&j->progress, 0);
+    SDL_AtomicSet(&j->cancel, 0);
+    SDL_AtomicSet(&j->state, GS_RUNNING);
+
+    j->thread = SDL_CreateThread(gen_thread, "generation", j);
+    if (!j->thread) {
+        app_warning("Can't start generation thread: %s", SDL_GetError());
+        gen_thread(j);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* returns the state of the job, the thread is joined once it's over */
+enum gen_state
+gen_poll(struct gen_job *j) {
+    enum gen_state state = SDL_AtomicGet(&j->state);
+
+    if (state != GS_RUNNING)
+        gen_wait(j);
+
+    return state;
+}
+
+/* asks the job to stop, it stops at the next chunk row */
+void
+gen_cancel(struct gen_job *j) {
+    if (SDL_AtomicGet(&j->state) == GS_RUNNING)
+        SDL_AtomicSet(&j->cancel, 1);
+}
+
+void
+gen_wait(struct gen_job *j) {
+    if (j->thread) {
+        SDL_WaitThread(j->thread, NULL);
+        j->thread = NULL;
+    }
+}
@@ -3,7 +3,49 @@
 
 #include "types.h"
 
+/* to be bumped whenever generated worlds change, see cache.h */
+#define GEN_VERSION 1
+
+/* Background generation
+ *
+ * gen_start generates a world on its own thread while the caller goes on
+ * drawing frames. The job reports the part of the world generated in per
+ * mille after every chunk row of the map and stops at the next chunk row
+ * once it's cancelled; a cancelled world is half generated and is to be
+ * generated again before it's used.
+ *
+ * Nothing but the job fields may be touched until gen_poll tells the job
+ * is over, gen_poll joins the thread then, so everything the thread wrote
+ * into the world is seen by the caller.
+ */
+
+enum gen_state {
+    GS_IDLE = 0,
+    GS_RUNNING,
+    GS_DONE,
+    GS_CANCELLED
+};
+
+struct gen_job {
+    struct world *world;
+    struct vec2 size;
+    uint32_t seed;
+    SDL_Thread *thread;
+    SDL_atomic_t state;     /* enum gen_state */
+    SDL_atomic_t progress;  /* per mille of the world generated */
+    SDL_atomic_t cancel;    /* checked by the thread between chunk rows */
+};
+
 void gen_world(struct world *w, struct vec2 size, uint32_t seed);
+void gen_job_init(struct gen_job *j);
+int gen_start(struct gen_job *j, struct world *w, struct vec2 size, uint32_t seed);
+enum gen_state gen_poll(struct gen_job *j);
+void gen_cancel(struct gen_job *j);
+void gen_wait(struct gen_job *j);
+void gen_types(struct map *map, int x, int y, int n, int *types);
+void gen_chunk(struct map *map, struct map_chunk *c, int cx, int cy);
+void transit_map(struct map *map);
+void transit_update_rect(struct map *map, struct recti r);
 
 #endif /* _GEN_H_ */
 
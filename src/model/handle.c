@@ -0,0 +1,117 @@
+#include "handle.h"
+#include "stb_ds.h"
+
+#define GEN(v)  ((v) >> HANDLE_INDEX_BITS)
+#define MAKE(gen, index)  ((uint32_t)(gen) << HANDLE_INDEX_BITS | (index))
+
+static void release_slot(struct handles *h, uint32_t slot);
+
+void
+handles_init(struct handles *h) {
+    h->slots = NULL;
+    h->dense = NULL;
+    h->free = HANDLE_INDEX_MASK;
+}
+
+void
+handles_free(struct handles *h) {
+    arrfree(h->slots);
+    arrfree(h->dense);
+    h->free = HANDLE_INDEX_MASK;
+}
+
+/* removes all the entities, their handles don't resolve anymore */
+void
+handles_clear(struct handles *h) {
+    h->free = HANDLE_INDEX_MASK;
+    for (int i = arrlen(h->slots) - 1; i >= 0; --i) {
+        if (GEN(h->slots[i]) != HANDLE_GEN_MAX)
+            release_slot(h, i);
+    }
+
+    arrsetlen(h->dense, 0);
+}
+
+/* adds an entity at the end of the dense array, returns its handle or
+ * HANDLE_NONE if all the slots are taken
+ */
+handle
+handles_add(struct handles *h) {
+    uint32_t slot;
+    uint32_t i = arrlen(h->dense);
+
+    if (h->free != HANDLE_INDEX_MASK) {
+        slot = h->free;
+        h->free = h->slots[slot] & HANDLE_INDEX_MASK;
+    } else {
+        slot = arrlen(h->slots);
+        if (slot >= HANDLE_INDEX_MASK)
+            return HANDLE_NONE;
+        arrput(h->slots, 0);
+    }
+
+    h->slots[slot] = MAKE(GEN(h->slots[slot]), i);
+    arrput(h->dense, slot);
+    return MAKE(GEN(h->slots[slot]), slot);
+}
+
+/* returns dense index of the entity, -1 if the handle is stale */
+int
+handles_get(struct handles *h, handle id) {
+    uint32_t slot = id & HANDLE_INDEX_MASK;
+
+    if (id == HANDLE_NONE || slot >= arrlen(h->slots) || GEN(h->slots[slot]) != GEN(id))
+        return -1;
+
+    return h->slots[slot] & HANDLE_INDEX_MASK;
+}
+
+/* removes the entity, returns its dense index or -1 if the handle is stale;
+ * the caller moves the last element of its dense arrays to that index
+ */
+int
+handles_remove(struct handles *h, handle id) {
+    int i = handles_get(h, id);
+    uint32_t slot = id & HANDLE_INDEX_MASK;
+
+    if (i < 0)
+        return -1;
+
+    uint32_t moved = arrpop(h->dense);
+    if (i != arrlen(h->dense)) {
+        h->dense[i] = moved;
+        h->slots[moved] = MAKE(GEN(h->slots[moved]), i);
+    }
+
+    release_slot(h, slot);
+    return i;
+}
+
+/* returns handle of the entity at dense index i */
+handle
+handles_at(struct handles *h, int i) {
+    uint32_t slot = h->dense[i];
+    return MAKE(GEN(h->slots[slot]), slot);
+}
+
+int
+handles_count(struct handles *h) {
+    return arrlen(h->dense);
+}
+
+/* bumps the generation of the slot and puts it to the free list, a slot
+ * reaching the last generation is retired: it resolves nothing and is
+ * never given out again
+ */
+static void
+release_slot(struct handles *h, uint32_t slot) {
+    uint32_t gen = GEN(h->slots[slot]) + 1;
+
+    if (gen == HANDLE_GEN_MAX) {
+        h->slots[slot] = MAKE(gen, HANDLE_INDEX_MASK);
+        return;
+    }
+
+    h->slots[slot] = MAKE(gen, h->free);
+    h->free = slot;
+}
@@ -0,0 +1,46 @@
+#ifndef _HANDLE_H_
+#define _HANDLE_H_
+
+#include <stdint.h>
+
+/* Generational handles
+ *
+ * Entities are kept in dense arrays without holes and referred to by
+ * handles: a slot index and the generation of the slot. A slot maps to
+ * the dense index of its entity, the dense array maps back to the slots.
+ * Removing an entity moves the last one of the dense array to its place
+ * (swap-remove) and bumps the generation of its slot, so old handles of
+ * the slot don't resolve anymore. Free slots are linked into a list,
+ * adding and removing are O(1).
+ *
+ * A handle is 22 bits of slot and 10 bits of generation. Slot
+ * HANDLE_INDEX_MASK ends the free list and is never given out, so there
+ * are at most HANDLE_INDEX_MASK slots; handles_add returns HANDLE_NONE
+ * when they are all taken. A slot which generation reaches HANDLE_GEN_MAX
+ * is retired instead of wrapping to 0, so a stale handle never resolves
+ * again; such slots are not reused until handles_free.
+ */
+
+#define HANDLE_INDEX_BITS   22
+#define HANDLE_INDEX_MASK   ((1u << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GEN_MAX      ((1u << (32 - HANDLE_INDEX_BITS)) - 1)
+#define HANDLE_NONE         UINT32_MAX
+
+typedef uint32_t handle;
+
+struct handles {
+    uint32_t *slots;    /* stb_ds array, generation and dense index, next free slot while free */
+    uint32_t *dense;    /* stb_ds array, slot of every dense element */
+    uint32_t free;      /* first free slot, HANDLE_INDEX_MASK if none */
+};
+
+void handles_init(struct handles *h);
+void handles_free(struct handles *h);
+void handles_clear(struct handles *h);
+handle handles_add(struct handles *h);
+int handles_get(struct handles *h, handle id);
+int handles_remove(struct handles *h, handle id);
+handle handles_at(struct handles *h, int i);
+int handles_count(struct handles *h);
+
+#endif /* _HANDLE_H_ */
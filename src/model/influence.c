@@ -0,0 +1,392 @@
+#include "influence.h"
+#include "events.h"
+#include "map.h"
+#include "prof.h"
+#include "app.h"
+#include "serial.h"
+#include "stb_ds.h"
+#include <malloc.h>
+#include <string.h>
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+#define diagonal(cost) max(1, ((cost) * 14 + 5) / 10)
+
+static void touch(struct influence *inf, struct vec2 tile);
+static void apply(struct world *w, enum event_t type, int add);
+static void compute_chunk(struct world *w, int c);
+
+void
+influence_init(struct influence *inf) {
+    memset(inf, 0, sizeof(*inf));
+    inf->factions = 1;
+    inf->period = 10;
+    inf->unit = 64;
+    inf->building = 128;
+    inf->decay = 8;
+}
+
+void
+influence_free(struct influence *inf) {
+    int chunks = inf->chunks.x * inf->chunks.y;
+
+    for (int i = 0; inf->sources && i != chunks; ++i)
+        arrfree(inf->sources[i]);
+    for (int i = 0; i != 256; ++i)
+        arrfree(inf->buckets[i]);
+
+    arrfree(inf->cost);
+    arrfree(inf->dirty_list);
+    free(inf->sources);
+    free(inf->dirty);
+    free(inf->values);
+    free(inf->owner);
+    free(inf->window);
+    free(inf->costs);
+    inf->sources = NULL;
+    inf->dirty = inf->values = inf->owner = inf->window = NULL;
+    inf->costs = NULL;
+    inf->chunks.x = inf->chunks.y = 0;
+}
+
+/* reads the 'influence' object of world json, v can be NULL */
+int
+influence_read(struct influence *inf, struct jq_value *v, struct unit_t *types) {
+    struct jq_value *k;
+
+    if (!v) {
+        inf->enabled = 0;
+        return 0;
+    }
+
+    if (!jq_isobject(v)) {
+        app_warning("'influence' should be an object");
+        return 1;
+    }
+
+    k = jq_find(v, "enabled", 0);
+    inf->enabled = k ? jq_istrue(k) : 1;
+
+    if (read_int(v, "influence", "factions", 1, INF_FACTIONS, inf->factions, &inf->factions)) return 1;
+    if (read_int(v, "influence", "period", 1, 1024, inf->period, &inf->period)) return 1;
+    if (read_int(v, "influence", "unit", 0, 255, inf->unit, &inf->unit)) return 1;
+    if (read_int(v, "influence", "building", 0, 255, inf->building, &inf->building)) return 1;
+    if (read_int(v, "influence", "decay", 1, 255, inf->decay, &inf->decay)) return 1;
+
+    inf->pass_type = 0;
+    k = jq_find(v, "passability", 0);
+    if (k) {
+        int found = 0;
+        for (int i = 0, ie = arrlen(types); k && jq_isstring(k) && i != ie; ++i) {
+            if (!strcmp(types[i].name, k->value.string)) {
+                inf->pass_type = i;
+                found = 1;
+                break;
+            }
+        }
+
+        if (!found) {
+            app_warning("'influence.passability' should be a name of a unit type");
+            return 1;
+        }
+    }
+
+    for (int i = 0, ie = arrlen(types); i != ie; ++i) {
+        if (types[i].faction >= inf->factions)
+            app_warning("unit '%s' is of faction %i, there are %i factions only", types[i].name, types[i].faction, inf->factions);
+    }
+
+    return 0;
+}
+
+/* sizes the maps for the world map, collects sources of all the units and
+ * buildings and computes everything
+ */
+void
+influence_reset(struct world *w) {
+    struct influence *inf = &w->influence;
+    int min_cost = 255;
+
+    influence_free(inf);
+    if (!inf->enabled || !arrlen(w->unit_types))
+        return;
+
+    inf->size = w->map.size;
+    inf->chunks.x = (inf->size.x + INF_CHUNK - 1) >> INF_CHUNK_SHIFT;
+    inf->chunks.y = (inf->size.y + INF_CHUNK - 1) >> INF_CHUNK_SHIFT;
+
+    /* costs of steps and how far the strongest source can reach */
+    arrsetlen(inf->cost, arrlen(w->map.tile_types));
+    for (int t = 0, te = arrlen(inf->cost); t != te; ++t) {
+        float pass = w->unit_types[ inf->pass_type ].pass[t];
+        inf->cost[t] = pass > 0. ? max(1, (int)(pass * inf->decay + .5)) : 0;
+        if (inf->cost[t])
+            min_cost = min(min_cost, inf->cost[t]);
+    }
+    inf->reach = (max(inf->unit, inf->building) + min_cost - 1) / min_cost;
+
+    int chunks = inf->chunks.x * inf->chunks.y;
+    int side = INF_CHUNK + 2 * inf->reach;
+    inf->sources = calloc(chunks, sizeof(struct inf_source *));
+    inf->dirty = calloc(chunks, 1);
+    inf->values = calloc((size_t)chunks * inf->factions, INF_CHUNK_TILES);
+    inf->owner = malloc((size_t)chunks * INF_CHUNK_TILES);
+    inf->window = malloc((size_t)side * side);
+    inf->costs = malloc(sizeof(int) * side * side);
+    memset(inf->owner, INF_NONE, (size_t)chunks * INF_CHUNK_TILES);
+
+    for (int i = 0, ie = arrlen(w->units); i != ie; ++i) {
+        struct vec2 tile = { w->units[i].coords.x >> TILE_SHIFT, w->units[i].coords.y >> TILE_SHIFT };
+        influence_add_source(inf, tile, w->unit_types[ w->units[i].type ].faction, inf->unit);
+    }
+
+    for (int i = 0, ie = arrlen(w->buildings); i != ie; ++i)
+        influence_add_source(inf, w->buildings[i].coords, w->buildings[i].faction, inf->building);
+
+    for (int c = 0; c != chunks; ++c) {
+        inf->dirty[c] = 1;
+        arrput(inf->dirty_list, c);
+    }
+
+    influence_refresh(w);
+}
+
+/* adds a source and marks chunks within its reach dirty */
+void
+influence_add_source(struct influence *inf, struct vec2 tile, int faction, int strength) {
+    if (!inf->sources || faction < 0 || faction >= inf->factions || !strength)
+        return;
+
+    struct inf_source s = { tile, faction, strength };
+    arrput(inf->sources[ inf->chunks.x * (tile.y >> INF_CHUNK_SHIFT) + (tile.x >> INF_CHUNK_SHIFT) ], s);
+    touch(inf, tile);
+}
+
+void
+influence_remove_source(struct influence *inf, struct vec2 tile, int faction, int strength) {
+    if (!inf->sources || faction < 0 || faction >= inf->factions || !strength)
+        return;
+
+    struct inf_source *s = inf->sources[ inf->chunks.x * (tile.y >> INF_CHUNK_SHIFT) + (tile.x >> INF_CHUNK_SHIFT) ];
+    for (int i = 0, ie = arrlen(s); i != ie; ++i) {
+        if (s[i].tile.x == tile.x && s[i].tile.y == tile.y && s[i].faction == faction && s[i].strength == strength) {
+            arrdelswap(s, i);
+            break;
+        }
+    }
+
+    touch(inf, tile);
+}
+
+/* applies world events handed over by the last world_step, recomputes
+ * dirty chunks every period ticks
+ */
+void
+influence_update(struct world *w) {
+    struct influence *inf = &w->influence;
+    int n;
+    struct event *e;
+
+    if (!inf->sources)
+        return;
+
+    apply(w, EV_UNIT_SPAWNED, 1);
+    apply(w, EV_UNIT_ENTERED, 1);
+    apply(w, EV_UNIT_LEFT, 0);
+    apply(w, EV_UNIT_DIED, 0);
+
+    /* passability may be changed */
+    e = events_get(&w->events, EV_TILE_CHANGED, &n);
+    for (int i = 0; i != n; ++i)
+        touch(inf, e[i].tile);
+
+    if (w->tick % inf->period == 0)
+        influence_refresh(w);
+}
+
+/* recomputes the dirty chunks */
+void
+influence_refresh(struct world *w) {
+    struct influence *inf = &w->influence;
+
+    prof_begin(PROF_INFLUENCE);
+    for (int i = 0, ie = arrlen(inf->dirty_list); i != ie; ++i) {
+        compute_chunk(w, inf->dirty_list[i]);
+        inf->dirty[ inf->dirty_list[i] ] = 0;
+    }
+    prof_count(PROF_INFLUENCE_CHUNKS, arrlen(inf->dirty_list));
+    arrsetlen(inf->dirty_list, 0);
+    prof_end(PROF_INFLUENCE);
+}
+
+/* returns influence of the faction on the tile */
+int
+influence_get(struct influence *inf, int faction, struct vec2 tile) {
+    unsigned char *chunk = influence_chunk(inf, faction, tile.x >> INF_CHUNK_SHIFT, tile.y >> INF_CHUNK_SHIFT);
+    return chunk ? chunk[ INF_CHUNK * (tile.y & (INF_CHUNK - 1)) + (tile.x & (INF_CHUNK - 1)) ] : 0;
+}
+
+/* returns the faction owning the tile, INF_NONE if nobody does */
+int
+influence_owner(struct influence *inf, struct vec2 tile) {
+    if (!inf->owner)
+        return INF_NONE;
+
+    int c = inf->chunks.x * (tile.y >> INF_CHUNK_SHIFT) + (tile.x >> INF_CHUNK_SHIFT);
+    return inf->owner[ c * INF_CHUNK_TILES + INF_CHUNK * (tile.y & (INF_CHUNK - 1)) + (tile.x & (INF_CHUNK - 1)) ];
+}
+
+/* returns INF_CHUNK_TILES values of the faction within the chunk, row by row, NULL if there are none */
+unsigned char *
+influence_chunk(struct influence *inf, int faction, int cx, int cy) {
+    if (!inf->values || faction < 0 || faction >= inf->factions)
+        return NULL;
+
+    return &inf->values[ ((size_t)(inf->chunks.x * cy + cx) * inf->factions + faction) * INF_CHUNK_TILES ];
+}
+
+/* marks chunks within reach of the tile dirty */
+static void
+touch(struct influence *inf, struct vec2 tile) {
+    int cx0 = max(0, tile.x - inf->reach) >> INF_CHUNK_SHIFT;
+    int cy0 = max(0, tile.y - inf->reach) >> INF_CHUNK_SHIFT;
+    int cx1 = min(inf->size.x - 1, tile.x + inf->reach) >> INF_CHUNK_SHIFT;
+    int cy1 = min(inf->size.y - 1, tile.y + inf->reach) >> INF_CHUNK_SHIFT;
+
+    for (int cy = cy0; cy <= cy1; ++cy) {
+        for (int c = inf->chunks.x * cy + cx0, cx = cx0; cx <= cx1; ++c, ++cx) {
+            if (!inf->dirty[c]) {
+                inf->dirty[c] = 1;
+                arrput(inf->dirty_list, c);
+            }
+        }
+    }
+}
+
+/* adds or removes sources of units of the events */
+static void
+apply(struct world *w, enum event_t type, int add) {
+    struct influence *inf = &w->influence;
+    int n;
+    struct event *e = events_get(&w->events, type, &n);
+
+    for (int i = 0; i != n; ++i) {
+        int faction = w->unit_types[ e[i].unit_type ].faction;
+        if (add)
+            influence_add_source(inf, e[i].tile, faction, inf->unit);
+        else
+            influence_remove_source(inf, e[i].tile, faction, inf->unit);
+    }
+}
+
+/* runs the bucket queue for every faction over the window of the chunk
+ * and its surroundings within reach, then updates owners of the chunk
+ */
+static void
+compute_chunk(struct world *w, int c) {
+    struct influence *inf = &w->influence;
+    struct map *map = &w->map;
+    unsigned char *win = inf->window;
+    int *costs = inf->costs;
+    int have_costs = 0;
+    int cx = c % inf->chunks.x;
+    int cy = c / inf->chunks.x;
+
+    /* window in tiles */
+    int x0 = max(0, (cx << INF_CHUNK_SHIFT) - inf->reach);
+    int y0 = max(0, (cy << INF_CHUNK_SHIFT) - inf->reach);
+    int x1 = min(map->size.x, ((cx + 1) << INF_CHUNK_SHIFT) + inf->reach);
+    int y1 = min(map->size.y, ((cy + 1) << INF_CHUNK_SHIFT) + inf->reach);
+    int ww = x1 - x0;
+
+    for (int f = 0; f != inf->factions; ++f) {
+        int top = 0;
+        memset(win, 0, ww * (y1 - y0));
+
+        /* seeding sources within the window */
+        for (int sy = y0 >> INF_CHUNK_SHIFT; sy <= (y1 - 1) >> INF_CHUNK_SHIFT; ++sy) {
+            for (int sx = x0 >> INF_CHUNK_SHIFT; sx <= (x1 - 1) >> INF_CHUNK_SHIFT; ++sx) {
+                struct inf_source *s = inf->sources[ inf->chunks.x * sy + sx ];
+                for (int k = 0, ke = arrlen(s); k != ke; ++k) {
+                    if (s[k].faction != f || s[k].tile.x < x0 || s[k].tile.x >= x1 || s[k].tile.y < y0 || s[k].tile.y >= y1)
+                        continue;
+
+                    int i = ww * (s[k].tile.y - y0) + (s[k].tile.x - x0);
+                    if (s[k].strength > win[i]) {
+                        win[i] = s[k].strength;
+                        arrput(inf->buckets[ s[k].strength ], i);
+                        top = max(top, s[k].strength);
+                    }
+                }
+            }
+        }
+
+        /* step costs of the window are read a row at a time, once for all
+         * the factions, so chunks which aren't made cost a noise batch per
+         * row rather than per tile
+         */
+        if (top && !have_costs) {
+            for (int y = y0; y != y1; ++y) {
+                int *row = costs + ww * (y - y0);
+                map_get_types(map, x0, y, ww, row);
+                for (int x = 0; x != ww; ++x)
+                    row[x] = inf->cost[ row[x] ];
+            }
+            have_costs = 1;
+        }
+
+        /* tiles are settled from the strongest value down */
+        for (int v = top; v > 0; --v) {
+            while (arrlen(inf->buckets[v])) {
+                int i = arrpop(inf->buckets[v]);
+                if (win[i] != v)
+                    continue;
+
+                int x = i % ww, y = i / ww;
+                for (int dy = -1; dy <= 1; ++dy) {
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        int nx = x + dx, ny = y + dy;
+                        if ((!dx && !dy) || nx < 0 || ny < 0 || nx >= ww || y0 + ny >= y1)
+                            continue;
+
+                        int cost = costs[ww * ny + nx];
+                        if (!cost)
+                            continue;
+
+                        int nv = v - (dx && dy ? diagonal(cost) : cost);
+                        int ni = ww * ny + nx;
+                        if (nv > win[ni]) {
+                            win[ni] = nv;
+                            arrput(inf->buckets[nv], ni);
+                        }
+                    }
+                }
+            }
+        }
+
+        /* copying the chunk out of the window, tiles off the map stay 0 */
+        unsigned char *out = influence_chunk(inf, f, cx, cy);
+        for (int y = 0; y != INF_CHUNK; ++y) {
+            int ty = (cy << INF_CHUNK_SHIFT) + y;
+            for (int x = 0; x != INF_CHUNK; ++x) {
+                int tx = (cx << INF_CHUNK_SHIFT) + x;
+                out[INF_CHUNK * y + x] = tx < x1 && ty < y1 ? win[ww * (ty - y0) + (tx - x0)] : 0;
+            }
+        }
+    }
+
+    /* owners, ties go to the lower faction */
+    unsigned char *owner = &inf->owner[ (size_t)c * INF_CHUNK_TILES ];
+    unsigned char best[INF_CHUNK_TILES] = { 0 };
+    memset(owner, INF_NONE, INF_CHUNK_TILES);
+    for (int f = 0; f != inf->factions; ++f) {
+        unsigned char *vals = influence_chunk(inf, f, cx, cy);
+        for (int i = 0; i != INF_CHUNK_TILES; ++i) {
+            if (vals[i] > best[i]) {
+                best[i] = vals[i];
+                owner[i] = f;
+            }
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef _INFLUENCE_H_
+#define _INFLUENCE_H_
+
+#include "types.h"
+
+/* Influence maps
+ *
+ * Every unit and building spreads influence of its faction over the map:
+ * a source of strength s gives a tile s minus the cheapest cost of the way
+ * to it, a step costs decay times passability of the tile stepped on for
+ * the 'passability' unit type (1.4 times more diagonally), impassable tiles
+ * stop it. A tile gets the strongest influence of every faction, 0..255,
+ * and is owned by the faction with the most of it.
+ *
+ * Values are kept in chunks of INF_CHUNK x INF_CHUNK tiles, per faction,
+ * so a chunk of one faction is a compact array of bytes. Moves, spawns and
+ * deaths of units, buildings and tile changes mark chunks within reach
+ * dirty, every 'period' ticks only the dirty chunks are recomputed: a
+ * bucket queue (values are small integers) runs from the sources of the
+ * window around the chunk, nothing outside the window can reach it.
+ *
+ * Values are written by the simulation thread.
+ *
+ * World json knob, all keys are optional:
+ *     "influence": { "enabled": true, "factions": 2, "period": 10, "unit": 64,
+ *                    "building": 128, "decay": 8, "passability": "human" }
+ *     "units": [ { ..., "faction": 1 } ]
+ */
+
+struct jq_value;
+
+void influence_init(struct influence *inf);
+void influence_free(struct influence *inf);
+int influence_read(struct influence *inf, struct jq_value *v, struct unit_t *types);
+void influence_reset(struct world *w);
+void influence_add_source(struct influence *inf, struct vec2 tile, int faction, int strength);
+void influence_remove_source(struct influence *inf, struct vec2 tile, int faction, int strength);
+void influence_update(struct world *w);
+void influence_refresh(struct world *w);
+int influence_get(struct influence *inf, int faction, struct vec2 tile);
+int influence_owner(struct influence *inf, struct vec2 tile);
+unsigned char *influence_chunk(struct influence *inf, int faction, int cx, int cy);
+
+#endif /* _INFLUENCE_H_ */
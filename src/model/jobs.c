@@ -0,0 +1,362 @@
+#include "jobs.h"
+#include "ai.h"
+#include "prod.h"
+#include "prof.h"
+#include "app.h"
+#include "serial.h"
+#include "stb_ds.h"
+#include <malloc.h>
+#include <string.h>
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+static int get_cell(struct job_board *b, struct vec2 coords);
+static void open_job(struct job_board *b, int job);
+static void close_job(struct job_board *b, int job);
+static int find_job(struct job_board *b, struct vec2 coords);
+static void scan_cell(struct job_board *b, struct vec2 coords, int x, int y, int *best, int *best_d);
+static void free_job(struct job_board *b, int job);
+static int assign(struct world *w, struct ai *ai, int job);
+
+void
+jobs_init(struct job_board *b) {
+    b->jobs = NULL;
+    b->free = -1;
+    b->open = 0;
+    b->cell_shift = 3;
+    b->radius = 4;
+    b->budget = 256;
+    b->work = 120;
+    /* a single cell until the map size is known */
+    b->size.x = b->size.y = 1;
+    b->cells = calloc(1, sizeof(int *));
+    b->idle = NULL;
+    b->idle_head = 0;
+    b->assigned = 0;
+    b->done = 0;
+}
+
+void
+jobs_free(struct job_board *b) {
+    for (int i = 0, ie = b->size.x * b->size.y; i != ie; ++i)
+        arrfree(b->cells[i]);
+
+    free(b->cells);
+    b->cells = NULL;
+    arrfree(b->jobs);
+    arrfree(b->idle);
+}
+
+/* reads the 'jobs' object of world json, v can be NULL */
+int
+jobs_read(struct job_board *b, struct jq_value *v) {
+    int cell;
+
+    if (!v) return 0;
+
+    if (!jq_isobject(v)) {
+        app_warning("'jobs' should be an object");
+        return 1;
+    }
+
+    if (read_int(v, "jobs", "cell", 1, 256, 1 << b->cell_shift, &cell)) return 1;
+    if (read_int(v, "jobs", "radius", 0, 1024, b->radius, &b->radius)) return 1;
+    if (read_int(v, "jobs", "budget", 1, 1 << 20, b->budget, &b->budget)) return 1;
+    if (read_int(v, "jobs", "work", 1, 1 << 20, b->work, &b->work)) return 1;
+
+    for (b->cell_shift = 0; (1 << (b->cell_shift + 1)) <= cell; ++b->cell_shift);
+    if (1 << b->cell_shift != cell)
+        app_warning("'jobs.cell' should be a power of two, set to %i", 1 << b->cell_shift);
+
+    return 0;
+}
+
+/* sizes the grid for the map and empties the idle queue, assigned jobs
+ * are open again as the units are generated anew
+ */
+void
+jobs_reset(struct job_board *b, struct vec2 map_size) {
+    for (int i = 0, ie = b->size.x * b->size.y; i != ie; ++i)
+        arrfree(b->cells[i]);
+    free(b->cells);
+
+    b->size.x = max((map_size.x + (1 << b->cell_shift) - 1) >> b->cell_shift, 1);
+    b->size.y = max((map_size.y + (1 << b->cell_shift) - 1) >> b->cell_shift, 1);
+    b->cells = calloc(b->size.x * b->size.y, sizeof(int *));
+
+    arrsetlen(b->idle, 0);
+    b->idle_head = 0;
+
+    b->open = 0;
+    for (int i = 0, ie = arrlen(b->jobs); i != ie; ++i) {
+        if (b->jobs[i].type != J_NONE)
+            open_job(b, i);
+    }
+}
+
+/* adds an open job, returns its index */
+int
+jobs_post(struct job_board *b, struct job *j) {
+    int i = b->free;
+
+    if (i >= 0) {
+        b->free = b->jobs[i].slot;
+        b->jobs[i] = *j;
+    } else {
+        i = arrlen(b->jobs);
+        arrput(b->jobs, *j);
+    }
+
+    open_job(b, i);
+    return i;
+}
+
+void
+jobs_add_idle(struct job_board *b, handle unit) {
+    arrput(b->idle, unit);
+}
+
+/* matches at most budget waiting units to the nearest open jobs,
+ * returns the number of assignments
+ */
+int
+jobs_step(struct world *w) {
+    struct job_board *b = &w->jobs;
+    int assigned = 0;
+    int num = min(arrlen(b->idle) - b->idle_head, b->budget);
+
+    for (int i = 0; i != num && b->open; ++i) {
+        handle h = b->idle[b->idle_head++];
+        int u = handles_get(&w->unit_handles, h);
+        if (u < 0)
+            continue;   /* the unit is removed */
+
+        struct ai *ai = &w->ais[u];
+        struct vec2 coords = { ai_unit(ai)->coords.x >> TILE_SHIFT, ai_unit(ai)->coords.y >> TILE_SHIFT };
+        int j = find_job(b, coords);
+
+        if (j < 0 || assign(w, ai, j)) {
+            /* trying again later, the unit may come closer to a job */
+            arrput(b->idle, h);
+            continue;
+        }
+
+        ++assigned;
+    }
+
+    /* dropping the popped part of the queue */
+    if (b->idle_head == arrlen(b->idle)) {
+        arrsetlen(b->idle, 0);
+        b->idle_head = 0;
+    } else if (b->idle_head > 1024 && b->idle_head * 2 > arrlen(b->idle)) {
+        int len = arrlen(b->idle) - b->idle_head;
+        memmove(b->idle, b->idle + b->idle_head, len * sizeof(handle));
+        arrsetlen(b->idle, len);
+        b->idle_head = 0;
+    }
+
+    b->assigned += assigned;
+    prof_count(PROF_ASSIGNMENTS, assigned);
+    return assigned;
+}
+
+/* posts jobs bringing the missing inputs to buildings blocked by the last production step */
+void
+jobs_post_supplies(struct world *w) {
+    struct production *p = &w->prod;
+
+    for (int i = 0, ie = arrlen(p->blocked); i != ie; ++i) {
+        int bld = p->blocked[i];
+        int r = p->receipt[bld];
+
+        if (bld >= arrlen(w->buildings))
+            continue;
+
+        /* what is on the way already is not asked again */
+        for (int a = 0; a != AT_MAX; ++a) {
+            int missing = p->in[a][r] - p->stock[a][bld] - p->pending[a][bld];
+            if (missing > 0) {
+                struct job j = { J_SUPPLY, handles_at(&w->building_handles, bld), a, missing, w->jobs.work, w->buildings[bld].coords, HANDLE_NONE, -1 };
+                jobs_post(&w->jobs, &j);
+                p->pending[a][bld] += missing;
+            }
+        }
+    }
+}
+
+/* its unit is removed: a supply job is dropped and its amount released,
+ * the building is woken to post what it still misses, other jobs are open
+ * again
+ */
+void
+jobs_reopen(struct world *w, int job) {
+    struct job_board *b = &w->jobs;
+    struct job *j = &b->jobs[job];
+
+    if (j->type == J_NONE || j->unit == HANDLE_NONE)
+        return;
+
+    if (j->type == J_SUPPLY) {
+        int bld = handles_get(&w->building_handles, j->building);
+        if (bld >= 0) {
+            w->prod.pending[j->asset][bld] -= j->amount;
+            prod_wake(&w->prod, bld);
+        }
+        free_job(b, job);
+    } else {
+        open_job(b, job);
+    }
+}
+
+/* drops the open jobs of the building removed, assigned ones are done
+ * with no effect; its pending amounts go with its production state
+ */
+void
+jobs_remove_building(struct job_board *b, handle building) {
+    for (int i = 0, ie = arrlen(b->jobs); i != ie; ++i) {
+        struct job *j = &b->jobs[i];
+        if (j->type != J_NONE && j->building == building && j->unit == HANDLE_NONE) {
+            close_job(b, i);
+            free_job(b, i);
+        }
+    }
+}
+
+/* applies the effect of the job done by its unit and frees it */
+void
+jobs_done(struct world *w, int job) {
+    struct job_board *b = &w->jobs;
+    struct job *j = &b->jobs[job];
+    int bld = handles_get(&w->building_handles, j->building);
+
+    switch (j->type) {
+    case J_SUPPLY:  if (bld >= 0) {
+                        w->prod.pending[j->asset][bld] -= j->amount;
+                        prod_add_stock(&w->prod, bld, j->asset, j->amount);
+                    }
+                    break;
+
+    default:        break;
+    }
+
+    if (j->unit == HANDLE_NONE)
+        close_job(b, job);
+
+    free_job(b, job);
+    ++b->done;
+}
+
+static int
+get_cell(struct job_board *b, struct vec2 coords) {
+    int x = trim(0, b->size.x - 1, coords.x >> b->cell_shift);
+    int y = trim(0, b->size.y - 1, coords.y >> b->cell_shift);
+    return b->size.x * y + x;
+}
+
+/* puts the job to the grid */
+static void
+open_job(struct job_board *b, int job) {
+    int c = get_cell(b, b->jobs[job].coords);
+    b->jobs[job].unit = HANDLE_NONE;
+    b->jobs[job].slot = arrlen(b->cells[c]);
+    arrput(b->cells[c], job);
+    ++b->open;
+}
+
+/* removes the job from the grid, the last job of the cell takes its slot */
+static void
+close_job(struct job_board *b, int job) {
+    int *cell = b->cells[ get_cell(b, b->jobs[job].coords) ];
+    int slot = b->jobs[job].slot;
+    int last = arrpop(cell);
+
+    if (last != job) {
+        cell[slot] = last;
+        b->jobs[last].slot = slot;
+    }
+
+    --b->open;
+}
+
+/* returns the nearest open job within radius cells, -1 if there is none */
+static int
+find_job(struct job_board *b, struct vec2 coords) {
+    int cx = coords.x >> b->cell_shift;
+    int cy = coords.y >> b->cell_shift;
+    int best = -1, best_d = INT_MAX;
+
+    for (int r = 0; r <= b->radius; ++r) {
+        /* jobs of ring r are farther than (r - 1) cells */
+        if (best >= 0) {
+            long long bound = (long long)(r - 1) << b->cell_shift;
+            if (bound * bound >= best_d)
+                break;
+        }
+
+        for (int y = cy - r; y <= cy + r; ++y) {
+            if (y < 0 || y >= b->size.y)
+                continue;
+
+            if (y == cy - r || y == cy + r) {
+                for (int x = max(cx - r, 0), xe = min(cx + r, b->size.x - 1); x <= xe; ++x)
+                    scan_cell(b, coords, x, y, &best, &best_d);
+            } else {
+                if (cx - r >= 0) scan_cell(b, coords, cx - r, y, &best, &best_d);
+                if (cx + r < b->size.x) scan_cell(b, coords, cx + r, y, &best, &best_d);
+            }
+        }
+    }
+
+    return best;
+}
+
+static void
+scan_cell(struct job_board *b, struct vec2 coords, int x, int y, int *best, int *best_d) {
+    int *cell = b->cells[b->size.x * y + x];
+
+    for (int i = 0, ie = arrlen(cell); i != ie; ++i) {
+        struct job *j = &b->jobs[ cell[i] ];
+        int dx = j->coords.x - coords.x;
+        int dy = j->coords.y - coords.y;
+        int d = dx * dx + dy * dy;
+        if (d < *best_d) {
+            *best = cell[i];
+            *best_d = d;
+        }
+    }
+}
+
+/* puts the job to the free list, it's to be closed already */
+static void
+free_job(struct job_board *b, int job) {
+    b->jobs[job].type = J_NONE;
+    b->jobs[job].unit = HANDLE_NONE;
+    b->jobs[job].slot = b->free;
+    b->free = job;
+}
+
+/* replaces the unit task with walking to the job and doing it */
+static int
+assign(struct world *w, struct ai *ai, int job) {
+    struct job *j = &w->jobs.jobs[job];
+    struct task t;
+
+    if (task_alloc(w, &t, 2))
+        return 1;
+
+    t.actions[0].type = A_WALK;
+    t.actions[0].act.walk.to.x = j->coords.x << TILE_SHIFT;
+    t.actions[0].act.walk.to.y = j->coords.y << TILE_SHIFT;
+    t.actions[1].type = A_DO;
+    t.actions[1].act.work.job = job;
+    t.actions[1].act.work.cnt = j->time;
+
+    task_free(w, &ai->task);
+    ai->task = t;
+    ai->job = job;
+
+    close_job(&w->jobs, job);
+    j->unit = handles_at(&w->unit_handles, ai_index(ai));
+    return 0;
+}
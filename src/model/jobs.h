@@ -0,0 +1,43 @@
+#ifndef _JOBS_H_
+#define _JOBS_H_
+
+#include "types.h"
+
+/* Job board
+ *
+ * Jobs are posted to the board and idle units pull work from it. Open jobs
+ * are indexed by a grid of cells of 1 << cell_shift tiles, so a unit looks
+ * only at the cells around it, ring by ring up to radius, and takes the
+ * nearest job. At most budget waiting units are matched per tick, units
+ * which found nothing go back to the end of the queue.
+ *
+ * An assigned job becomes the unit task: walking to the job tile and
+ * working there (A_DO), after that jobs_done applies the job effect.
+ *
+ * Buildings blocked by production for lack of inputs post supply jobs for
+ * what is missing less what supply jobs are already bringing (pending of
+ * production); the pending amount is released when the job is done, its
+ * unit is removed or its building is removed.
+ *
+ * World json:
+ *     "jobs": { "cell": 8, "radius": 4, "budget": 256, "work": 120 }
+ */
+
+#define JOB_NONE    -1      /* ai.job of a unit which is not waiting for a job */
+#define JOB_WAITING -2      /* ai.job of a unit within the idle queue */
+
+struct jq_value;
+
+void jobs_init(struct job_board *b);
+void jobs_free(struct job_board *b);
+int jobs_read(struct job_board *b, struct jq_value *v);
+void jobs_reset(struct job_board *b, struct vec2 map_size);
+int jobs_post(struct job_board *b, struct job *j);
+void jobs_add_idle(struct job_board *b, handle unit);
+int jobs_step(struct world *w);
+void jobs_post_supplies(struct world *w);
+void jobs_reopen(struct world *w, int job);
+void jobs_remove_building(struct job_board *b, handle building);
+void jobs_done(struct world *w, int job);
+
+#endif /* _JOBS_H_ */
@@ -0,0 +1,124 @@
+#include "lod.h"
+#include "app.h"
+#include "serial.h"
+#include "stb_ds.h"
+#include <malloc.h>
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+static int rect_distance(struct recti *r, int x, int y);
+
+void
+lod_init(struct lod *l) {
+    l->enabled = 0;
+    l->chunk_shift = 5;
+    l->radius = 2;
+    l->period = 4;
+    l->levels = 3;
+    l->periods = NULL;
+    l->size.x = l->size.y = 0;
+    l->level = NULL;
+    l->view.x = l->view.y = l->view.w = l->view.h = 0;
+}
+
+void
+lod_free(struct lod *l) {
+    arrfree(l->periods);
+    free(l->level);
+    l->level = NULL;
+}
+
+/* reads the 'lod' object of world json, v can be NULL */
+int
+lod_read(struct lod *l, struct jq_value *v) {
+    int chunk;
+    struct jq_value *k;
+
+    if (!v) {
+        l->enabled = 0;
+    } else if (!jq_isobject(v)) {
+        app_warning("'lod' should be an object");
+        return 1;
+    } else {
+        k = jq_find(v, "enabled", 0);
+        l->enabled = k ? jq_istrue(k) : 1;
+
+        if (read_int(v, "lod", "chunk", 4, 256, 1 << l->chunk_shift, &chunk)) return 1;
+        if (read_int(v, "lod", "radius", 1, 1024, l->radius, &l->radius)) return 1;
+        if (read_int(v, "lod", "period", 2, 64, l->period, &l->period)) return 1;
+        if (read_int(v, "lod", "levels", 1, 4, l->levels, &l->levels)) return 1;
+
+        for (l->chunk_shift = 0; (1 << (l->chunk_shift + 1)) <= chunk; ++l->chunk_shift);
+        if (1 << l->chunk_shift != chunk)
+            app_warning("'lod.chunk' should be a power of two, set to %i", 1 << l->chunk_shift);
+    }
+
+    arrsetlen(l->periods, l->levels);
+    for (int i = 0, p = 1; i != l->levels; ++i, p *= l->period)
+        l->periods[i] = p;
+
+    return 0;
+}
+
+/* recalculates levels of all the chunks, it's cheap as there are few chunks */
+void
+lod_update(struct world *w) {
+    struct lod *l = &w->lod;
+    struct vec2 size = {
+        (w->map.size.x + (1 << l->chunk_shift) - 1) >> l->chunk_shift,
+        (w->map.size.y + (1 << l->chunk_shift) - 1) >> l->chunk_shift
+    };
+
+    if (!l->enabled)
+        return;
+
+    if (l->size.x != size.x || l->size.y != size.y) {
+        free(l->level);
+        l->level = malloc(size.x * size.y);
+        l->size = size;
+    }
+
+    /* view and player position in chunks */
+    struct recti view = {
+        l->view.x >> l->chunk_shift,
+        l->view.y >> l->chunk_shift,
+        ((l->view.x + l->view.w - 1) >> l->chunk_shift) - (l->view.x >> l->chunk_shift) + 1,
+        ((l->view.y + l->view.h - 1) >> l->chunk_shift) - (l->view.y >> l->chunk_shift) + 1
+    };
+    struct recti player = { -1, -1, 1, 1 };
+    int p = handles_get(&w->unit_handles, w->player);
+    if (p >= 0) {
+        player.x = w->units[p].coords.x >> (TILE_SHIFT + l->chunk_shift);
+        player.y = w->units[p].coords.y >> (TILE_SHIFT + l->chunk_shift);
+    }
+
+    for (int i = 0, y = 0; y != size.y; ++y) {
+        for (int x = 0; x != size.x; ++x, ++i) {
+            int d = INT_MAX;
+            if (l->view.w > 0 && l->view.h > 0) d = rect_distance(&view, x, y);
+            if (player.x >= 0) d = min(d, rect_distance(&player, x, y));
+
+            int level = d <= l->radius ? 0 : 1 + (d - l->radius - 1) / l->radius;
+            l->level[i] = min(level, l->levels - 1);
+        }
+    }
+}
+
+/* returns level of the chunk the pixel coords belong to */
+int
+lod_get_level(struct lod *l, struct vec2 coords) {
+    if (!l->enabled || !l->level)
+        return 0;
+
+    int shift = TILE_SHIFT + l->chunk_shift;
+    return l->level[l->size.x * (coords.y >> shift) + (coords.x >> shift)];
+}
+
+/* Chebyshev distance from chunk x, y to the rect of chunks */
+static int
+rect_distance(struct recti *r, int x, int y) {
+    int dx = max(max(r->x - x, x - (r->x + r->w - 1)), 0);
+    int dy = max(max(r->y - y, y - (r->y + r->h - 1)), 0);
+    return max(dx, dy);
+}
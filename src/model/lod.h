@@ -0,0 +1,28 @@
+#ifndef _LOD_H_
+#define _LOD_H_
+
+#include "types.h"
+
+/* Level of detail of the simulation
+ *
+ * The map is split into square chunks. Chunks within 'radius' chunks of
+ * the visible frame or of the player are simulated every tick (level 0),
+ * every next 'radius' chunks farther the level grows by one up to
+ * 'levels' - 1. Units of level l are stepped every period^l ticks with
+ * the same quantum, so they cover the same distance with fewer steps.
+ * Steps are staggered by unit index to spread the load evenly. When a
+ * chunk comes into view its units are back to full rate on the next tick.
+ *
+ * World json knob, all keys are optional:
+ *     "lod": { "enabled": true, "chunk": 32, "radius": 2, "period": 4, "levels": 3 }
+ */
+
+struct jq_value;
+
+void lod_init(struct lod *l);
+void lod_free(struct lod *l);
+int lod_read(struct lod *l, struct jq_value *v);
+void lod_update(struct world *w);
+int lod_get_level(struct lod *l, struct vec2 coords);
+
+#endif /* _LOD_H_ */
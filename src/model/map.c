@@ -0,0 +1,544 @@
+#include "map.h"
+#include "gen.h"
+#include "cache.h"
+#include "tpool.h"
+#include "app.h"
+#include "serial.h"
+#include "stb_ds.h"
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+#define MAP_EVICT_MAX   64      /* chunks written to the swap file per call at most */
+
+struct map_prefetch_job {
+    struct map *map;
+    int *index;                 /* chunks to generate */
+    struct map_chunk **chunk;   /* generated chunks */
+};
+
+/* by enum map_layout */
+static const char *layouts[] = { "rows", "blocks", "morton" };
+
+struct map_lru {
+    unsigned long used;
+    int index;
+};
+
+static struct map_chunk *load_chunk(struct map *m, int i);
+static void make_chunk(struct map *m, struct map_chunk *c, int i);
+static int swap_out(struct map *m, int i);
+static int in_rects(struct recti *r, int n, int x, int y);
+static int lru_cmp(const void *a, const void *b);
+static int tile_at_cmp(const void *a, const void *b);
+
+void
+map_init(struct map *m) {
+    m->size.x = m->size.y = 0;
+    m->tile_types = NULL;
+    m->chunks.x = m->chunks.y = 0;
+    map_set_layout(m, ML_ROWS);
+    m->chunk = NULL;
+    m->flags = NULL;
+    m->resident = 0;
+    m->budget = 4096;
+    m->radius = 2;
+    m->clock = 0;
+    m->fork = 0;
+    m->swap_path = NULL;
+    m->swap = NULL;
+    m->lock = SDL_CreateMutex();
+    m->units = NULL;
+    m->cached = NULL;
+    m->cache_base = NULL;
+    m->cache_size = 0;
+    memset(&m->gen.perlin, 0, sizeof(m->gen.perlin));
+    m->gen.parts = NULL;
+    m->gen.transit = NULL;
+}
+
+/* the map of a fork frees only the chunks it has made itself, the rest
+ * belongs to the arena and to the world
+ */
+void
+map_free(struct map *m) {
+    for (int i = 0, ie = m->chunks.x * m->chunks.y; i != ie; ++i) {
+        if (m->chunk[i] && !(m->flags[i] & MC_BORROWED))
+            free(m->chunk[i]);
+    }
+    hmfree(m->units);
+
+    if (m->fork)
+        return;
+
+    cache_unmap(m);
+    free(m->chunk);
+    free(m->flags);
+    m->chunk = NULL;
+    m->flags = NULL;
+    m->chunks.x = m->chunks.y = 0;
+    m->resident = 0;
+    arrfree(m->gen.parts);
+    arrfree(m->gen.transit);
+
+    if (m->swap) {
+        SDL_RWclose(m->swap);
+        m->swap = NULL;
+        remove(m->swap_path);
+    }
+    free(m->swap_path);
+    m->swap_path = NULL;
+    SDL_DestroyMutex(m->lock);
+    m->lock = NULL;
+}
+
+/* reads the 'map' object of world json, v can be NULL; the swap file is
+ * made in dir unless it's named, NULL for the working directory
+ */
+int
+map_read(struct map *m, struct jq_value *v, const char *dir) {
+    static int maps = 0;
+    char buf[4096];
+    struct jq_value *k;
+
+    if (dir)
+        snprintf(buf, sizeof(buf), "%s/map%i.swap", dir, maps++);
+    else
+        snprintf(buf, sizeof(buf), "map%i.swap", maps++);
+
+    if (v && !jq_isobject(v)) {
+        app_warning("'map' should be an object");
+        return 1;
+    } else if (v) {
+        if (read_int(v, "map", "budget", 16, INT_MAX, m->budget, &m->budget)) return 1;
+        if (read_int(v, "map", "radius", 0, 64, m->radius, &m->radius)) return 1;
+
+        k = jq_find(v, "layout", 0);
+        if (k) {
+            int layout = -1;
+            for (int i = 0; jq_isstring(k) && i != sizeof(layouts) / sizeof(layouts[0]); ++i) {
+                if (!strcmp(k->value.string, layouts[i]))
+                    layout = i;
+            }
+
+            if (layout < 0) {
+                app_warning("'map.layout' should be \"rows\", \"blocks\" or \"morton\"");
+                return 1;
+            }
+            map_set_layout(m, layout);
+        }
+
+        k = jq_find(v, "swap", 0);
+        if (k && !jq_isstring(k)) {
+            app_warning("'map.swap' should be a file name");
+            return 1;
+        } else if (k) {
+            snprintf(buf, sizeof(buf), "%s", k->value.string);
+        }
+    }
+
+    free(m->swap_path);
+    m->swap_path = strdup(buf);
+    return 0;
+}
+
+/* drops all the chunks, the map of the new size is made by its generator */
+void
+map_reset(struct map *m, struct vec2 size) {
+    struct vec2 chunks = {
+        (size.x + MAP_CHUNK - 1) >> MAP_CHUNK_SHIFT,
+        (size.y + MAP_CHUNK - 1) >> MAP_CHUNK_SHIFT
+    };
+
+    map_lock(m);
+    for (int i = 0, ie = m->chunks.x * m->chunks.y; i != ie; ++i)
+        free(m->chunk[i]);
+
+    free(m->chunk);
+    free(m->flags);
+    m->size = size;
+    m->chunks = chunks;
+    m->chunk = calloc(max(chunks.x * chunks.y, 1), sizeof(struct map_chunk *));
+    m->flags = calloc(max(chunks.x * chunks.y, 1), 1);
+    m->resident = 0;
+    m->clock = 0;
+    hmfree(m->units);
+    hmdefault(m->units, HANDLE_NONE);
+    cache_unmap(m);
+    map_unlock(m);
+}
+
+/* sets the order of the tiles within the chunks, the map is to be reset
+ * after it
+ */
+void
+map_set_layout(struct map *m, enum map_layout layout) {
+    m->layout = layout;
+    for (int i = 0; i != MAP_CHUNK; ++i) {
+        int spread = 0;
+        for (int b = 0; b != MAP_CHUNK_SHIFT; ++b)
+            spread |= (i >> b & 1) << (2 * b);
+
+        switch (layout) {
+        case ML_ROWS:
+            m->offset_x[i] = i;
+            m->offset_y[i] = i << MAP_CHUNK_SHIFT;
+            break;
+        case ML_BLOCKS:
+            m->offset_x[i] = (i & 7) + ((i >> 3) << 6);
+            m->offset_y[i] = ((i & 7) << 3) + ((i >> 3) << (MAP_CHUNK_SHIFT + 3));
+            break;
+        case ML_MORTON:
+            m->offset_x[i] = spread;
+            m->offset_y[i] = spread << 1;
+            break;
+        }
+    }
+}
+
+/* returns the tile, its chunk is generated or read back if it's not in memory */
+struct tile *
+map_get_tile(struct map *m, int x, int y) {
+    int i = (y >> MAP_CHUNK_SHIFT) * m->chunks.x + (x >> MAP_CHUNK_SHIFT);
+    struct map_chunk *c = SDL_AtomicGetPtr((void **)&m->chunk[i]);
+
+    if (!c)
+        c = load_chunk(m, i);
+
+    c->used = m->clock;
+    return &c->tiles[ map_offset(m, x, y) ];
+}
+
+int
+map_get_type(struct map *m, int x, int y) {
+    int type;
+    map_get_types(m, x, y, 1, &type);
+    return type;
+}
+
+/* types of n tiles of row y from x on, chunks which have never been made
+ * are taken from the world cache or asked the generator instead, swapped
+ * ones are read back as they may have been changed
+ */
+void
+map_get_types(struct map *m, int x, int y, int n, int *types) {
+    int row = (y >> MAP_CHUNK_SHIFT) * m->chunks.x;
+    int offset = m->offset_y[ y & (MAP_CHUNK - 1) ];
+
+    while (n > 0) {
+        int len = min(n, MAP_CHUNK - (x & (MAP_CHUNK - 1)));
+        int i = row + (x >> MAP_CHUNK_SHIFT);
+        struct map_chunk *c = SDL_AtomicGetPtr((void **)&m->chunk[i]);
+
+        if (!c && (m->flags[i] & MC_SWAPPED))
+            c = load_chunk(m, i);
+
+        const struct tile *tiles = c ? c->tiles : m->cached ? m->cached + (size_t)i * MAP_CHUNK_TILES : NULL;
+        if (tiles) {
+            const uint16_t *ox = &m->offset_x[ x & (MAP_CHUNK - 1) ];
+            for (int j = 0; j != len; ++j)
+                types[j] = tiles[ offset + ox[j] ].type;
+        } else {
+            gen_types(m, x, y, len, types);
+        }
+
+        x += len;
+        types += len;
+        n -= len;
+    }
+}
+
+/* types of n tiles anywhere on the map; the tiles are sorted and the ones
+ * of a row within MAP_CHUNK of each other are read by one map_get_types,
+ * so chunks which have never been made cost a noise batch per span
+ * rather than per tile. order is an stb_ds array the tiles are sorted in,
+ * it's kept by the caller to be reused
+ */
+void
+map_get_types_at(struct map *m, const struct vec2 *tiles, int n, int *types, struct map_tile_at **order_p) {
+    struct map_tile_at *order;
+    int span[MAP_CHUNK];
+
+    if (n <= 0)
+        return;
+
+    arrsetlen(*order_p, n);
+    order = *order_p;
+    for (int i = 0; i != n; ++i) {
+        order[i].y = tiles[i].y;
+        order[i].x = tiles[i].x;
+        order[i].index = i;
+    }
+    qsort(order, n, sizeof(struct map_tile_at), tile_at_cmp);
+
+    for (int k = 0; k != n;) {
+        int x = order[k].x, y = order[k].y, e = k + 1;
+        while (e != n && order[e].y == y && order[e].x - x < MAP_CHUNK)
+            ++e;
+
+        map_get_types(m, x, y, order[e - 1].x - x + 1, span);
+        for (; k != e; ++k)
+            types[ order[k].index ] = span[ order[k].x - x ];
+    }
+}
+
+/* returns the unit on the tile, HANDLE_NONE if there is none */
+handle
+map_get_unit(struct map *m, int x, int y) {
+    return hmget(m->units, y * m->size.x + x);
+}
+
+/* puts unit h on the tile, HANDLE_NONE frees the tile */
+void
+map_set_unit(struct map *m, int x, int y, handle h) {
+    if (h == HANDLE_NONE)
+        (void)hmdel(m->units, y * m->size.x + x);
+    else
+        hmput(m->units, y * m->size.x + x, h);
+}
+
+static void
+prefetch_chunks(void *data, int begin, int end) {
+    struct map_prefetch_job *job = data;
+    struct map *m = job->map;
+
+    for (int i = begin; i != end; ++i) {
+        int k = job->index[i];
+        job->chunk[i] = malloc(sizeof(struct map_chunk));
+        if (job->chunk[i])
+            make_chunk(m, job->chunk[i], k);
+    }
+}
+
+/* makes the chunks of the rect resident, new chunks are generated on the
+ * thread pool, swapped ones are read back
+ */
+void
+map_prefetch(struct map *m, struct recti r) {
+    struct map_prefetch_job job = { m, NULL, NULL };
+    int x0 = max(r.x, 0), y0 = max(r.y, 0);
+    int x1 = min(r.x + r.w, m->chunks.x), y1 = min(r.y + r.h, m->chunks.y);
+
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            int i = y * m->chunks.x + x;
+            if (m->chunk[i])
+                continue;
+            if (m->flags[i] & MC_SWAPPED)
+                load_chunk(m, i);
+            else
+                arrput(job.index, i);
+        }
+    }
+
+    if (!job.index)
+        return;
+
+    arrsetlen(job.chunk, arrlen(job.index));
+    tpool_for(arrlen(job.index), 1, prefetch_chunks, &job);
+
+    map_lock(m);
+    for (int i = 0, ie = arrlen(job.index); i != ie; ++i) {
+        int k = job.index[i];
+        if (!job.chunk[i] || m->chunk[k]) {
+            /* out of memory or made meanwhile by the renderer */
+            free(job.chunk[i]);
+            continue;
+        }
+
+        job.chunk[i]->used = m->clock;
+        SDL_AtomicSetPtr((void **)&m->chunk[k], job.chunk[i]);
+        ++m->resident;
+    }
+    map_unlock(m);
+
+    arrfree(job.index);
+    arrfree(job.chunk);
+}
+
+/* while there are more chunks than budget, writes the least recently used
+ * ones out of the n keep rects (in chunks) to the swap file and frees them;
+ * chunks used by the last tick stay
+ */
+void
+map_evict(struct map *m, struct recti *keep, int n) {
+    struct map_lru *lru = NULL;
+
+    if (m->fork || m->resident <= m->budget)
+        return;
+
+    map_lock(m);
+    for (int i = 0, y = 0; y != m->chunks.y; ++y) {
+        for (int x = 0; x != m->chunks.x; ++x, ++i) {
+            struct map_chunk *c = m->chunk[i];
+            if (c && c->used + 1 < m->clock && !in_rects(keep, n, x, y)) {
+                struct map_lru l = { c->used, i };
+                arrput(lru, l);
+            }
+        }
+    }
+
+    qsort(lru, arrlen(lru), sizeof(struct map_lru), lru_cmp);
+
+    for (int i = 0, ie = min(arrlen(lru), min(m->resident - m->budget, MAP_EVICT_MAX)); i < ie; ++i) {
+        if (swap_out(m, lru[i].index))
+            break;
+    }
+    map_unlock(m);
+
+    arrfree(lru);
+}
+
+/* called by the simulation thread between the ticks */
+void
+map_stream(struct world *w) {
+    struct map *m = &w->map;
+    struct recti keep[2];
+    int n = 0;
+
+    if (m->fork || !m->chunk)
+        return;
+
+    ++m->clock;
+
+    struct recti *view = &w->lod.view;
+    if (view->w > 0 && view->h > 0) {
+        keep[n].x = (view->x >> MAP_CHUNK_SHIFT) - m->radius;
+        keep[n].y = (view->y >> MAP_CHUNK_SHIFT) - m->radius;
+        keep[n].w = ((view->x + view->w - 1) >> MAP_CHUNK_SHIFT) + m->radius + 1 - keep[n].x;
+        keep[n].h = ((view->y + view->h - 1) >> MAP_CHUNK_SHIFT) + m->radius + 1 - keep[n].y;
+        ++n;
+    }
+
+    int p = handles_get(&w->unit_handles, w->player);
+    if (p >= 0) {
+        keep[n].x = (w->units[p].coords.x >> (TILE_SHIFT + MAP_CHUNK_SHIFT)) - m->radius;
+        keep[n].y = (w->units[p].coords.y >> (TILE_SHIFT + MAP_CHUNK_SHIFT)) - m->radius;
+        keep[n].w = keep[n].h = 2 * m->radius + 1;
+        ++n;
+    }
+
+    for (int i = 0; i != n; ++i)
+        map_prefetch(m, keep[i]);
+
+    map_evict(m, keep, n);
+}
+
+void
+map_lock(struct map *m) {
+    SDL_LockMutex(m->lock);
+}
+
+void
+map_unlock(struct map *m) {
+    SDL_UnlockMutex(m->lock);
+}
+
+/* slow path of map_get_tile, both threads may get here. If the chunk
+ * can't be allocated or read back, its tiles are made in the fallback
+ * chunk of the map which stays out of the directory, so the next access
+ * tries again; changes of a swapped chunk are lost for that time and the
+ * fallback is only good until the next failure
+ */
+static struct map_chunk *
+load_chunk(struct map *m, int i) {
+    struct map_chunk *c;
+
+    map_lock(m);
+    c = m->chunk[i];
+    if (!c) {
+        c = malloc(sizeof(struct map_chunk));
+        if (!c) {
+            if (!(m->flags[i] & MC_FAILED))
+                app_warning("Can't allocate map chunk %i, its tiles are generated on every access", i);
+        } else if (m->flags[i] & MC_SWAPPED) {
+            if (SDL_RWseek(m->swap, (Sint64)i * sizeof(c->tiles), RW_SEEK_SET) < 0 ||
+                SDL_RWread(m->swap, c->tiles, sizeof(c->tiles), 1) != 1) {
+                if (!(m->flags[i] & MC_FAILED))
+                    app_warning("Can't read map chunk %i from '%s', its tiles are generated: %s", i, m->swap_path, SDL_GetError());
+                free(c);
+                c = NULL;
+            }
+        } else {
+            make_chunk(m, c, i);
+        }
+
+        if (c) {
+            m->flags[i] &= ~MC_FAILED;
+            c->used = m->clock;
+            SDL_AtomicSetPtr((void **)&m->chunk[i], c);
+            ++m->resident;
+        } else {
+            m->flags[i] |= MC_FAILED;
+            c = &m->fallback;
+            make_chunk(m, c, i);
+        }
+    }
+    map_unlock(m);
+
+    return c;
+}
+
+/* tiles of chunk i as they were made, from the world cache or the generator */
+static void
+make_chunk(struct map *m, struct map_chunk *c, int i) {
+    if (m->cached)
+        memcpy(c->tiles, m->cached + (size_t)i * MAP_CHUNK_TILES, sizeof(c->tiles));
+    else
+        gen_chunk(m, c, i % m->chunks.x, i / m->chunks.x);
+}
+
+/* every chunk has its slot in the swap file, returns 1 if the chunk stays */
+static int
+swap_out(struct map *m, int i) {
+    struct map_chunk *c = m->chunk[i];
+
+    if (!m->swap) {
+        m->swap = SDL_RWFromFile(m->swap_path, "w+b");
+        if (!m->swap) {
+            app_warning("Can't open map swap file '%s', chunks stay in memory: %s", m->swap_path, SDL_GetError());
+            m->budget = INT_MAX;
+            return 1;
+        }
+    }
+
+    if (SDL_RWseek(m->swap, (Sint64)i * sizeof(c->tiles), RW_SEEK_SET) < 0 ||
+        SDL_RWwrite(m->swap, c->tiles, sizeof(c->tiles), 1) != 1) {
+        app_warning("Can't write map chunk %i to '%s': %s", i, m->swap_path, SDL_GetError());
+        return 1;
+    }
+
+    /* flagged first, so the chunk is never taken for an unmade one */
+    m->flags[i] |= MC_SWAPPED;
+    SDL_AtomicSetPtr((void **)&m->chunk[i], NULL);
+    --m->resident;
+    free(c);
+    return 0;
+}
+
+static int
+in_rects(struct recti *r, int n, int x, int y) {
+    for (int i = 0; i != n; ++i) {
+        if (x >= r[i].x && x < r[i].x + r[i].w && y >= r[i].y && y < r[i].y + r[i].h)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+lru_cmp(const void *a, const void *b) {
+    const struct map_lru *l = a, *r = b;
+    return l->used < r->used ? -1 : l->used > r->used;
+}
+
+static int
+tile_at_cmp(const void *a, const void *b) {
+    const struct map_tile_at *l = a, *r = b;
+    if (l->y != r->y)
+        return l->y < r->y ? -1 : 1;
+    return l->x < r->x ? -1 : l->x > r->x;
+}
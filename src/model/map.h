@@ -0,0 +1,70 @@
+#ifndef _MAP_H_
+#define _MAP_H_
+
+#include "types.h"
+
+/* Chunked map
+ *
+ * Tiles are kept in chunks of MAP_CHUNK x MAP_CHUNK tiles found through a
+ * directory of the map size in chunks. A chunk is made on the first access
+ * from the seeded generator (gen_chunk) or the world cache (cache.h), or
+ * read back from the swap file, so
+ * a new map costs nothing but its directory and only the chunks which are
+ * looked at or walked on are ever generated.
+ *
+ * Between the ticks map_stream prefetches the chunks within 'radius' chunks
+ * of the view and of the player on the thread pool, and while there are
+ * more than 'budget' chunks in memory it writes the least recently used
+ * ones farther away to the swap file and frees them.
+ *
+ * Tile pointers are valid until the next map_stream. The renderer takes
+ * map_lock for the time it holds them, chunks are evicted under the lock.
+ * map_get_type and map_get_types ask the generator for the types of the
+ * chunks which have never been made, so they don't make them resident;
+ * the generator works a row at a time, so types are better read in rows
+ * or batched by map_get_types_at than one by one.
+ * After changing types of tiles transit_update_rect (gen.h) fixes the
+ * transitions around them.
+ *
+ * A tile is a type and a quad of neighbors of greater types, 2 bytes, the
+ * tileset and transit indexes are looked up in a table of the generator.
+ * Units on the tiles are few compared to the tiles, they are kept in a hash
+ * map by the tile, so chunks don't need to be made to put units on them.
+ *
+ * Tiles within a chunk are row by row, in 8 x 8 blocks or in z-order, so
+ * the neighbors of a tile above and below are in the same cache line more
+ * often; the layout is chosen at world creation, map_offset hides it.
+ *
+ * The swap file is made in the cache directory (cache.h) unless it's named.
+ *
+ * World json knob, all keys are optional:
+ *     "map": { "budget": 4096, "radius": 2, "swap": "map.swap", "layout": "rows" | "blocks" | "morton" }
+ */
+
+/* offset of tile x, y of the map in its chunk */
+#define map_offset(m, x, y) ((m)->offset_x[ (x) & (MAP_CHUNK - 1) ] + (m)->offset_y[ (y) & (MAP_CHUNK - 1) ])
+
+/* tileset indexes of tile t, 0 without tileset 'landset' */
+#define map_tileset_index(m, t) ((m)->gen.transit ? (m)->gen.transit[ (t)->type * 16 ] : 0)
+#define map_transit_index(m, t) ((m)->gen.transit ? (m)->gen.transit[ (t)->type * 16 + (t)->quad ] : 0)
+
+struct jq_value;
+
+void map_init(struct map *m);
+void map_free(struct map *m);
+int map_read(struct map *m, struct jq_value *v, const char *dir);
+void map_reset(struct map *m, struct vec2 size);
+void map_set_layout(struct map *m, enum map_layout layout);
+struct tile *map_get_tile(struct map *m, int x, int y);
+int map_get_type(struct map *m, int x, int y);
+void map_get_types(struct map *m, int x, int y, int n, int *types);
+void map_get_types_at(struct map *m, const struct vec2 *tiles, int n, int *types, struct map_tile_at **order);
+handle map_get_unit(struct map *m, int x, int y);
+void map_set_unit(struct map *m, int x, int y, handle h);
+void map_prefetch(struct map *m, struct recti chunks);
+void map_evict(struct map *m, struct recti *keep, int n);
+void map_stream(struct world *w);
+void map_lock(struct map *m);
+void map_unlock(struct map *m);
+
+#endif /* _MAP_H_ */
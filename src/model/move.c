@@ -0,0 +1,161 @@
+#include "move.h"
+#include "prof.h"
+#include "events.h"
+#include "map.h"
+#include "stb_ds.h"
+
+#if defined(__AVX2__)
+  #include <immintrin.h>
+#elif defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+void
+move_init(struct move_batch *b) {
+    b->unit = NULL;
+    b->x = b->y = NULL;
+    b->tx = b->ty = NULL;
+    b->speed = NULL;
+    b->changed = NULL;
+}
+
+void
+move_free(struct move_batch *b) {
+    arrfree(b->unit);
+    arrfree(b->x);
+    arrfree(b->y);
+    arrfree(b->tx);
+    arrfree(b->ty);
+    arrfree(b->speed);
+    arrfree(b->changed);
+}
+
+void
+move_push(struct move_batch *b, int unit, struct vec2 coords, struct vec2 to, int speed) {
+    arrput(b->unit, unit);
+    arrput(b->x, coords.x);
+    arrput(b->y, coords.y);
+    arrput(b->tx, to.x);
+    arrput(b->ty, to.y);
+    arrput(b->speed, speed);
+}
+
+/* moves every unit of the batch by at most speed pixels along each axis
+ * towards its target and fills in the changed array
+ */
+void
+move_run(struct move_batch *b) {
+    int i = 0;
+    int n = arrlen(b->unit);
+    arrsetlen(b->changed, 0);
+
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256i x  = _mm256_loadu_si256((__m256i *)(b->x + i));
+        __m256i y  = _mm256_loadu_si256((__m256i *)(b->y + i));
+        __m256i s  = _mm256_loadu_si256((__m256i *)(b->speed + i));
+        __m256i ns = _mm256_sub_epi32(_mm256_setzero_si256(), s);
+        __m256i dx = _mm256_sub_epi32(_mm256_loadu_si256((__m256i *)(b->tx + i)), x);
+        __m256i dy = _mm256_sub_epi32(_mm256_loadu_si256((__m256i *)(b->ty + i)), y);
+        dx = _mm256_min_epi32(_mm256_max_epi32(dx, ns), s);
+        dy = _mm256_min_epi32(_mm256_max_epi32(dy, ns), s);
+        __m256i nx = _mm256_add_epi32(x, dx);
+        __m256i ny = _mm256_add_epi32(y, dy);
+        _mm256_storeu_si256((__m256i *)(b->x + i), nx);
+        _mm256_storeu_si256((__m256i *)(b->y + i), ny);
+
+        __m256i diff = _mm256_or_si256(
+            _mm256_xor_si256(_mm256_srai_epi32(nx, TILE_SHIFT), _mm256_srai_epi32(x, TILE_SHIFT)),
+            _mm256_xor_si256(_mm256_srai_epi32(ny, TILE_SHIFT), _mm256_srai_epi32(y, TILE_SHIFT)));
+        int mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(diff, _mm256_setzero_si256()))) & 0xff;
+        while (mask) {
+            arrput(b->changed, i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        __m128i x  = _mm_loadu_si128((__m128i *)(b->x + i));
+        __m128i y  = _mm_loadu_si128((__m128i *)(b->y + i));
+        __m128i s  = _mm_loadu_si128((__m128i *)(b->speed + i));
+        __m128i ns = _mm_sub_epi32(_mm_setzero_si128(), s);
+        __m128i dx = _mm_sub_epi32(_mm_loadu_si128((__m128i *)(b->tx + i)), x);
+        __m128i dy = _mm_sub_epi32(_mm_loadu_si128((__m128i *)(b->ty + i)), y);
+        __m128i m;
+        /* SSE2 has no 32 bit min and max, so clamping with compare and select */
+        m  = _mm_cmpgt_epi32(dx, s);
+        dx = _mm_or_si128(_mm_and_si128(m, s), _mm_andnot_si128(m, dx));
+        m  = _mm_cmplt_epi32(dx, ns);
+        dx = _mm_or_si128(_mm_and_si128(m, ns), _mm_andnot_si128(m, dx));
+        m  = _mm_cmpgt_epi32(dy, s);
+        dy = _mm_or_si128(_mm_and_si128(m, s), _mm_andnot_si128(m, dy));
+        m  = _mm_cmplt_epi32(dy, ns);
+        dy = _mm_or_si128(_mm_and_si128(m, ns), _mm_andnot_si128(m, dy));
+        __m128i nx = _mm_add_epi32(x, dx);
+        __m128i ny = _mm_add_epi32(y, dy);
+        _mm_storeu_si128((__m128i *)(b->x + i), nx);
+        _mm_storeu_si128((__m128i *)(b->y + i), ny);
+
+        __m128i diff = _mm_or_si128(
+            _mm_xor_si128(_mm_srai_epi32(nx, TILE_SHIFT), _mm_srai_epi32(x, TILE_SHIFT)),
+            _mm_xor_si128(_mm_srai_epi32(ny, TILE_SHIFT), _mm_srai_epi32(y, TILE_SHIFT)));
+        int mask = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(diff, _mm_setzero_si128()))) & 0xf;
+        while (mask) {
+            arrput(b->changed, i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    /* scalar fallback and the tail */
+    for (; i < n; ++i) {
+        int x = b->x[i];
+        int y = b->y[i];
+        int s = b->speed[i];
+        b->x[i] += trim(-s, s, b->tx[i] - x);
+        b->y[i] += trim(-s, s, b->ty[i] - y);
+
+        if ((b->x[i] >> TILE_SHIFT) != (x >> TILE_SHIFT) || (b->y[i] >> TILE_SHIFT) != (y >> TILE_SHIFT))
+            arrput(b->changed, i);
+    }
+}
+
+/* runs the kernel, then writes coords back to the units and updates
+ * tile occupancy for units which tile is changed, the batch is emptied
+ * but keeps its capacity for the next tick
+ */
+void
+move_step(struct world *w) {
+    struct move_batch *b = &w->moves;
+    struct map *map = &w->map;
+
+    move_run(b);
+    prof_count(PROF_MOVED, arrlen(b->unit));
+    prof_count(PROF_TILE_CHANGES, arrlen(b->changed));
+
+    for (int i = 0, ie = arrlen(b->changed); i != ie; ++i) {
+        int k = b->changed[i];
+        struct unit *u = &w->units[ b->unit[k] ];
+        struct vec2 from = { u->coords.x >> TILE_SHIFT, u->coords.y >> TILE_SHIFT };
+        struct vec2 to = { b->x[k] >> TILE_SHIFT, b->y[k] >> TILE_SHIFT };
+        handle h = handles_at(&w->unit_handles, b->unit[k]);
+
+        map_set_unit(map, from.x, from.y, HANDLE_NONE);
+        map_set_unit(map, to.x, to.y, h);
+        events_push(&w->events, EV_UNIT_LEFT, h, u->type, from);
+        events_push(&w->events, EV_UNIT_ENTERED, h, u->type, to);
+    }
+
+    for (int i = 0, ie = arrlen(b->unit); i != ie; ++i) {
+        struct unit *u = &w->units[ b->unit[i] ];
+        u->coords.x = b->x[i];
+        u->coords.y = b->y[i];
+    }
+
+    arrsetlen(b->unit, 0);
+    arrsetlen(b->x, 0);
+    arrsetlen(b->y, 0);
+    arrsetlen(b->tx, 0);
+    arrsetlen(b->ty, 0);
+    arrsetlen(b->speed, 0);
+}
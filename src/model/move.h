@@ -0,0 +1,21 @@
+#ifndef _MOVE_H_
+#define _MOVE_H_
+
+#include "types.h"
+
+/* Batched unit movement
+ *
+ * AIs don't move units themselves, they push walking units to the batch
+ * and move_step advances all of them at once. Coords, targets and speeds
+ * are kept as separate arrays (SoA), so the kernel can process 8 (AVX2)
+ * or 4 (SSE2) units per iteration, there is a scalar fallback as well.
+ * Only units which tile is changed get to occupancy update.
+ */
+
+void move_init(struct move_batch *b);
+void move_free(struct move_batch *b);
+void move_push(struct move_batch *b, int unit, struct vec2 coords, struct vec2 to, int speed);
+void move_run(struct move_batch *b);
+void move_step(struct world *w);
+
+#endif /* _MOVE_H_ */
@@ -1,4 +1,6 @@
 #include "path.h"
+#include "prof.h"
+#include "map.h"
 #include "stb_ds.h"
 #include <math.h>
 #include <assert.h>
@@ -45,12 +47,13 @@ find_path(struct world *w, struct unit *u, struct vec2 dest) {
 
     struct path rv = { NULL };
     struct map *map = &w->map;
-    struct tile *tiles = map->tiles;
     struct node *data = NULL;           /* path node storage */
     size_t *open = NULL;                /* open list */
     size_t *close = NULL;               /* close list */
     int path_found = 0;
 
+    prof_begin(PROF_PATH);
+
     /* src tile is u->coords / 64, dest tile is dest.
      * we swap src and dest not to reverse the result path
      * as said in A* algorithm instruction
@@ -58,7 +61,7 @@ find_path(struct world *w, struct unit *u, struct vec2 dest) {
     struct vec2 finish = { u->coords.x / 64, u->coords.y / 64 };
     struct node start = { .coo = dest, .g = .0, .h = calc_h(dest, finish), .prev = -1 };
 
-    if (!is_obstacle(get_passability(w, u, &tiles[map->size.x * dest.y + dest.x]))) {
+    if (!is_obstacle(get_passability(w, u, map_get_tile(map, dest.x, dest.y)))) {
         arrsetcap(data, (int)start.h * 2);
         arrsetcap(open, (int)start.h * 2);
         arrsetcap(close, (int)start.h * 2);
@@ -87,7 +90,7 @@ find_path(struct world *w, struct unit *u, struct vec2 dest) {
             if (coo.y > 0) {
                 neighbors[num].coo.x = coo.x - 1;
                 neighbors[num].coo.y = coo.y - 1;
-                pass = get_passability(w, u, &tiles[map->size.x * neighbors[num].coo.y + neighbors[num].coo.x]);
+                pass = get_passability(w, u, map_get_tile(map, neighbors[num].coo.x, neighbors[num].coo.y));
                 if (!is_obstacle(pass)) {
                     neighbors[num++].pass = pass * 1.4;
                 }
@@ -95,7 +98,7 @@ find_path(struct world *w, struct unit *u, struct vec2 dest) {
 
             neighbors[num].coo.x = coo.x - 1;
             neighbors[num].coo.y = coo.y;
-            pass = get_passability(w, u, &tiles[map->size.x * neighbors[num].coo.y + neighbors[num].coo.x]);
+            pass = get_passability(w, u, map_get_tile(map, neighbors[num].coo.x, neighbors[num].coo.y));
             if (!is_obstacle(pass)) {
                 neighbors[num++].pass = pass;
             }
@@ -103,7 +106,7 @@ find_path(struct world *w, struct unit *u, struct vec2 dest) {
             if (coo.y + 1 < map->size.y) {
                 neighbors[num].coo.x = coo.x - 1;
                 neighbors[num].coo.y = coo.y + 1;
-                pass = get_passability(w, u, &tiles[map->size.x * neighbors[num].coo.y + neighbors[num].coo.x]);
+                pass = get_passability(w, u, map_get_tile(map, neighbors[num].coo.x, neighbors[num].coo.y));
                 if (!is_obstacle(pass)) {
                     neighbors[num++].pass = pass * 1.4;
                 }
@@ -113,7 +116,7 @@ find_path(struct world *w, struct unit *u, struct vec2 dest) {
         if (coo.y > 0) {
             neighbors[num].coo.x = coo.x;
             neighbors[num].coo.y = coo.y - 1;
-            pass = get_passability(w, u, &tiles[map->size.x * neighbors[num].coo.y + neighbors[num].coo.x]);
+            pass = get_passability(w, u, map_get_tile(map, neighbors[num].coo.x, neighbors[num].coo.y));
             if (!is_obstacle(pass)) {
                 neighbors[num++].pass = pass;
             }
@@ -122,7 +125,7 @@ find_path(struct world *w, struct unit *u, struct vec2 dest) {
         if (coo.y + 1 < map->size.y) {
             neighbors[num].coo.x = coo.x;
             neighbors[num].coo.y = coo.y + 1;
-            pass = get_passability(w, u, &tiles[map->size.x * neighbors[num].coo.y + neighbors[num].coo.x]);
+            pass = get_passability(w, u, map_get_tile(map, neighbors[num].coo.x, neighbors[num].coo.y));
             if (!is_obstacle(pass)) {
                 neighbors[num++].pass = pass;
             }
@@ -132,7 +135,7 @@ find_path(struct world *w, struct unit *u, struct vec2 dest) {
             if (coo.y > 0) {
                 neighbors[num].coo.x = coo.x + 1;
                 neighbors[num].coo.y = coo.y - 1;
-                pass = get_passability(w, u, &tiles[map->size.x * neighbors[num].coo.y + neighbors[num].coo.x]);
+                pass = get_passability(w, u, map_get_tile(map, neighbors[num].coo.x, neighbors[num].coo.y));
                 if (!is_obstacle(pass)) {
                     neighbors[num++].pass = pass * 1.4;
                 }
@@ -140,7 +143,7 @@ find_path(struct world *w, struct unit *u, struct vec2 dest) {
 
             neighbors[num].coo.x = coo.x + 1;
             neighbors[num].coo.y = coo.y;
-            pass = get_passability(w, u, &tiles[map->size.x * neighbors[num].coo.y + neighbors[num].coo.x]);
+            pass = get_passability(w, u, map_get_tile(map, neighbors[num].coo.x, neighbors[num].coo.y));
             if (!is_obstacle(pass)) {
                 neighbors[num++].pass = pass;
             }
@@ -148,7 +151,7 @@ find_path(struct world *w, struct unit *u, struct vec2 dest) {
             if (coo.y + 1 < map->size.y) {
                 neighbors[num].coo.x = coo.x + 1;
                 neighbors[num].coo.y = coo.y + 1;
-                pass = get_passability(w, u, &tiles[map->size.x * neighbors[num].coo.y + neighbors[num].coo.x]);
+                pass = get_passability(w, u, map_get_tile(map, neighbors[num].coo.x, neighbors[num].coo.y));
                 if (!is_obstacle(pass)) {
                     neighbors[num++].pass = pass * 1.4;
                 }
@@ -182,6 +185,7 @@ find_path(struct world *w, struct unit *u, struct vec2 dest) {
             if (!s_found) {
                 struct node node = { .coo = n->coo, .g = current->g + n->pass, .h = calc_h(n->coo, finish), .prev = current_index };
                 arrput(data, node);
+                current = &data[current_index];     /* data may have moved */
                 open = arrputsorted(data, open, &data[ arrlenu(data) - 1 ]);
             } else if (current->g + n->pass + calc_h(n->coo, finish) < s_found->g + s_found->h) {
                 s_found->g = current->g + n->pass;
@@ -202,9 +206,14 @@ find_path(struct world *w, struct unit *u, struct vec2 dest) {
         }
     }
 
+    prof_count(PROF_PATHS, 1);
+    prof_count(PROF_PATH_NODES, arrlenu(data));
+
     arrfree(close);
     arrfree(data);
 
+    prof_end(PROF_PATH);
+
     return rv;
 }
 
@@ -0,0 +1,150 @@
+#include "pool.h"
+#include "types.h"
+#include "stb_ds.h"
+#include <malloc.h>
+#include <string.h>
+
+/* every block starts with this header, actions follow it */
+struct pool_block {
+    size_t cap;                 /* number of actions the block can hold */
+    int cls;                    /* size class, POOL_CLASSES for oversized blocks */
+    struct pool_block *next;    /* next free block of the same class, next live one if oversized */
+    struct pool_block *prev;    /* previous live block if oversized */
+};
+
+#define block_actions(bl) ((struct action *)((bl) + 1))
+#define action_block(a) ((struct pool_block *)(a) - 1)
+
+static int get_class(size_t n);
+static int refill(struct action_pool *p, int cls);
+
+void
+pool_init(struct action_pool *p) {
+    for (int i = 0; i != POOL_CLASSES; ++i)
+        p->free[i] = NULL;
+
+    p->slabs = NULL;
+    p->oversized = NULL;
+    memset(&p->stats, 0, sizeof(p->stats));
+}
+
+void
+pool_free(struct action_pool *p) {
+    for (int i = 0, ie = arrlenu(p->slabs); i != ie; ++i)
+        free(p->slabs[i]);
+
+    arrfree(p->slabs);
+
+    /* oversized blocks still acquired */
+    while (p->oversized) {
+        struct pool_block *next = p->oversized->next;
+        free(p->oversized);
+        p->oversized = next;
+    }
+
+    pool_init(p);
+}
+
+struct action *
+pool_acquire(struct action_pool *p, size_t n) {
+    struct pool_block *bl;
+    int cls = get_class(n);
+
+    if (cls == POOL_CLASSES) {
+        bl = malloc(sizeof(struct pool_block) + sizeof(struct action) * n);
+        if (!bl) return NULL;
+        bl->cap = n;
+        bl->cls = cls;
+        bl->prev = NULL;
+        bl->next = p->oversized;
+        if (p->oversized)
+            p->oversized->prev = bl;
+        p->oversized = bl;
+        ++p->stats.oversized;
+    } else {
+        if (!p->free[cls] && refill(p, cls))
+            return NULL;
+
+        bl = p->free[cls];
+        p->free[cls] = bl->next;
+        bl->cls = cls;
+        bl->next = NULL;
+    }
+
+    ++p->stats.acquired;
+    ++p->stats.live;
+
+    return block_actions(bl);
+}
+
+void
+pool_release(struct action_pool *p, struct action *a) {
+    if (!a) return;
+
+    struct pool_block *bl = action_block(a);
+    ++p->stats.released;
+    --p->stats.live;
+
+    if (bl->cls == POOL_CLASSES) {
+        if (bl->prev)
+            bl->prev->next = bl->next;
+        else
+            p->oversized = bl->next;
+        if (bl->next)
+            bl->next->prev = bl->prev;
+        free(bl);
+    } else {
+        bl->next = p->free[bl->cls];
+        p->free[bl->cls] = bl;
+    }
+}
+
+size_t
+pool_capacity(struct action *a) {
+    return a ? action_block(a)->cap : 0;
+}
+
+struct pool_stats
+pool_get_stats(struct action_pool *p) {
+    return p->stats;
+}
+
+/* returns the least class which blocks can hold n actions */
+static int
+get_class(size_t n) {
+    int cls = 0;
+    while (cls != POOL_CLASSES && ((size_t)1 << cls) < n)
+        ++cls;
+
+    return cls;
+}
+
+/* mallocs a new slab and threads its blocks into the free list of class cls */
+static int
+refill(struct action_pool *p, int cls) {
+    size_t cap = (size_t)1 << cls;
+    size_t block_size = sizeof(struct pool_block) + sizeof(struct action) * cap;
+    size_t num;
+
+    /* keeping the next block header aligned */
+    block_size = (block_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    num = POOL_SLAB_SIZE / block_size;
+    if (!num) num = 1;
+
+    char *slab = malloc(block_size * num);
+    if (!slab) return 1;
+
+    arrput(p->slabs, slab);
+    ++p->stats.slabs;
+    p->stats.slab_bytes += block_size * num;
+
+    for (size_t i = 0; i != num; ++i) {
+        struct pool_block *bl = (struct pool_block *)(slab + block_size * i);
+        bl->cap = cap;
+        bl->cls = cls;
+        bl->next = p->free[cls];
+        p->free[cls] = bl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+
+/* Action block pool
+ *
+ * Blocks of actions are kept in power of two size classes, each class has
+ * its own free list, so acquiring and releasing a block is O(1). Free lists
+ * are refilled from slabs, that is the only place the pool calls malloc,
+ * so once the pool is warmed up the simulation doesn't touch libc heap.
+ */
+
+#define POOL_CLASSES    16              /* the biggest class holds 1 << 15 actions */
+#define POOL_SLAB_SIZE  (64 * 1024)     /* preferred slab size in bytes */
+
+struct action;
+struct pool_block;
+
+struct pool_stats {
+    size_t acquired;        /* blocks acquired so far */
+    size_t released;        /* blocks released so far */
+    size_t live;            /* blocks acquired and not released yet */
+    size_t slabs;           /* malloc calls made to refill free lists */
+    size_t slab_bytes;      /* bytes allocated for slabs */
+    size_t oversized;       /* blocks too big for any class, malloced directly */
+};
+
+struct action_pool {
+    struct pool_block *free[POOL_CLASSES];
+    void **slabs;           /* stb_ds array of malloced slabs */
+    struct pool_block *oversized;   /* live oversized blocks, freed by pool_free as well */
+    struct pool_stats stats;
+};
+
+void pool_init(struct action_pool *p);
+void pool_free(struct action_pool *p);
+struct action *pool_acquire(struct action_pool *p, size_t n);
+void pool_release(struct action_pool *p, struct action *a);
+size_t pool_capacity(struct action *a);
+struct pool_stats pool_get_stats(struct action_pool *p);
+
+#endif /* _POOL_H_ */
@@ -0,0 +1,356 @@
+#include "prod.h"
+#include "app.h"
+#include "serial.h"
+#include "prof.h"
+#include "stb_ds.h"
+#include <string.h>
+
+static const char *asset_names[AT_MAX] = { "unknown", "wheat", "bread", "flour", "wood" };
+static const char *tool_names[TLT_MAX] = { "unknown", "sword", "axe", "oven" };
+static const char *building_names[BT_MAX] = { "unknown", "house", "windmill", "bakery", "sawmill" };
+
+static int find_name(const char **names, int num, const char *name);
+static int read_amounts(struct jq_value *v, const char *key, const char **names, int num, int *out);
+static void get_used_columns(int **columns, int num, int receipts, int *used);
+
+void
+prod_init(struct production *p) {
+    memset(p, 0, sizeof(*p));
+
+    /* the empty receipt of idle buildings */
+    arrput(p->time, 0);
+    for (int a = 0; a != AT_MAX; ++a) {
+        arrput(p->in[a], 0);
+        arrput(p->out[a], 0);
+    }
+    for (int t = 0; t != TLT_MAX; ++t)
+        arrput(p->need[t], 0);
+}
+
+void
+prod_free(struct production *p) {
+    arrfree(p->receipts);
+    arrfree(p->time);
+    arrfree(p->receipt);
+    arrfree(p->progress);
+    arrfree(p->blocked);
+
+    for (int a = 0; a != AT_MAX; ++a) {
+        arrfree(p->in[a]);
+        arrfree(p->out[a]);
+        arrfree(p->stock[a]);
+        arrfree(p->pending[a]);
+    }
+
+    for (int t = 0; t != TLT_MAX; ++t) {
+        arrfree(p->need[t]);
+        arrfree(p->tools[t]);
+    }
+}
+
+/* reads the 'receipts' array of world json, v can be NULL */
+int
+prod_read(struct production *p, struct jq_value *v) {
+    struct jq_value *r;
+
+    if (!v) return 0;
+
+    if (!jq_isarray(v)) {
+        app_warning("'receipts' should be an array");
+        return 1;
+    }
+
+    jq_foreach_array(r, v) {
+        struct receipt rc;
+        struct jq_value *k;
+        memset(&rc, 0, sizeof(rc));
+
+        if (!jq_isobject(r)) {
+            app_warning("'receipt' is not an object");
+            return 1;
+        }
+
+        k = jq_find(r, "name", 0);
+        if (k && jq_isstring(k)) {
+            rc.name = k->value.string;
+        } else {
+            app_warning("'name' of receipt is not found or not a string");
+            return 1;
+        }
+
+        k = jq_find(r, "building", 0);
+        if (k && jq_isstring(k))
+            rc.building = find_name(building_names, BT_MAX, k->value.string);
+        if (rc.building == BT_UNKNOWN) {
+            app_warning("'building' of receipt '%s' is not found or unknown", rc.name);
+            return 1;
+        }
+
+        k = jq_find(r, "time", 0);
+        if (k && jq_isinteger(k) && k->value.integer > 0) {
+            rc.time = k->value.integer;
+        } else {
+            app_warning("'time' of receipt '%s' should be a positive integer", rc.name);
+            return 1;
+        }
+
+        if (read_amounts(r, "inputs", asset_names, AT_MAX, rc.inputs)) return 1;
+        if (read_amounts(r, "outputs", asset_names, AT_MAX, rc.outputs)) return 1;
+        if (read_amounts(r, "tools", tool_names, TLT_MAX, rc.tools)) return 1;
+
+        prod_add_receipt(p, &rc);
+    }
+
+    return 0;
+}
+
+/* returns index of the new receipt */
+int
+prod_add_receipt(struct production *p, struct receipt *r) {
+    arrput(p->receipts, *r);
+    arrput(p->time, r->time);
+
+    for (int a = 0; a != AT_MAX; ++a) {
+        arrput(p->in[a], r->inputs[a]);
+        arrput(p->out[a], r->outputs[a]);
+    }
+
+    for (int t = 0; t != TLT_MAX; ++t)
+        arrput(p->need[t], r->tools[t]);
+
+    return arrlen(p->receipts) - 1;
+}
+
+/* returns index of the first receipt the building type runs, -1 if there is none */
+int
+prod_find_receipt(struct production *p, enum building_t type) {
+    for (int i = 0, ie = arrlen(p->receipts); i != ie; ++i) {
+        if (p->receipts[i].building == type)
+            return i;
+    }
+
+    return -1;
+}
+
+/* adds a building running the receipt (-1 for none), returns its index */
+int
+prod_add(struct production *p, int receipt) {
+    arrput(p->receipt, receipt + 1);
+    arrput(p->progress, receipt < 0 ? PROD_BLOCKED : 0);
+
+    for (int a = 0; a != AT_MAX; ++a) {
+        arrput(p->stock[a], 0);
+        arrput(p->pending[a], 0);
+    }
+
+    for (int t = 0; t != TLT_MAX; ++t)
+        arrput(p->tools[t], 0);
+
+    return arrlen(p->receipt) - 1;
+}
+
+/* removes the building, the last building takes its index */
+void
+prod_remove(struct production *p, int building) {
+    /* the stock leaves the totals */
+    for (int a = 0; a != AT_MAX; ++a) {
+        p->totals[a] -= p->stock[a][building];
+        arrdelswap(p->stock[a], building);
+        arrdelswap(p->pending[a], building);
+    }
+
+    for (int t = 0; t != TLT_MAX; ++t)
+        arrdelswap(p->tools[t], building);
+
+    arrdelswap(p->receipt, building);
+    arrdelswap(p->progress, building);
+
+    /* indices of the last step are not valid anymore */
+    arrsetlen(p->blocked, 0);
+}
+
+void
+prod_add_stock(struct production *p, int building, enum asset_t type, int num) {
+    p->stock[type][building] += num;
+    p->totals[type] += num;
+    prod_wake(p, building);
+}
+
+void
+prod_add_tools(struct production *p, int building, enum tool_t type, int num) {
+    p->tools[type][building] += num;
+    prod_wake(p, building);
+}
+
+/* lets a blocked building check its inputs and tools again on the next step */
+void
+prod_wake(struct production *p, int building) {
+    if (p->progress[building] == PROD_BLOCKED && p->receipt[building])
+        p->progress[building] = 0;
+}
+
+void
+prod_step(struct production *p) {
+    int n = arrlen(p->receipt);
+    int nr = arrlen(p->time);
+    int used_in[AT_MAX], used_out[AT_MAX], used_tools[TLT_MAX];
+    int done[PROD_BATCH], ready[PROD_BATCH * 2], ok[PROD_BATCH * 2];
+
+    /* columns no receipt uses are skipped */
+    get_used_columns(p->in, AT_MAX, nr, used_in);
+    get_used_columns(p->out, AT_MAX, nr, used_out);
+    get_used_columns(p->need, TLT_MAX, nr, used_tools);
+    arrsetlen(p->blocked, 0);
+
+    for (int b = 0; b < n; b += PROD_BATCH) {
+        int num = n - b < PROD_BATCH ? n - b : PROD_BATCH;
+        int *pr = p->progress + b;
+        int *rc = p->receipt;
+        int nd = 0, nready = 0;
+
+        /* advancing cycles, collecting buildings which cycle is finished
+         * and buildings waiting to start a new one, without branches
+         */
+        for (int i = 0; i < num; ++i) {
+            int v = pr[i];
+            done[nd] = b + i;
+            nd += v == 1;
+            ready[nready] = b + i;
+            nready += v == 0;
+            pr[i] = v - (v > 0);
+        }
+
+        if (!nd && !nready)
+            continue;
+
+        p->cycles += nd;
+        prof_count(PROF_CYCLES, nd);
+
+        /* emitting outputs, finished buildings are ready for the next cycle */
+        for (int a = 0; a != AT_MAX; ++a) {
+            if (!used_out[a]) continue;
+            int *st = p->stock[a];
+            int *out = p->out[a];
+            long long sum = 0;
+            for (int k = 0; k < nd; ++k) {
+                int v = out[ rc[ done[k] ] ];
+                st[ done[k] ] += v;
+                sum += v;
+            }
+            p->totals[a] += sum;
+        }
+
+        for (int k = 0; k < nd; ++k)
+            ready[nready++] = done[k];
+
+        /* checking inputs and tools */
+        for (int k = 0; k < nready; ++k)
+            ok[k] = 1;
+
+        for (int a = 0; a != AT_MAX; ++a) {
+            if (!used_in[a]) continue;
+            int *st = p->stock[a];
+            int *in = p->in[a];
+            for (int k = 0; k < nready; ++k)
+                ok[k] &= st[ ready[k] ] >= in[ rc[ ready[k] ] ];
+        }
+
+        for (int t = 0; t != TLT_MAX; ++t) {
+            if (!used_tools[t]) continue;
+            int *tl = p->tools[t];
+            int *need = p->need[t];
+            for (int k = 0; k < nready; ++k)
+                ok[k] &= tl[ ready[k] ] >= need[ rc[ ready[k] ] ];
+        }
+
+        /* consuming inputs and starting cycles */
+        for (int a = 0; a != AT_MAX; ++a) {
+            if (!used_in[a]) continue;
+            int *st = p->stock[a];
+            int *in = p->in[a];
+            long long sum = 0;
+            for (int k = 0; k < nready; ++k) {
+                int v = ok[k] * in[ rc[ ready[k] ] ];
+                st[ ready[k] ] -= v;
+                sum += v;
+            }
+            p->totals[a] -= sum;
+        }
+
+        /* buildings lacking something are blocked until their stock or tools change */
+        for (int k = 0; k < nready; ++k) {
+            if (ok[k]) {
+                p->progress[ ready[k] ] = p->time[ rc[ ready[k] ] ];
+            } else {
+                p->progress[ ready[k] ] = PROD_BLOCKED;
+                arrput(p->blocked, ready[k]);
+            }
+        }
+    }
+}
+
+const char *
+prod_asset_name(enum asset_t type) {
+    return asset_names[type];
+}
+
+const char *
+prod_tool_name(enum tool_t type) {
+    return tool_names[type];
+}
+
+const char *
+prod_building_name(enum building_t type) {
+    return building_names[type];
+}
+
+/* returns index of the name, 0 (unknown) if it's not found */
+static int
+find_name(const char **names, int num, const char *name) {
+    for (int i = 1; i != num; ++i) {
+        if (!strcmp(names[i], name))
+            return i;
+    }
+
+    return 0;
+}
+
+/* reads an optional object of names and positive integers */
+static int
+read_amounts(struct jq_value *v, const char *key, const char **names, int num, int *out) {
+    struct jq_pair *pair;
+    struct jq_value *k = jq_find(v, key, 0);
+
+    if (!k) return 0;
+
+    if (!jq_isobject(k)) {
+        app_warning("'%s' of receipt should be an object", key);
+        return 1;
+    }
+
+    jq_foreach_object(pair, k) {
+        int i = find_name(names, num, pair->key);
+        if (!i) {
+            app_warning("'%s' in '%s' of receipt is unknown", pair->key, key);
+            return 1;
+        }
+
+        if (!jq_isinteger(&pair->value) || pair->value.value.integer < 0) {
+            app_warning("'%s.%s' of receipt should be a non negative integer", key, pair->key);
+            return 1;
+        }
+
+        out[i] = pair->value.value.integer;
+    }
+
+    return 0;
+}
+
+static void
+get_used_columns(int **columns, int num, int receipts, int *used) {
+    for (int c = 0; c != num; ++c) {
+        used[c] = 0;
+        for (int r = 0; r != receipts; ++r)
+            used[c] |= columns[c][r] != 0;
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef _PROD_H_
+#define _PROD_H_
+
+#include "types.h"
+
+/* Production
+ *
+ * Every building runs one receipt in cycles: when the building has all
+ * the input assets and tools of the receipt the inputs are consumed and
+ * after receipt time ticks the outputs are added to the building stock.
+ *
+ * Stocks, tools and progress are kept as one array per column (SoA).
+ * prod_step walks the progress column in batches of PROD_BATCH without
+ * branches and collects buildings which cycle is finished or which wait
+ * for a new one, then only those are processed one column at a time.
+ * Buildings lacking inputs or tools are blocked and not checked again
+ * until their stock or tools change, the ones blocked by the last step
+ * are listed in blocked (the job board posts supply jobs for them).
+ *
+ * World json receipts:
+ *     "receipts": [ { "name": "bread", "building": "bakery", "time": 60,
+ *                     "inputs": { "flour": 2 }, "outputs": { "bread": 1 },
+ *                     "tools": { "oven": 1 } } ]
+ */
+
+#define PROD_BATCH 256
+#define PROD_BLOCKED -1     /* progress of buildings waiting for inputs or tools */
+
+struct jq_value;
+
+void prod_init(struct production *p);
+void prod_free(struct production *p);
+int prod_read(struct production *p, struct jq_value *v);
+int prod_add_receipt(struct production *p, struct receipt *r);
+int prod_find_receipt(struct production *p, enum building_t type);
+int prod_add(struct production *p, int receipt);
+void prod_remove(struct production *p, int building);
+void prod_add_stock(struct production *p, int building, enum asset_t type, int num);
+void prod_add_tools(struct production *p, int building, enum tool_t type, int num);
+void prod_wake(struct production *p, int building);
+void prod_step(struct production *p);
+const char *prod_asset_name(enum asset_t type);
+const char *prod_tool_name(enum tool_t type);
+const char *prod_building_name(enum building_t type);
+
+#endif /* _PROD_H_ */
@@ -0,0 +1,141 @@
+#include "prof.h"
+
+#ifdef PROF_ENABLED
+
+#include "app.h"
+#include <SDL2/SDL.h>
+#include <stdio.h>
+
+static struct prof_phase_stat phases[PROF_PHASES] = {
+    [PROF_WORLD_STEP]   = { .name = "world_step",       .thread = PROF_SIM_THREAD },
+    [PROF_AI]           = { .name = "ai",               .thread = PROF_SIM_THREAD },
+    [PROF_MOVE]         = { .name = "move",             .thread = PROF_SIM_THREAD },
+    [PROF_PROD]         = { .name = "production",       .thread = PROF_SIM_THREAD },
+    [PROF_JOBS]         = { .name = "jobs",             .thread = PROF_SIM_THREAD },
+    [PROF_PATH]         = { .name = "find_path",        .thread = PROF_SIM_THREAD },
+    [PROF_INFLUENCE]    = { .name = "influence",        .thread = PROF_SIM_THREAD },
+    [PROF_DRAW]         = { .name = "draw",             .thread = PROF_UI_THREAD },
+    [PROF_RENDER]       = { .name = "nk_sdl_render",    .thread = PROF_UI_THREAD }
+};
+
+static const char *counter_names[PROF_COUNTERS] = {
+    [PROF_TICKS]        = "ticks",
+    [PROF_AI_STEPS]     = "ai steps",
+    [PROF_MOVED]        = "units moved",
+    [PROF_TILE_CHANGES] = "tile changes",
+    [PROF_PATHS]        = "paths",
+    [PROF_PATH_NODES]   = "path nodes",
+    [PROF_FRAMES]       = "frames",
+    [PROF_CYCLES]       = "production cycles",
+    [PROF_ASSIGNMENTS]  = "job assignments",
+    [PROF_INFLUENCE_CHUNKS] = "influence chunks"
+};
+
+static uint64_t counters[PROF_COUNTERS];
+
+static int get_bucket(uint64_t dur);
+
+void
+prof_begin_(enum prof_phase p) {
+    phases[p].begin = SDL_GetPerformanceCounter();
+}
+
+void
+prof_end_(enum prof_phase p) {
+    struct prof_phase_stat *ph = &phases[p];
+    struct prof_sample *s = &ph->samples[ph->n % PROF_SAMPLES];
+
+    /* the evicted sample leaves the histogram */
+    if (ph->n >= PROF_SAMPLES)
+        --ph->hist[get_bucket(s->dur)];
+
+    s->start = ph->begin;
+    s->dur = SDL_GetPerformanceCounter() - ph->begin;
+    ++ph->hist[get_bucket(s->dur)];
+    ++ph->n;
+}
+
+void
+prof_count_(enum prof_counter c, uint64_t n) {
+    counters[c] += n;
+}
+
+struct prof_phase_stat *
+prof_get_phase(enum prof_phase p) {
+    return &phases[p];
+}
+
+uint64_t
+prof_get_counter(enum prof_counter c) {
+    return counters[c];
+}
+
+const char *
+prof_counter_name(enum prof_counter c) {
+    return counter_names[c];
+}
+
+double
+prof_to_us(uint64_t ticks) {
+    return (double)ticks * 1000000. / (double)SDL_GetPerformanceFrequency();
+}
+
+/* writes the samples within the rings in chrome trace event format,
+ * it can be opened with chrome://tracing or ui.perfetto.dev
+ */
+int
+prof_dump_trace(const char *fname) {
+    uint64_t origin = UINT64_MAX;
+    int first = 1;
+    FILE *fp = fopen(fname, "w");
+    if (!fp) {
+        app_warning("Can't open trace file '%s'", fname);
+        return 1;
+    }
+
+    for (int p = 0; p != PROF_PHASES; ++p) {
+        struct prof_phase_stat *ph = &phases[p];
+        unsigned long num = ph->n < PROF_SAMPLES ? ph->n : PROF_SAMPLES;
+        for (unsigned long i = 0; i != num; ++i) {
+            if (ph->samples[i].start < origin)
+                origin = ph->samples[i].start;
+        }
+    }
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (int p = 0; p != PROF_PHASES; ++p) {
+        struct prof_phase_stat *ph = &phases[p];
+        unsigned long num = ph->n < PROF_SAMPLES ? ph->n : PROF_SAMPLES;
+        /* every thread has its own row */
+        int tid = ph->thread;
+        for (unsigned long i = 0; i != num; ++i) {
+            struct prof_sample *s = &ph->samples[i];
+            fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f}",
+                first ? "" : ",\n", ph->name, tid, prof_to_us(s->start - origin), prof_to_us(s->dur));
+            first = 0;
+        }
+    }
+
+    fprintf(fp, "\n],\"otherData\":{");
+    for (int c = 0; c != PROF_COUNTERS; ++c) {
+        fprintf(fp, "%s\"%s\":%llu", c ? "," : "", counter_names[c], (unsigned long long)counters[c]);
+    }
+    fprintf(fp, "}}\n");
+
+    fclose(fp);
+    return 0;
+}
+
+static int
+get_bucket(uint64_t dur) {
+    uint64_t us = prof_to_us(dur);
+    int i = 0;
+    while (us > 1 && i != PROF_BUCKETS - 1) {
+        us >>= 1;
+        ++i;
+    }
+
+    return i;
+}
+
+#endif /* PROF_ENABLED */
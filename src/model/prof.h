@@ -0,0 +1,90 @@
+#ifndef _PROF_H_
+#define _PROF_H_
+
+/* Simulation profiler
+ *
+ * Phases are timed with prof_begin/prof_end pairs, events are counted with
+ * prof_count. Every phase keeps its last PROF_SAMPLES samples and a rolling
+ * log2 histogram of them. Everything compiles to nothing unless
+ * PROF_ENABLED is defined (cmake -DSOCIETY_PROFILE=ON).
+ *
+ * A phase is supposed to be timed by one thread only, phases don't nest
+ * into themselves.
+ */
+
+#include <stdint.h>
+
+enum prof_phase {
+    PROF_WORLD_STEP = 0,
+    PROF_AI,
+    PROF_MOVE,
+    PROF_PROD,
+    PROF_JOBS,
+    PROF_PATH,
+    PROF_INFLUENCE,
+    PROF_DRAW,
+    PROF_RENDER,
+    PROF_PHASES
+};
+
+enum prof_counter {
+    PROF_TICKS = 0,
+    PROF_AI_STEPS,
+    PROF_MOVED,
+    PROF_TILE_CHANGES,
+    PROF_PATHS,
+    PROF_PATH_NODES,
+    PROF_FRAMES,
+    PROF_CYCLES,
+    PROF_ASSIGNMENTS,
+    PROF_INFLUENCE_CHUNKS,
+    PROF_COUNTERS
+};
+
+/* rows of the trace, by the thread which times the phase */
+enum prof_thread {
+    PROF_SIM_THREAD = 1,
+    PROF_UI_THREAD
+};
+
+#define PROF_SAMPLES 256
+#define PROF_BUCKETS 20            /* bucket i holds samples of [2^i, 2^(i+1)) microseconds */
+
+struct prof_sample {
+    uint64_t start;                 /* performance counter ticks */
+    uint64_t dur;
+};
+
+struct prof_phase_stat {
+    const char *name;
+    enum prof_thread thread;
+    uint64_t begin;                 /* start of the open sample */
+    unsigned long n;                /* total samples, the ring index is n % PROF_SAMPLES */
+    struct prof_sample samples[PROF_SAMPLES];
+    unsigned hist[PROF_BUCKETS];    /* histogram of the samples within the ring */
+};
+
+#ifdef PROF_ENABLED
+
+#define prof_begin(p)       prof_begin_(p)
+#define prof_end(p)         prof_end_(p)
+#define prof_count(c, n)    prof_count_((c), (n))
+
+void prof_begin_(enum prof_phase p);
+void prof_end_(enum prof_phase p);
+void prof_count_(enum prof_counter c, uint64_t n);
+struct prof_phase_stat *prof_get_phase(enum prof_phase p);
+uint64_t prof_get_counter(enum prof_counter c);
+const char *prof_counter_name(enum prof_counter c);
+double prof_to_us(uint64_t ticks);
+int prof_dump_trace(const char *fname);
+
+#else
+
+#define prof_begin(p)       ((void)0)
+#define prof_end(p)         ((void)0)
+#define prof_count(c, n)    ((void)0)
+
+#endif /* PROF_ENABLED */
+
+#endif /* _PROF_H_ */
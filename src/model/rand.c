@@ -1,6 +1,16 @@
 #include"rand.h"
 #include "types.h"
 #include <time.h>
+#include <limits.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+  #include <immintrin.h>
+#elif defined(__SSE4_1__)
+  #include <smmintrin.h>
+#elif defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
 
 /* Mersene twister pseudorandom number generator */
 
@@ -34,10 +44,59 @@ void mt_init_state(mt_state* state, uint32_t seed) {
     }
     
     state->state_index = 0;
+    state->kind = RAND_MT;
+}
+
+/* splitmix64 spreads the seed over the xoshiro state, which must not be all zeros */
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t xoshiro_next(uint64_t *st) {
+    uint64_t result = rotl(st[1] * 5, 7) * 9;
+    uint64_t tmp = st[1] << 17;
+
+    st[2] ^= st[0];
+    st[3] ^= st[1];
+    st[1] ^= st[2];
+    st[0] ^= st[3];
+    st[2] ^= tmp;
+    st[3] = rotl(st[3], 45);
+
+    return result;
+}
+
+void rand_init_state(mt_state* state, int kind, uint32_t seed) {
+    mt_init_state(state, seed);
+
+    if (kind == RAND_XOSHIRO) {
+        uint64_t x = seed;
+        for (int i = 0; i != 4; ++i)
+            state->xoshiro[i] = splitmix64(&x);
+        state->kind = RAND_XOSHIRO;
+    }
+}
+
+/* switches the state to another generator seeded by the current one,
+ * so the sequence still depends on the initial seed only
+ */
+void rand_select(mt_state* state, int kind) {
+    if (state->kind != kind)
+        rand_init_state(state, kind, mt_random_uint32(state));
 }
 
 
 uint32_t mt_random_uint32(mt_state* state) {
+    if (state->kind == RAND_XOSHIRO)
+        return xoshiro_next(state->xoshiro) >> 32;
+
     uint32_t* state_array = &(state->state_array[0]);
     
     int k = state->state_index;      // point to current state location
@@ -73,6 +132,136 @@ uint32_t mt_random_uint32(mt_state* state) {
     return z; 
 }
 
+/*
+ * Block generation
+ *
+ * When the state index is at 0 the next 624 values are the tempered words
+ * of the whole state regenerated in order, so it is regenerated in one
+ * pass SFMT style: word k depends on the old word k+1 and on word k+m,
+ * which is old for k < n-m and already regenerated (k-(n-m) behind) after
+ * that, both far enough for 8 (AVX2) or 4 (SSE2) words at a time. The
+ * values are the same as the ones of mt_random_uint32 called in a loop.
+ */
+
+#define MT_WORD(dst, from) do { \
+        uint32_t x_ = (st[dst] & UMASK) | (st[(dst) + 1] & LMASK); \
+        st[dst] = st[from] ^ (x_ >> 1) ^ (x_ & 1 ? a : 0); \
+    } while (0)
+
+#if defined(__AVX2__)
+  #define MT_WIDTH 8
+  #define MT_WORDS(dst, from) do { \
+        __m256i x_ = _mm256_or_si256(_mm256_and_si256(_mm256_loadu_si256((__m256i *)(st + (dst))), upper), \
+                                     _mm256_and_si256(_mm256_loadu_si256((__m256i *)(st + (dst) + 1)), lower)); \
+        __m256i odd_ = _mm256_cmpeq_epi32(_mm256_and_si256(x_, one), one); \
+        x_ = _mm256_xor_si256(_mm256_srli_epi32(x_, 1), _mm256_and_si256(odd_, matrix)); \
+        _mm256_storeu_si256((__m256i *)(st + (dst)), _mm256_xor_si256(_mm256_loadu_si256((__m256i *)(st + (from))), x_)); \
+    } while (0)
+#elif defined(__SSE2__)
+  #define MT_WIDTH 4
+  #define MT_WORDS(dst, from) do { \
+        __m128i x_ = _mm_or_si128(_mm_and_si128(_mm_loadu_si128((__m128i *)(st + (dst))), upper), \
+                                  _mm_and_si128(_mm_loadu_si128((__m128i *)(st + (dst) + 1)), lower)); \
+        __m128i odd_ = _mm_cmpeq_epi32(_mm_and_si128(x_, one), one); \
+        x_ = _mm_xor_si128(_mm_srli_epi32(x_, 1), _mm_and_si128(odd_, matrix)); \
+        _mm_storeu_si128((__m128i *)(st + (dst)), _mm_xor_si128(_mm_loadu_si128((__m128i *)(st + (from))), x_)); \
+    } while (0)
+#endif
+
+static void mt_regenerate(uint32_t *st) {
+    int k = 0;
+
+#if defined(__AVX2__)
+    const __m256i upper = _mm256_set1_epi32((int)UMASK);
+    const __m256i lower = _mm256_set1_epi32((int)LMASK);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i matrix = _mm256_set1_epi32((int)a);
+#elif defined(__SSE2__)
+    const __m128i upper = _mm_set1_epi32((int)UMASK);
+    const __m128i lower = _mm_set1_epi32((int)LMASK);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i matrix = _mm_set1_epi32((int)a);
+#endif
+
+    /* words with the old word k+m */
+#ifdef MT_WORDS
+    for (; k + MT_WIDTH <= n - m; k += MT_WIDTH)
+        MT_WORDS(k, k + m);
+#endif
+    for (; k < n - m; ++k)
+        MT_WORD(k, k + m);
+
+    /* words with the regenerated word k-(n-m) */
+#ifdef MT_WORDS
+    for (; k + MT_WIDTH <= n - 1; k += MT_WIDTH)
+        MT_WORDS(k, k - (n - m));
+#endif
+    for (; k < n - 1; ++k)
+        MT_WORD(k, k - (n - m));
+
+    /* the last word wraps to the regenerated word 0 */
+    uint32_t x = (st[n - 1] & UMASK) | (st[0] & LMASK);
+    st[n - 1] = st[m - 1] ^ (x >> 1) ^ (x & 1 ? a : 0);
+}
+
+#undef MT_WORD
+#undef MT_WORDS
+#undef MT_WIDTH
+
+static void mt_temper(const uint32_t *st, uint32_t *buf) {
+    int k = 0;
+
+#if defined(__AVX2__)
+    const __m256i mask_b = _mm256_set1_epi32((int)b);
+    const __m256i mask_c = _mm256_set1_epi32((int)c);
+    for (; k + 8 <= n; k += 8) {
+        __m256i y = _mm256_loadu_si256((__m256i *)(st + k));
+        y = _mm256_xor_si256(y, _mm256_srli_epi32(y, u));
+        y = _mm256_xor_si256(y, _mm256_and_si256(_mm256_slli_epi32(y, s), mask_b));
+        y = _mm256_xor_si256(y, _mm256_and_si256(_mm256_slli_epi32(y, t), mask_c));
+        _mm256_storeu_si256((__m256i *)(buf + k), _mm256_xor_si256(y, _mm256_srli_epi32(y, l)));
+    }
+#elif defined(__SSE2__)
+    const __m128i mask_b = _mm_set1_epi32((int)b);
+    const __m128i mask_c = _mm_set1_epi32((int)c);
+    for (; k + 4 <= n; k += 4) {
+        __m128i y = _mm_loadu_si128((__m128i *)(st + k));
+        y = _mm_xor_si128(y, _mm_srli_epi32(y, u));
+        y = _mm_xor_si128(y, _mm_and_si128(_mm_slli_epi32(y, s), mask_b));
+        y = _mm_xor_si128(y, _mm_and_si128(_mm_slli_epi32(y, t), mask_c));
+        _mm_storeu_si128((__m128i *)(buf + k), _mm_xor_si128(y, _mm_srli_epi32(y, l)));
+    }
+#endif
+
+    for (; k < n; ++k) {
+        uint32_t y = st[k];
+        y = y ^ (y >> u);
+        y = y ^ ((y << s) & b);
+        y = y ^ ((y << t) & c);
+        buf[k] = y ^ (y >> l);
+    }
+}
+
+void mt_fill_uint32(mt_state* state, uint32_t *buf, int cnt) {
+    int i = 0;
+
+    if (state->kind == RAND_XOSHIRO) {
+        for (; i < cnt; ++i)
+            buf[i] = xoshiro_next(state->xoshiro) >> 32;
+        return;
+    }
+
+    /* up to the start of the state, whole states, then the rest */
+    for (; i < cnt && state->state_index != 0; ++i)
+        buf[i] = mt_random_uint32(state);
+    for (; cnt - i >= n; i += n) {
+        mt_regenerate(state->state_array);
+        mt_temper(state->state_array, buf + i);
+    }
+    for (; i < cnt; ++i)
+        buf[i] = mt_random_uint32(state);
+}
+
 uint32_t uniform_uint_distribution(uint32_t num, uint32_t b_, uint32_t e_) {
     return num % (e_ - b_ + 1) + b_;
 }
@@ -93,18 +282,20 @@ void perlin2d_init(struct perlin2d *p, mt_state *state) {
         //p->permutation_table[i] = uniform_uint_distribution(mt_random_uint32(state), 0, 255) & 3;
 }
 
-static struct vec2f get_pseudo_random_gradient_vector(struct perlin2d *p, int x, int y) {
-    struct vec2f rv;
+/* gradients by the value of the permutation table */
+static const float gradient_x[4] = { 1, -1, 0,  0 };
+static const float gradient_y[4] = { 0,  0, 1, -1 };
+
+static int get_gradient_index(struct perlin2d *p, int x, int y) {
     /* int v = (int)(((x * 1836311903) ^ (y * 2971215073) + 4807526976) & (PERLIN2D_PERMUTATION_TABLE_SIZE - 1)); */
     int v = (int)(((x * 1836311903) ^ ((y * 2971215073) + 4807526976)) & (PERLIN2D_PERMUTATION_TABLE_SIZE - 1));
-    v = p->permutation_table[v];
+    return p->permutation_table[v];
+}
 
-    switch (v) {
-    case 0:  rv.x = 1; rv.y = 0; return rv;
-    case 1:  rv.x = -1; rv.y = 0; return rv;;
-    case 2:  rv.x = 0; rv.y = 1; return rv;
-    default: rv.x = 0; rv.y = -1; return rv;
-    }
+static struct vec2f get_pseudo_random_gradient_vector(struct perlin2d *p, int x, int y) {
+    int v = get_gradient_index(p, x, y);
+    struct vec2f rv = { gradient_x[v], gradient_y[v] };
+    return rv;
 }
 
 /* returns -0.5 <= retval <= 0.5 */
@@ -156,6 +347,196 @@ float perlin2d_noise_x(struct perlin2d *p, float fx, float fy, int octaves, floa
     return result/max;
 }
 
+/*
+ * Batch noise
+ *
+ * Samples of a row share their top and the lattice hashes, so the four
+ * gradient indices are looked up once per lattice cell, the right corners
+ * of a cell are the left corners of the next one. The rest is done 8 (AVX2)
+ * or 4 (SSE4.1) samples at a time with the gradients taken from a 4 entry
+ * table held in a register, there is a scalar fallback as well.
+ *
+ * The kernels do the same operations as perlin2d_noise in the same order,
+ * but the compiler may fuse multiplies and adds differently in both of them,
+ * so a sample differs from perlin2d_noise by at most PERLIN2D_EPSILON. Rows
+ * are padded to whole vectors, so every sample goes through the same code
+ * and depends on its coordinates only, wherever the row starts.
+ */
+
+#define PERLIN2D_BLOCK 64       /* samples which gradients are looked up at once */
+
+#if defined(__AVX2__)
+  #define PERLIN2D_LANES 8
+#elif defined(__SSE4_1__)
+  #define PERLIN2D_LANES 4
+#else
+  #define PERLIN2D_LANES 1
+#endif
+
+struct perlin2d_block {
+    float px[PERLIN2D_BLOCK];               /* x within the lattice cell */
+    int g[4][PERLIN2D_BLOCK];               /* top left, top right, bottom left, bottom right */
+};
+
+static void
+perlin2d_block_run(struct perlin2d_block *blk, float py, float sy, int cnt, float *out) {
+    int i = 0;
+
+#if defined(__AVX2__)
+    const __m256 lut_x = _mm256_setr_ps(1, -1, 0, 0, 1, -1, 0, 0);
+    const __m256 lut_y = _mm256_setr_ps(0, 0, 1, -1, 0, 0, 1, -1);
+    const __m256 one = _mm256_set1_ps(1);
+    const __m256 vpy = _mm256_set1_ps(py);
+    const __m256 vpy1 = _mm256_set1_ps(py - 1);
+    const __m256 vsy = _mm256_set1_ps(sy);
+    for (; i + 8 <= cnt; i += 8) {
+        __m256 px  = _mm256_loadu_ps(blk->px + i);
+        __m256 px1 = _mm256_sub_ps(px, one);
+        __m256i g0 = _mm256_loadu_si256((__m256i *)(blk->g[0] + i));
+        __m256i g1 = _mm256_loadu_si256((__m256i *)(blk->g[1] + i));
+        __m256i g2 = _mm256_loadu_si256((__m256i *)(blk->g[2] + i));
+        __m256i g3 = _mm256_loadu_si256((__m256i *)(blk->g[3] + i));
+
+        __m256 tx1 = _mm256_add_ps(_mm256_mul_ps(px,  _mm256_permutevar_ps(lut_x, g0)), _mm256_mul_ps(vpy,  _mm256_permutevar_ps(lut_y, g0)));
+        __m256 tx2 = _mm256_add_ps(_mm256_mul_ps(px1, _mm256_permutevar_ps(lut_x, g1)), _mm256_mul_ps(vpy,  _mm256_permutevar_ps(lut_y, g1)));
+        __m256 bx1 = _mm256_add_ps(_mm256_mul_ps(px,  _mm256_permutevar_ps(lut_x, g2)), _mm256_mul_ps(vpy1, _mm256_permutevar_ps(lut_y, g2)));
+        __m256 bx2 = _mm256_add_ps(_mm256_mul_ps(px1, _mm256_permutevar_ps(lut_x, g3)), _mm256_mul_ps(vpy1, _mm256_permutevar_ps(lut_y, g3)));
+
+        /* quntic curve */
+        __m256 sx = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(px, px), px),
+            _mm256_add_ps(_mm256_mul_ps(px, _mm256_sub_ps(_mm256_mul_ps(px, _mm256_set1_ps(6)), _mm256_set1_ps(15))), _mm256_set1_ps(10)));
+
+        __m256 tx = _mm256_add_ps(tx1, _mm256_mul_ps(_mm256_sub_ps(tx2, tx1), sx));
+        __m256 bx = _mm256_add_ps(bx1, _mm256_mul_ps(_mm256_sub_ps(bx2, bx1), sx));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(tx, _mm256_mul_ps(_mm256_sub_ps(bx, tx), vsy)));
+    }
+#elif defined(__SSE4_1__)
+    /* there is no variable float permute before AVX, so the table is
+     * shuffled by bytes: gradient g takes bytes 4g .. 4g+3
+     */
+    const __m128i lut_x = _mm_castps_si128(_mm_setr_ps(1, -1, 0, 0));
+    const __m128i lut_y = _mm_castps_si128(_mm_setr_ps(0, 0, 1, -1));
+    const __m128i spread = _mm_set1_epi32(0x04040404);
+    const __m128i bytes = _mm_set1_epi32(0x03020100);
+    const __m128 one = _mm_set1_ps(1);
+    const __m128 vpy = _mm_set1_ps(py);
+    const __m128 vpy1 = _mm_set1_ps(py - 1);
+    const __m128 vsy = _mm_set1_ps(sy);
+    for (; i + 4 <= cnt; i += 4) {
+        __m128 px  = _mm_loadu_ps(blk->px + i);
+        __m128 px1 = _mm_sub_ps(px, one);
+        __m128i g0 = _mm_add_epi32(_mm_mullo_epi32(_mm_loadu_si128((__m128i *)(blk->g[0] + i)), spread), bytes);
+        __m128i g1 = _mm_add_epi32(_mm_mullo_epi32(_mm_loadu_si128((__m128i *)(blk->g[1] + i)), spread), bytes);
+        __m128i g2 = _mm_add_epi32(_mm_mullo_epi32(_mm_loadu_si128((__m128i *)(blk->g[2] + i)), spread), bytes);
+        __m128i g3 = _mm_add_epi32(_mm_mullo_epi32(_mm_loadu_si128((__m128i *)(blk->g[3] + i)), spread), bytes);
+
+        __m128 tx1 = _mm_add_ps(_mm_mul_ps(px,  _mm_castsi128_ps(_mm_shuffle_epi8(lut_x, g0))), _mm_mul_ps(vpy,  _mm_castsi128_ps(_mm_shuffle_epi8(lut_y, g0))));
+        __m128 tx2 = _mm_add_ps(_mm_mul_ps(px1, _mm_castsi128_ps(_mm_shuffle_epi8(lut_x, g1))), _mm_mul_ps(vpy,  _mm_castsi128_ps(_mm_shuffle_epi8(lut_y, g1))));
+        __m128 bx1 = _mm_add_ps(_mm_mul_ps(px,  _mm_castsi128_ps(_mm_shuffle_epi8(lut_x, g2))), _mm_mul_ps(vpy1, _mm_castsi128_ps(_mm_shuffle_epi8(lut_y, g2))));
+        __m128 bx2 = _mm_add_ps(_mm_mul_ps(px1, _mm_castsi128_ps(_mm_shuffle_epi8(lut_x, g3))), _mm_mul_ps(vpy1, _mm_castsi128_ps(_mm_shuffle_epi8(lut_y, g3))));
+
+        /* quntic curve */
+        __m128 sx = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(px, px), px),
+            _mm_add_ps(_mm_mul_ps(px, _mm_sub_ps(_mm_mul_ps(px, _mm_set1_ps(6)), _mm_set1_ps(15))), _mm_set1_ps(10)));
+
+        __m128 tx = _mm_add_ps(tx1, _mm_mul_ps(_mm_sub_ps(tx2, tx1), sx));
+        __m128 bx = _mm_add_ps(bx1, _mm_mul_ps(_mm_sub_ps(bx2, bx1), sx));
+        _mm_storeu_ps(out + i, _mm_add_ps(tx, _mm_mul_ps(_mm_sub_ps(bx, tx), vsy)));
+    }
+#endif
+
+    /* scalar fallback and the tail */
+    for (; i < cnt; ++i) {
+        float px = blk->px[i];
+        float tx1 = px       * gradient_x[ blk->g[0][i] ] + py       * gradient_y[ blk->g[0][i] ];
+        float tx2 = (px - 1) * gradient_x[ blk->g[1][i] ] + py       * gradient_y[ blk->g[1][i] ];
+        float bx1 = px       * gradient_x[ blk->g[2][i] ] + (py - 1) * gradient_y[ blk->g[2][i] ];
+        float bx2 = (px - 1) * gradient_x[ blk->g[3][i] ] + (py - 1) * gradient_y[ blk->g[3][i] ];
+        float sx = quntic_curve(px);
+        float tx = lerp(tx1, tx2, sx);
+        float bx = lerp(bx1, bx2, sx);
+        out[i] = lerp(tx, bx, sy);
+    }
+}
+
+/* out[i] = perlin2d_noise(p, fx + i * step, fy) for 0 <= i < cnt */
+void perlin2d_noise_row(struct perlin2d *p, float fx, float fy, float step, int cnt, float *out) {
+    struct perlin2d_block blk;
+    float samples[PERLIN2D_BLOCK];
+    int top = fy;
+    float py = fy - top;
+    float sy = quntic_curve(py);
+
+    for (int i = 0; i < cnt; i += PERLIN2D_BLOCK) {
+        int len = cnt - i < PERLIN2D_BLOCK ? cnt - i : PERLIN2D_BLOCK;
+        int padded = (len + PERLIN2D_LANES - 1) / PERLIN2D_LANES * PERLIN2D_LANES;
+        int last = INT_MIN, g0 = 0, g1 = 0, g2 = 0, g3 = 0;
+
+        for (int j = 0; j != padded; ++j) {
+            float x = fx + (float)(i + j) * step;
+            int left = x;
+            blk.px[j] = x - left;
+
+            if (left != last) {
+                if (last != INT_MIN && left == last + 1) {
+                    g0 = g1;
+                    g2 = g3;
+                } else {
+                    g0 = get_gradient_index(p, left, top);
+                    g2 = get_gradient_index(p, left, top + 1);
+                }
+                g1 = get_gradient_index(p, left + 1, top);
+                g3 = get_gradient_index(p, left + 1, top + 1);
+                last = left;
+            }
+
+            blk.g[0][j] = g0;
+            blk.g[1][j] = g1;
+            blk.g[2][j] = g2;
+            blk.g[3][j] = g3;
+        }
+
+        perlin2d_block_run(&blk, py, sy, padded, samples);
+        memcpy(out + i, samples, sizeof(float) * len);
+    }
+}
+
+/* out[y * width + x] = perlin2d_noise_x(p, fx + x * step, fy + y * step, octaves, persistence) */
+void perlin2d_noise_grid(struct perlin2d *p, float fx, float fy, float step, int width, int height,
+    int octaves, float persistence, float *out)
+{
+    float row[PERLIN2D_BLOCK];
+
+    for (int y = 0; y != height; ++y) {
+        for (int x = 0; x < width; x += PERLIN2D_BLOCK) {
+            int len = width - x < PERLIN2D_BLOCK ? width - x : PERLIN2D_BLOCK;
+            float *dst = out + (size_t)y * width + x;
+            float ox = fx + (float)x * step;
+            float oy = fy + (float)y * step;
+            float ostep = step;
+            float amplitude = 1;
+            float max = 0;
+
+            for (int j = 0; j != len; ++j)
+                dst[j] = 0;
+
+            for (int o = 0; o != octaves; ++o) {
+                max += amplitude;
+                perlin2d_noise_row(p, ox, oy, ostep, len, row);
+                for (int j = 0; j != len; ++j)
+                    dst[j] += row[j] * amplitude;
+                amplitude *= persistence;
+                ox *= 2;
+                oy *= 2;
+                ostep *= 2;
+            }
+
+            for (int j = 0; j != len; ++j)
+                dst[j] /= max;
+        }
+    }
+}
+
 /*
  * Helper functions
  */
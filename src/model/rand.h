@@ -7,9 +7,20 @@
 
 #define _n_ 624
 
+/* Generators, selected per world by its json:
+ *     "random": "xoshiro"
+ * mt_random_uint32 and mt_fill_uint32 draw from the generator of the state
+ */
+enum rand_t {
+    RAND_MT = 0,                    // Mersene twister, the default
+    RAND_XOSHIRO                    // xoshiro256**, faster and with a 32 byte state
+};
+
 typedef struct mt_state {
     uint32_t state_array[_n_];      // the array for the state vector 
     int state_index;                // index into state vector array, 0 <= state_index <= n-1   always
+    int kind;                       // enum rand_t
+    uint64_t xoshiro[4];            // state of xoshiro256**
 } mt_state;
 
 #define PERLIN2D_PERMUTATION_TABLE_SIZE 1024 
@@ -20,6 +31,9 @@ struct perlin2d {
 uint32_t random_device();           // generate pseudo random seed
 void mt_init_state(mt_state* state, uint32_t seed); 
 uint32_t mt_random_uint32(mt_state* state);
+void mt_fill_uint32(mt_state* state, uint32_t *buf, int n);    // same as n calls of mt_random_uint32
+void rand_init_state(mt_state* state, int kind, uint32_t seed);
+void rand_select(mt_state* state, int kind);
 uint32_t uniform_uint_distribution(uint32_t num, uint32_t b_, uint32_t e_);
 
 /* Perlin noise */
@@ -27,6 +41,15 @@ void perlin2d_init(struct perlin2d *p, mt_state *state);
 float perlin2d_noise(struct perlin2d *p, float fx, float fy);
 float perlin2d_noise_x(struct perlin2d *p, float fx, float fy, int octaves, float persistence);
 
+/* Batch Perlin noise: a row or a grid of samples step apart, SIMD kernels
+ * are used if the build enables AVX2 or SSE4.1. Samples may differ from
+ * the ones of perlin2d_noise and perlin2d_noise_x by PERLIN2D_EPSILON
+ */
+#define PERLIN2D_EPSILON 1e-6f
+void perlin2d_noise_row(struct perlin2d *p, float fx, float fy, float step, int n, float *out);
+void perlin2d_noise_grid(struct perlin2d *p, float fx, float fy, float step, int width, int height,
+    int octaves, float persistence, float *out);
+
 /* linear interpolation of t_ between a_ and b_ where 0.0 <= t_ <= 1.0 */ 
 float lerp(float a_, float b_, float t_);
 int trim(int min, int max, int t_);
@@ -0,0 +1,254 @@
+#include "res.h"
+#include "app.h"
+#include "serial.h"
+#include "stb_ds.h"
+#include <malloc.h>
+#include <string.h>
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+static const char *type_names[RT_MAX] = { "unknown", "wood" };
+
+static unsigned get_chunk_row(struct resource_layer *l, enum resource_t type, int cx, int y);
+static void scan_chunk(struct resource_layer *l, enum resource_t type, int cx, int cy, struct vec2 from, int *best_d, struct vec2 *out);
+
+void
+res_init(struct resource_layer *l) {
+    memset(l, 0, sizeof(*l));
+}
+
+void
+res_free(struct resource_layer *l) {
+    for (int t = 0; t != RT_MAX; ++t) {
+        free(l->bits[t]);
+        free(l->count[t]);
+    }
+
+    free(l->amount);
+    res_init(l);
+}
+
+/* empties the layer and sizes it for the map */
+void
+res_reset(struct resource_layer *l, struct vec2 size) {
+    res_free(l);
+
+    l->size = size;
+    l->words = (size.x + 63) >> 6;
+    l->chunks.x = (size.x + RES_CHUNK - 1) >> RES_CHUNK_SHIFT;
+    l->chunks.y = (size.y + RES_CHUNK - 1) >> RES_CHUNK_SHIFT;
+
+    for (int t = 0; t != RT_MAX; ++t) {
+        l->bits[t] = calloc(l->words * size.y, sizeof(uint64_t));
+        l->count[t] = calloc(l->chunks.x * l->chunks.y, sizeof(int));
+    }
+
+    l->amount = calloc(size.x * size.y, sizeof(uint16_t));
+}
+
+/* reads the optional 'resource' object of a tile type, v can be NULL */
+int
+res_read_tile(struct tile_t *t, struct jq_value *v) {
+    struct jq_value *k;
+
+    t->resource = RT_UNKNOWN;
+    t->resource_part = .0;
+    t->resource_amount = 0;
+
+    if (!v) return 0;
+
+    if (!jq_isobject(v)) {
+        app_warning("'resource' of tile '%s' should be an object", t->name);
+        return 1;
+    }
+
+    k = jq_find(v, "type", 0);
+    if (k && jq_isstring(k)) {
+        for (int i = 1; i != RT_MAX; ++i) {
+            if (!strcmp(type_names[i], k->value.string))
+                t->resource = i;
+        }
+    }
+    if (t->resource == RT_UNKNOWN) {
+        app_warning("'resource.type' of tile '%s' is not found or unknown", t->name);
+        return 1;
+    }
+
+    k = jq_find(v, "part", 0);
+    if (k && jq_isnumber(k)) {
+        t->resource_part = jq_isreal(k) ? k->value.real : (float)k->value.integer;
+    } else {
+        app_warning("'resource.part' of tile '%s' is not found or not a number", t->name);
+        return 1;
+    }
+
+    k = jq_find(v, "amount", 0);
+    if (k && jq_isinteger(k) && k->value.integer > 0 && k->value.integer <= UINT16_MAX) {
+        t->resource_amount = k->value.integer;
+    } else {
+        app_warning("'resource.amount' of tile '%s' should be an integer within 1 and %i", t->name, UINT16_MAX);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* adds amount of the resource to the tile, returns 1 if the tile holds another one */
+int
+res_add(struct resource_layer *l, enum resource_t type, int x, int y, int amount) {
+    int i = l->size.x * y + x;
+    uint64_t bit = (uint64_t)1 << (x & 63);
+    uint64_t *word = &l->bits[type][l->words * y + (x >> 6)];
+
+    if (amount <= 0)
+        return 0;
+
+    if (!(*word & bit)) {
+        if (l->amount[i])
+            return 1;
+
+        *word |= bit;
+        ++l->count[type][l->chunks.x * (y >> RES_CHUNK_SHIFT) + (x >> RES_CHUNK_SHIFT)];
+        ++l->total[type];
+    }
+
+    l->amount[i] = min(l->amount[i] + amount, UINT16_MAX);
+    return 0;
+}
+
+/* takes amount of the resource from the tile, returns the amount taken */
+int
+res_take(struct resource_layer *l, enum resource_t type, int x, int y, int amount) {
+    int i = l->size.x * y + x;
+    uint64_t bit = (uint64_t)1 << (x & 63);
+    uint64_t *word = &l->bits[type][l->words * y + (x >> 6)];
+
+    if (!(*word & bit))
+        return 0;
+
+    amount = min(amount, l->amount[i]);
+    l->amount[i] -= amount;
+
+    /* depleted */
+    if (!l->amount[i]) {
+        *word &= ~bit;
+        --l->count[type][l->chunks.x * (y >> RES_CHUNK_SHIFT) + (x >> RES_CHUNK_SHIFT)];
+        --l->total[type];
+    }
+
+    return amount;
+}
+
+/* returns amount of the resource on the tile */
+int
+res_get(struct resource_layer *l, enum resource_t type, int x, int y) {
+    if (!(l->bits[type][l->words * y + (x >> 6)] & ((uint64_t)1 << (x & 63))))
+        return 0;
+
+    return l->amount[l->size.x * y + x];
+}
+
+/* finds the nearest tile of the resource within r tiles, returns 1 if there is none */
+int
+res_nearest(struct resource_layer *l, enum resource_t type, struct vec2 from, int r, struct vec2 *out) {
+    int cx = from.x >> RES_CHUNK_SHIFT;
+    int cy = from.y >> RES_CHUNK_SHIFT;
+    int best_d = r * r + 1;
+    int rings = (r >> RES_CHUNK_SHIFT) + 1;
+
+    if (!l->total[type])
+        return 1;
+
+    for (int k = 0; k <= rings; ++k) {
+        /* tiles of ring k are farther than k - 1 chunks */
+        int bound = (k - 1) * RES_CHUNK;
+        if (k > 0 && bound * bound >= best_d)
+            break;
+
+        for (int y = cy - k; y <= cy + k; ++y) {
+            if (y < 0 || y >= l->chunks.y)
+                continue;
+
+            if (y == cy - k || y == cy + k) {
+                for (int x = max(cx - k, 0), xe = min(cx + k, l->chunks.x - 1); x <= xe; ++x)
+                    scan_chunk(l, type, x, y, from, &best_d, out);
+            } else {
+                if (cx - k >= 0) scan_chunk(l, type, cx - k, y, from, &best_d, out);
+                if (cx + k < l->chunks.x) scan_chunk(l, type, cx + k, y, from, &best_d, out);
+            }
+        }
+    }
+
+    return best_d > r * r;
+}
+
+/* appends resources of the type within the rect to out (stb_ds array), returns their number */
+int
+res_in_rect(struct resource_layer *l, enum resource_t type, struct recti rect, struct resource **out) {
+    int x0 = max(rect.x, 0), x1 = min(rect.x + rect.w, l->size.x) - 1;
+    int y0 = max(rect.y, 0), y1 = min(rect.y + rect.h, l->size.y) - 1;
+    int num = 0;
+
+    if (x0 > x1 || y0 > y1)
+        return 0;
+
+    for (int cy = y0 >> RES_CHUNK_SHIFT; cy <= y1 >> RES_CHUNK_SHIFT; ++cy) {
+        for (int cx = x0 >> RES_CHUNK_SHIFT; cx <= x1 >> RES_CHUNK_SHIFT; ++cx) {
+            if (!l->count[type][l->chunks.x * cy + cx])
+                continue;
+
+            /* columns of the chunk within the rect */
+            int cbase = cx << RES_CHUNK_SHIFT;
+            int lo = max(x0 - cbase, 0), hi = min(x1 - cbase, RES_CHUNK - 1);
+            unsigned mask = ((2u << hi) - 1) & ~((1u << lo) - 1);
+
+            for (int y = max(cy << RES_CHUNK_SHIFT, y0), ye = min(((cy + 1) << RES_CHUNK_SHIFT) - 1, y1); y <= ye; ++y) {
+                unsigned m = get_chunk_row(l, type, cx, y) & mask;
+                while (m) {
+                    int x = cbase + __builtin_ctz(m);
+                    struct resource res = { type, { x, y }, l->amount[l->size.x * y + x] };
+                    arrput(*out, res);
+                    ++num;
+                    m &= m - 1;
+                }
+            }
+        }
+    }
+
+    return num;
+}
+
+const char *
+res_type_name(enum resource_t type) {
+    return type_names[type];
+}
+
+/* bits of the chunk row, chunks are aligned with 64 bit words */
+static unsigned
+get_chunk_row(struct resource_layer *l, enum resource_t type, int cx, int y) {
+    int x = cx << RES_CHUNK_SHIFT;
+    return (l->bits[type][l->words * y + (x >> 6)] >> (x & 63)) & ((1u << RES_CHUNK) - 1);
+}
+
+static void
+scan_chunk(struct resource_layer *l, enum resource_t type, int cx, int cy, struct vec2 from, int *best_d, struct vec2 *out) {
+    if (!l->count[type][l->chunks.x * cy + cx])
+        return;
+
+    for (int y = cy << RES_CHUNK_SHIFT, ye = min(y + RES_CHUNK, l->size.y); y < ye; ++y) {
+        unsigned m = get_chunk_row(l, type, cx, y);
+        int dy = y - from.y;
+        while (m) {
+            int x = (cx << RES_CHUNK_SHIFT) + __builtin_ctz(m);
+            int dx = x - from.x;
+            int d = dx * dx + dy * dy;
+            if (d < *best_d) {
+                *best_d = d;
+                out->x = x;
+                out->y = y;
+            }
+            m &= m - 1;
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef _RES_H_
+#define _RES_H_
+
+#include "types.h"
+
+/* Resource layer
+ *
+ * Resources are aligned with map tiles, a tile holds one resource at most.
+ * Every resource type has an occupancy bitmap of the map and the number
+ * of its tiles per chunk of RES_CHUNK x RES_CHUNK tiles. Queries skip
+ * empty chunks and walk set bits of a chunk row, which is a 16 bit slice
+ * of one bitmap word. Taking the last of a resource clears its bit and
+ * decrements the chunk count, nothing else is to be updated.
+ *
+ * Tile types of world json can have a resource:
+ *     "resource": { "type": "wood", "part": 0.3, "amount": 100 }
+ */
+
+#define RES_CHUNK_SHIFT 4
+#define RES_CHUNK       (1 << RES_CHUNK_SHIFT)
+
+struct jq_value;
+
+void res_init(struct resource_layer *l);
+void res_free(struct resource_layer *l);
+void res_reset(struct resource_layer *l, struct vec2 size);
+int res_read_tile(struct tile_t *t, struct jq_value *v);
+int res_add(struct resource_layer *l, enum resource_t type, int x, int y, int amount);
+int res_take(struct resource_layer *l, enum resource_t type, int x, int y, int amount);
+int res_get(struct resource_layer *l, enum resource_t type, int x, int y);
+int res_nearest(struct resource_layer *l, enum resource_t type, struct vec2 from, int r, struct vec2 *out);
+int res_in_rect(struct resource_layer *l, enum resource_t type, struct recti rect, struct resource **out);
+const char *res_type_name(enum resource_t type);
+
+#endif /* _RES_H_ */
@@ -90,6 +90,24 @@ read_images(struct jq_value *json) {
     return rv;
 }
 
+/* reads integer key of object v within min and max, def if there is no
+ * key unless def is READ_REQUIRED; section names v in the warning
+ */
+int
+read_int(struct jq_value *v, const char *section, const char *key, int min, int max, int def, int *out) {
+    struct jq_value *k = jq_find(v, key, 0);
+    if (!k && def != READ_REQUIRED) {
+        *out = def;
+    } else if (k && jq_isinteger(k) && k->value.integer >= min && k->value.integer <= max) {
+        *out = k->value.integer;
+    } else {
+        app_warning("'%s.%s' should be an integer within %i and %i", section, key, min, max);
+        return 1;
+    }
+
+    return 0;
+}
+
 static char *read_file(const char *fname, size_t *rsz) {
     size_t sz;
     char *rv = NULL;
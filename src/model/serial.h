@@ -3,11 +3,15 @@
 
 #define JQ_WITH_DOM
 #include "jquick.h"
+#include <limits.h>
+
+#define READ_REQUIRED INT_MIN   /* def of read_int for keys which are to be there */
 
 struct nk_image_hash;
 
 struct jq_value *read_json(const char *fname);
 struct nk_image_hash *read_images(struct jq_value *json);
+int read_int(struct jq_value *v, const char *section, const char *key, int min, int max, int def, int *out);
 
 #endif /* _SERIAL_H_ */
 
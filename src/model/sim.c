@@ -0,0 +1,253 @@
+#include "sim.h"
+#include "world.h"
+#include "ai.h"
+#include "stats.h"
+#include "influence.h"
+#include "map.h"
+#include "app.h"
+#include "stb_ds.h"
+#include <string.h>
+
+#define SIM_FRESH 0x4
+#define SIM_INDEX 0x3
+
+static int sim_thread(void *data);
+static void publish(struct sim *s);
+static void drain_commands(struct sim *s);
+static void plan(struct sim *s, struct vec2 tile);
+static int exchange(SDL_atomic_t *a, int v);
+
+void
+sim_init(struct sim *s) {
+    s->world = NULL;
+    s->thread = NULL;
+    s->tick = 0;
+    SDL_AtomicSet(&s->running, 0);
+
+    for (int i = 0; i != SIM_SNAPSHOTS; ++i) {
+        s->snaps[i].tick = 0;
+        s->snaps[i].player = -1;
+        s->snaps[i].units = NULL;
+        stats_init(&s->snaps[i].stats);
+        s->snaps[i].path = NULL;
+    }
+
+    s->back = 0;
+    s->front = 1;
+    SDL_AtomicSet(&s->middle, 2);
+    s->lock = SDL_CreateMutex();
+    s->walks = NULL;
+    s->aim.x = s->aim.y = -1;
+    s->aimed = 0;
+    path_init(&s->planned);
+    s->planned_to.x = s->planned_to.y = -1;
+    s->view.x = s->view.y = s->view.w = s->view.h = 0;
+}
+
+void
+sim_free(struct sim *s) {
+    sim_stop(s);
+
+    for (int i = 0; i != SIM_SNAPSHOTS; ++i) {
+        arrfree(s->snaps[i].units);
+        stats_free(&s->snaps[i].stats);
+        arrfree(s->snaps[i].path);
+    }
+
+    arrfree(s->walks);
+
+    SDL_DestroyMutex(s->lock);
+}
+
+/* publishes the first snapshot synchronously so the renderer has
+ * something to draw right away, then starts the simulation thread
+ */
+int
+sim_start(struct sim *s, struct world *w) {
+    sim_stop(s);
+
+    s->world = w;
+    s->tick = 0;
+
+    publish(s);
+    SDL_AtomicSet(&s->running, 1);
+    s->thread = SDL_CreateThread(sim_thread, "simulation", s);
+    if (!s->thread) {
+        SDL_AtomicSet(&s->running, 0);
+        app_warning("Can't start simulation thread: %s", SDL_GetError());
+        return 1;
+    }
+
+    return 0;
+}
+
+void
+sim_stop(struct sim *s) {
+    if (s->thread) {
+        SDL_AtomicSet(&s->running, 0);
+        SDL_WaitThread(s->thread, NULL);
+        s->thread = NULL;
+    }
+
+    /* dropping commands nobody is going to execute */
+    SDL_LockMutex(s->lock);
+    arrsetlen(s->walks, 0);
+    s->aim.x = s->aim.y = -1;
+    s->aimed = 0;
+    SDL_UnlockMutex(s->lock);
+    path_free(&s->planned);
+    s->planned_to.x = s->planned_to.y = -1;
+}
+
+/* returns the newest snapshot, it stays valid until the next call */
+struct snapshot *
+sim_acquire(struct sim *s) {
+    if (SDL_AtomicGet(&s->middle) & SIM_FRESH)
+        s->front = exchange(&s->middle, s->front) & SIM_INDEX;
+
+    return &s->snaps[s->front];
+}
+
+/* the path to the tile is planned before the next tick, -1, -1 drops it */
+void
+sim_post_player_aim(struct sim *s, struct vec2 tile) {
+    SDL_LockMutex(s->lock);
+    s->aim = tile;
+    s->aimed = 1;
+    SDL_UnlockMutex(s->lock);
+}
+
+/* the player walks the path planned to the tile, it's found if it wasn't */
+void
+sim_post_player_walk(struct sim *s, struct vec2 tile) {
+    SDL_LockMutex(s->lock);
+    arrput(s->walks, tile);
+    SDL_UnlockMutex(s->lock);
+}
+
+/* the visible frame decides which units are simulated at full rate */
+void
+sim_post_view(struct sim *s, struct recti view) {
+    SDL_LockMutex(s->lock);
+    s->view = view;
+    SDL_UnlockMutex(s->lock);
+}
+
+static int
+sim_thread(void *data) {
+    struct sim *s = (struct sim *)data;
+    double delay = 1000. / s->world->fps;
+    double next = SDL_GetTicks64();
+
+    while (SDL_AtomicGet(&s->running)) {
+        drain_commands(s);
+        world_step(s->world);
+        /* consumers of world events (events.h) drain them here */
+        stats_update(s->world);
+        influence_update(s->world);
+        map_stream(s->world);
+        publish(s);
+
+        double now = SDL_GetTicks64();
+        next += delay;
+        if (next > now) {
+            SDL_Delay(next - now);
+        } else {
+            /* we are late, not trying to catch up */
+            next = now;
+        }
+    }
+
+    return 0;
+}
+
+static void
+publish(struct sim *s) {
+    struct world *w = s->world;
+    struct snapshot *snap = &s->snaps[s->back];
+
+    snap->tick = s->tick++;
+    snap->player = handles_get(&w->unit_handles, w->player);
+    arrsetlen(snap->units, arrlen(w->units));
+    memcpy(snap->units, w->units, sizeof(struct unit) * arrlen(w->units));
+    stats_copy(&snap->stats, &w->stats);
+    arrsetlen(snap->path, arrlen(s->planned.steps));
+    if (arrlen(s->planned.steps))
+        memcpy(snap->path, s->planned.steps, sizeof(struct vec2) * arrlen(s->planned.steps));
+
+    s->back = exchange(&s->middle, s->back | SIM_FRESH) & SIM_INDEX;
+}
+
+/* paths are found out of the lock, so the renderer never waits for them */
+static void
+drain_commands(struct sim *s) {
+    struct world *w = s->world;
+    struct vec2 *walks = NULL;
+    struct vec2 aim;
+    int aimed;
+
+    SDL_LockMutex(s->lock);
+    if (arrlen(s->walks)) {
+        arrsetlen(walks, arrlen(s->walks));
+        memcpy(walks, s->walks, sizeof(struct vec2) * arrlen(s->walks));
+        arrsetlen(s->walks, 0);
+    }
+    aim = s->aim;
+    aimed = s->aimed;
+    s->aimed = 0;
+    w->lod.view = s->view;
+    SDL_UnlockMutex(s->lock);
+
+    for (int i = 0, ie = arrlen(walks); i != ie; ++i) {
+        struct ai *player = world_get_player_ai(w);
+        if (!player)
+            break;
+
+        /* a tile there is no path to doesn't stop the player */
+        plan(s, walks[i]);
+        if (!s->planned.steps)
+            continue;
+
+        ai_add_task_from_path(player, s->planned);
+        /* the player walks it now, there is nothing to show until the next aim */
+        path_free(&s->planned);
+        s->planned_to.x = s->planned_to.y = -1;
+    }
+    arrfree(walks);
+
+    if (aimed) {
+        if (aim.x < 0) {
+            path_free(&s->planned);
+            s->planned_to = aim;
+        } else {
+            plan(s, aim);
+        }
+    }
+}
+
+/* plans the player's path to the tile unless it's planned already */
+static void
+plan(struct sim *s, struct vec2 tile) {
+    struct world *w = s->world;
+    struct map *m = &w->map;
+    int p = handles_get(&w->unit_handles, w->player);
+
+    if (s->planned_to.x == tile.x && s->planned_to.y == tile.y && s->planned.steps)
+        return;
+
+    path_free(&s->planned);
+    s->planned_to = tile;
+    if (p >= 0 && tile.x >= 0 && tile.x < m->size.x && tile.y >= 0 && tile.y < m->size.y)
+        s->planned = find_path(w, &w->units[p], tile);
+}
+
+/* SDL_AtomicSet is only an acquire barrier, CAS is a full one */
+static int
+exchange(SDL_atomic_t *a, int v) {
+    int old;
+    do {
+        old = SDL_AtomicGet(a);
+    } while (!SDL_AtomicCAS(a, old, v));
+
+    return old;
+}
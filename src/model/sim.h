@@ -0,0 +1,60 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include "types.h"
+#include "path.h"
+
+/* Simulation thread
+ *
+ * world_step runs on its own thread at world fps. After every tick the
+ * thread publishes an immutable snapshot of the units through a triple
+ * buffer: the simulation owns the back slot, the renderer owns the front
+ * slot and they swap through the middle one atomically, so neither side
+ * ever waits for the other. Terrain doesn't change while simulating, so
+ * it is read directly from the world map under map_lock, see map.h.
+ *
+ * Everything the renderer wants to change in the world goes through the
+ * command queue which is drained by the simulation thread before a tick.
+ * Paths are found there too: the renderer aims at a tile, the simulation
+ * plans the player's path to it and publishes it with the snapshot, a walk
+ * command hands the planned path over to the player.
+ */
+
+#define SIM_SNAPSHOTS 3
+
+struct snapshot {
+    unsigned long tick;
+    int player;             /* index of the player unit, -1 if there is no player */
+    struct unit *units;     /* stb_ds array, copy of world units */
+    struct world_stats stats;   /* copy of world statistics */
+    struct vec2 *path;      /* stb_ds array, copy of the path planned to the aimed tile */
+};
+
+struct sim {
+    struct world *world;
+    SDL_Thread *thread;
+    SDL_atomic_t running;
+    unsigned long tick;     /* ticks simulated, owned by the simulation thread */
+    struct snapshot snaps[SIM_SNAPSHOTS];
+    int back;               /* slot written by the simulation thread */
+    int front;              /* slot read by the renderer */
+    SDL_atomic_t middle;    /* slot being exchanged, SIM_FRESH is set if it's newer than front */
+    SDL_mutex *lock;        /* guards the command queue */
+    struct vec2 *walks;     /* stb_ds array of tiles the player is sent to */
+    struct vec2 aim;        /* tile to plan the player's path to, -1, -1 for none */
+    int aimed;              /* aim has changed since it was planned */
+    struct recti view;      /* visible tiles posted by the renderer */
+    struct path planned;    /* path to the aim, owned by the simulation thread */
+    struct vec2 planned_to;
+};
+
+void sim_init(struct sim *s);
+void sim_free(struct sim *s);
+int sim_start(struct sim *s, struct world *w);
+void sim_stop(struct sim *s);
+struct snapshot *sim_acquire(struct sim *s);
+void sim_post_player_aim(struct sim *s, struct vec2 tile);
+void sim_post_player_walk(struct sim *s, struct vec2 tile);
+void sim_post_view(struct sim *s, struct recti view);
+
+#endif /* _SIM_H_ */
@@ -0,0 +1,241 @@
+#include "stats.h"
+#include "events.h"
+#include "map.h"
+#include "app.h"
+#include "serial.h"
+#include "stb_ds.h"
+#include <string.h>
+
+static void recount(struct world *w, struct world_stats *s);
+static void apply(struct world *w);
+
+void
+stats_init(struct world_stats *s) {
+    memset(s, 0, sizeof(*s));
+    s->chunk_shift = 4;
+}
+
+void
+stats_free(struct world_stats *s) {
+    arrfree(s->occupancy);
+    arrfree(s->chunk_units);
+    arrfree(s->tiles);
+    arrfree(s->tile_types);
+    arrfree(s->order);
+    s->occupancy = NULL;
+    s->chunk_units = NULL;
+    s->tiles = NULL;
+    s->tile_types = NULL;
+    s->order = NULL;
+}
+
+/* reads the 'stats' object of world json, v can be NULL */
+int
+stats_read(struct world_stats *s, struct jq_value *v) {
+    int chunk;
+    struct jq_value *k;
+
+    if (!v)
+        return 0;
+
+    if (!jq_isobject(v)) {
+        app_warning("'stats' should be an object");
+        return 1;
+    }
+
+    k = jq_find(v, "check", 0);
+    s->check = k ? jq_istrue(k) : 0;
+
+    if (read_int(v, "stats", "chunk", 4, 256, 1 << s->chunk_shift, &chunk)) return 1;
+
+    for (s->chunk_shift = 0; (1 << (s->chunk_shift + 1)) <= chunk; ++s->chunk_shift);
+    if (1 << s->chunk_shift != chunk)
+        app_warning("'stats.chunk' should be a power of two, set to %i", 1 << s->chunk_shift);
+
+    return 0;
+}
+
+/* sizes the aggregates for the map and recounts them from scratch */
+void
+stats_reset(struct world *w) {
+    recount(w, &w->stats);
+}
+
+/* applies world events handed over by the last world_step */
+void
+stats_update(struct world *w) {
+    struct world_stats *s = &w->stats;
+
+    apply(w);
+
+    memcpy(s->assets, w->prod.totals, sizeof(s->assets));
+    memcpy(s->resources, w->recources.total, sizeof(s->resources));
+
+    if (s->check)
+        stats_check(w);
+}
+
+/* compares the aggregates with a full recompute, returns number of mismatches */
+int
+stats_check(struct world *w) {
+    struct world_stats *s = &w->stats;
+    struct world_stats full;
+    int bad = 0;
+
+    stats_init(&full);
+    full.chunk_shift = s->chunk_shift;
+    recount(w, &full);
+
+    if (full.population != s->population) {
+        app_warning("stats: population is %i, should be %i", s->population, full.population);
+        ++bad;
+    }
+
+    for (int i = 0, ie = arrlen(full.occupancy); i != ie; ++i) {
+        if (full.occupancy[i] != s->occupancy[i]) {
+            app_warning("stats: %i units on tile type %i, should be %i", s->occupancy[i], i, full.occupancy[i]);
+            ++bad;
+        }
+    }
+
+    for (int i = 0, ie = arrlen(full.chunk_units); i != ie; ++i) {
+        if (full.chunk_units[i] != s->chunk_units[i]) {
+            app_warning("stats: %i units within chunk %i, should be %i", s->chunk_units[i], i, full.chunk_units[i]);
+            ++bad;
+        }
+    }
+
+    for (int a = 0; a != AT_MAX; ++a) {
+        if (full.assets[a] != s->assets[a]) {
+            app_warning("stats: %lli of asset %i, should be %lli", s->assets[a], a, full.assets[a]);
+            ++bad;
+        }
+    }
+
+    for (int t = 0; t != RT_MAX; ++t) {
+        if (full.resources[t] != s->resources[t]) {
+            app_warning("stats: %i tiles of resource %i, should be %i", s->resources[t], t, full.resources[t]);
+            ++bad;
+        }
+    }
+
+    stats_free(&full);
+    ++s->checks;
+    s->mismatches += bad;
+    return bad;
+}
+
+/* copies the aggregates reusing arrays of dst, dst is to be freed with
+ * stats_free; the scratch arrays of dst are its own
+ */
+void
+stats_copy(struct world_stats *dst, struct world_stats *src) {
+    int *occupancy = dst->occupancy;
+    int *chunk_units = dst->chunk_units;
+    struct vec2 *tiles = dst->tiles;
+    int *tile_types = dst->tile_types;
+    struct map_tile_at *order = dst->order;
+
+    arrsetlen(occupancy, arrlen(src->occupancy));
+    arrsetlen(chunk_units, arrlen(src->chunk_units));
+    memcpy(occupancy, src->occupancy, sizeof(int) * arrlen(src->occupancy));
+    memcpy(chunk_units, src->chunk_units, sizeof(int) * arrlen(src->chunk_units));
+
+    *dst = *src;
+    dst->occupancy = occupancy;
+    dst->chunk_units = chunk_units;
+    dst->tiles = tiles;
+    dst->tile_types = tile_types;
+    dst->order = order;
+}
+
+/* returns number of units within the chunk of the tile */
+int
+stats_get_chunk(struct world_stats *s, struct vec2 tile) {
+    return s->chunk_units[ s->chunks.x * (tile.y >> s->chunk_shift) + (tile.x >> s->chunk_shift) ];
+}
+
+/* applies the unit events of all the types, types of their tiles are read
+ * in one batch
+ */
+static void
+apply(struct world *w) {
+    static const enum event_t types[] = { EV_UNIT_SPAWNED, EV_UNIT_ENTERED, EV_UNIT_LEFT, EV_UNIT_DIED };
+    static const int deltas[] = { 1, 1, -1, -1 };
+    struct world_stats *s = &w->stats;
+    struct event *e[4];
+    int n[4], total = 0, k = 0;
+
+    for (int i = 0; i != 4; ++i) {
+        e[i] = events_get(&w->events, types[i], &n[i]);
+        total += n[i];
+    }
+
+    s->population += n[0] - n[3];
+    if (!total)
+        return;
+
+    arrsetlen(s->tiles, total);
+    arrsetlen(s->tile_types, total);
+    struct vec2 *tiles = s->tiles;
+    int *tile_types = s->tile_types;
+    for (int i = 0; i != 4; ++i) {
+        for (int j = 0; j != n[i]; ++j)
+            tiles[k++] = e[i][j].tile;
+    }
+    map_get_types_at(&w->map, tiles, total, tile_types, &s->order);
+
+    k = 0;
+    for (int i = 0; i != 4; ++i) {
+        for (int j = 0; j != n[i]; ++j, ++k) {
+            struct vec2 t = tiles[k];
+            s->occupancy[ tile_types[k] ] += deltas[i];
+            s->chunk_units[ s->chunks.x * (t.y >> s->chunk_shift) + (t.x >> s->chunk_shift) ] += deltas[i];
+        }
+    }
+}
+
+static void
+recount(struct world *w, struct world_stats *s) {
+    struct map *map = &w->map;
+    struct resource_layer *l = &w->recources;
+
+    s->chunks.x = (map->size.x + (1 << s->chunk_shift) - 1) >> s->chunk_shift;
+    s->chunks.y = (map->size.y + (1 << s->chunk_shift) - 1) >> s->chunk_shift;
+    arrsetlen(s->occupancy, arrlen(map->tile_types));
+    arrsetlen(s->chunk_units, s->chunks.x * s->chunks.y);
+    memset(s->occupancy, 0, sizeof(int) * arrlen(s->occupancy));
+    memset(s->chunk_units, 0, sizeof(int) * arrlen(s->chunk_units));
+
+    /* types of the tiles of all the units are read in one batch */
+    s->population = arrlen(w->units);
+    if (s->population) {
+        arrsetlen(s->tiles, s->population);
+        arrsetlen(s->tile_types, s->population);
+        struct vec2 *tiles = s->tiles;
+        int *tile_types = s->tile_types;
+        for (int i = 0; i != s->population; ++i) {
+            tiles[i].x = w->units[i].coords.x >> TILE_SHIFT;
+            tiles[i].y = w->units[i].coords.y >> TILE_SHIFT;
+        }
+        map_get_types_at(map, tiles, s->population, tile_types, &s->order);
+
+        for (int i = 0; i != s->population; ++i) {
+            struct vec2 t = tiles[i];
+            ++s->occupancy[ tile_types[i] ];
+            ++s->chunk_units[ s->chunks.x * (t.y >> s->chunk_shift) + (t.x >> s->chunk_shift) ];
+        }
+    }
+
+    for (int a = 0; a != AT_MAX; ++a) {
+        s->assets[a] = 0;
+        for (int i = 0, ie = arrlen(w->prod.receipt); i != ie; ++i)
+            s->assets[a] += w->prod.stock[a][i];
+    }
+
+    for (int t = 0; t != RT_MAX; ++t) {
+        s->resources[t] = 0;
+        for (int i = 0; l->bits[t] && i != l->words * l->size.y; ++i)
+            s->resources[t] += __builtin_popcountll(l->bits[t][i]);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include "types.h"
+
+/* Aggregate statistics
+ *
+ * Population, units on tiles of every tile type and units within every
+ * chunk of the map are kept up to date from world events (events.h), so
+ * an update costs as much as there were changes, not units. Asset totals
+ * are maintained by production, resource totals by the resource layer,
+ * the update only picks them up.
+ *
+ * In check mode every update is followed by a full recompute of all the
+ * aggregates and mismatches are reported, it's O(units + buildings + map)
+ * and meant for debugging only.
+ *
+ * World json knob, all keys are optional:
+ *     "stats": { "chunk": 16, "check": false }
+ */
+
+struct jq_value;
+
+void stats_init(struct world_stats *s);
+void stats_free(struct world_stats *s);
+int stats_read(struct world_stats *s, struct jq_value *v);
+void stats_reset(struct world *w);
+void stats_update(struct world *w);
+int stats_check(struct world *w);
+void stats_copy(struct world_stats *dst, struct world_stats *src);
+int stats_get_chunk(struct world_stats *s, struct vec2 tile);
+
+#endif /* _STATS_H_ */
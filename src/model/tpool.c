@@ -0,0 +1,148 @@
+#include "tpool.h"
+#include "app.h"
+#include <SDL2/SDL.h>
+
+#define TPOOL_MAX_WORKERS 63
+
+static struct {
+    int workers;
+    SDL_Thread *threads[TPOOL_MAX_WORKERS];
+    SDL_mutex *run;             /* one loop at a time */
+    SDL_mutex *lock;            /* guards the fields below */
+    SDL_cond *wake;
+    SDL_cond *done;
+    unsigned long generation;   /* loops started so far */
+    int busy;                   /* workers still running the loop */
+    int quit;
+    /* the loop */
+    tpool_func func;
+    void *data;
+    int n, grain;
+    SDL_atomic_t next;          /* first item not taken yet */
+} pool;
+
+static int worker(void *unused);
+static void run_ranges(void);
+
+/* starts the workers, 0 means one per cpu core besides the calling thread */
+void
+tpool_init(int workers) {
+    if (pool.workers)
+        return;
+
+    if (workers <= 0)
+        workers = SDL_GetCPUCount() - 1;
+    if (workers > TPOOL_MAX_WORKERS)
+        workers = TPOOL_MAX_WORKERS;
+
+    pool.run = SDL_CreateMutex();
+    pool.lock = SDL_CreateMutex();
+    pool.wake = SDL_CreateCond();
+    pool.done = SDL_CreateCond();
+    pool.generation = 0;
+    pool.quit = 0;
+
+    for (int i = 0; i < workers; ++i) {
+        pool.threads[i] = SDL_CreateThread(worker, "tpool", NULL);
+        if (!pool.threads[i]) {
+            app_warning("Can't start a pool thread: %s", SDL_GetError());
+            break;
+        }
+        ++pool.workers;
+    }
+}
+
+void
+tpool_free(void) {
+    if (!pool.run)
+        return;
+
+    SDL_LockMutex(pool.lock);
+    pool.quit = 1;
+    SDL_CondBroadcast(pool.wake);
+    SDL_UnlockMutex(pool.lock);
+
+    for (int i = 0; i != pool.workers; ++i)
+        SDL_WaitThread(pool.threads[i], NULL);
+
+    SDL_DestroyCond(pool.done);
+    SDL_DestroyCond(pool.wake);
+    SDL_DestroyMutex(pool.lock);
+    SDL_DestroyMutex(pool.run);
+    pool.workers = 0;
+    pool.run = NULL;
+}
+
+/* returns number of threads running loops, the calling one included */
+int
+tpool_threads(void) {
+    return pool.workers + 1;
+}
+
+void
+tpool_for(int n, int grain, tpool_func func, void *data) {
+    if (grain < 1)
+        grain = 1;
+
+    if (!pool.workers || n <= grain) {
+        if (n > 0)
+            func(data, 0, n);
+        return;
+    }
+
+    SDL_LockMutex(pool.run);
+
+    SDL_LockMutex(pool.lock);
+    pool.func = func;
+    pool.data = data;
+    pool.n = n;
+    pool.grain = grain;
+    SDL_AtomicSet(&pool.next, 0);
+    pool.busy = pool.workers;
+    ++pool.generation;
+    SDL_CondBroadcast(pool.wake);
+    SDL_UnlockMutex(pool.lock);
+
+    run_ranges();
+
+    SDL_LockMutex(pool.lock);
+    while (pool.busy)
+        SDL_CondWait(pool.done, pool.lock);
+    SDL_UnlockMutex(pool.lock);
+
+    SDL_UnlockMutex(pool.run);
+}
+
+static int
+worker(void *unused) {
+    unsigned long seen = 0;
+
+    for (;;) {
+        SDL_LockMutex(pool.lock);
+        while (pool.generation == seen && !pool.quit)
+            SDL_CondWait(pool.wake, pool.lock);
+        if (pool.quit) {
+            SDL_UnlockMutex(pool.lock);
+            return 0;
+        }
+        seen = pool.generation;
+        SDL_UnlockMutex(pool.lock);
+
+        run_ranges();
+
+        SDL_LockMutex(pool.lock);
+        if (!--pool.busy)
+            SDL_CondSignal(pool.done);
+        SDL_UnlockMutex(pool.lock);
+    }
+}
+
+static void
+run_ranges(void) {
+    int begin;
+
+    while ((begin = SDL_AtomicAdd(&pool.next, pool.grain)) < pool.n) {
+        int end = begin + pool.grain < pool.n ? begin + pool.grain : pool.n;
+        pool.func(pool.data, begin, end);
+    }
+}
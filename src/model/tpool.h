@@ -0,0 +1,23 @@
+#ifndef _TPOOL_H_
+#define _TPOOL_H_
+
+/* Thread pool
+ *
+ * One pool of worker threads for data parallel loops. tpool_for splits
+ * [0, n) into ranges of grain items, the workers and the calling thread
+ * pull ranges until there are none left, then tpool_for returns. The
+ * function is to be pure with respect to the other ranges, so the result
+ * doesn't depend on the number of threads.
+ *
+ * Loops of different threads are run one by one, a loop is not to call
+ * tpool_for. Without tpool_init, or with 0 workers, loops run serially.
+ */
+
+typedef void (*tpool_func)(void *data, int begin, int end);
+
+void tpool_init(int workers);
+void tpool_free(void);
+int tpool_threads(void);
+void tpool_for(int n, int grain, tpool_func func, void *data);
+
+#endif /* _TPOOL_H_ */
@@ -2,16 +2,29 @@
 #define _TYPES_H_
 
 #include "rand.h"
+#include "pool.h"
+#include "handle.h"
 #ifndef NK_SDL_RENDERER_H_
   #include "nuklear_sdl_renderer.h"
 #endif
 #include <stdint.h>
 #include <limits.h>
 
-#define ID_NOTHING INT_MAX
+/* tile size in pixels of unit coords */
+#define TILE_SHIFT  6
+#define TILE_SIZE   (1 << TILE_SHIFT)
 
 struct jq_value;
 struct world;
+struct ai;
+
+/* coroutine behaviors, see co.h */
+enum co_status {
+    CO_DONE = 0,
+    CO_RUNNING
+};
+
+typedef enum co_status (*co_func)(struct ai *ai);
 
 /*
  * enums 
@@ -19,25 +32,34 @@ struct world;
 
 enum resource_t {
     RT_UNKNOWN = 0,
-    RT_WOOD
+    RT_WOOD,
+    RT_MAX
 };
 
 enum building_t {
     BT_UNKNOWN = 0,
     BT_HOUSE,
-    BT_WINDMILL
+    BT_WINDMILL,
+    BT_BAKERY,
+    BT_SAWMILL,
+    BT_MAX
 };
 
 enum asset_t {
     AT_UNKNOWN = 0,
     AT_WHEAT,
-    AT_BREAD
+    AT_BREAD,
+    AT_FLOUR,
+    AT_WOOD,
+    AT_MAX
 };
 
 enum tool_t {
     TLT_UNKNOWN = 0,
     TLT_SWORD,
-    TLT_AXE
+    TLT_AXE,
+    TLT_OVEN,
+    TLT_MAX
 };
 
 /*
@@ -76,6 +98,18 @@ struct characteristics {
 struct resource {
    enum resource_t type;
    struct vec2 coords;
+   int amount;
+};
+
+/* resources of the map, see res.h */
+struct resource_layer {
+    struct vec2 size;           /* map size in tiles */
+    int words;                  /* bitmap words per row */
+    struct vec2 chunks;         /* map size in chunks */
+    uint64_t *bits[RT_MAX];     /* occupancy bitmap of every type, row by row */
+    int *count[RT_MAX];         /* resource tiles of every type per chunk */
+    long total[RT_MAX];         /* resource tiles of every type */
+    uint16_t *amount;           /* amount per tile, a tile holds one resource at most */
 };
 
 struct tile_t {
@@ -83,19 +117,87 @@ struct tile_t {
     char *name;         /* not strduped */
     char *description;  /* not strduped */
     float gen_part;
+    enum resource_t resource;   /* resource generated on tiles of the type */
+    float resource_part;        /* probability of the resource per tile */
+    int resource_amount;
 };
 
+/* tile types are kept in a byte, the generator may give out one more */
+#define TILE_TYPES_MAX  255
+
+/* tileset and transit indexes are looked up by type and quad, see map.h,
+ * units on the tiles are kept apart in struct map
+ */
 struct tile {
-    int type;
-    int tileset_index;
-    int transit_index;
-    int units[1];
+    uint8_t type;
+    uint8_t quad;       /* neighbors of greater types, neighbor_* bits of tileset.h */
+};
+
+/* chunked map, see map.h */
+#define MAP_CHUNK_SHIFT 6
+#define MAP_CHUNK       (1 << MAP_CHUNK_SHIFT)      /* chunk side in tiles */
+#define MAP_CHUNK_TILES (MAP_CHUNK * MAP_CHUNK)
+
+enum map_chunk_flags {
+    MC_SWAPPED  = 0x1,          /* the chunk has a copy in the swap file */
+    MC_BORROWED = 0x2,          /* the chunk is in the arena of a fork */
+    MC_FAILED   = 0x4           /* the chunk couldn't be made resident, the fallback is used */
+};
+
+/* order of the tiles within a chunk */
+enum map_layout {
+    ML_ROWS = 0,                /* row by row */
+    ML_BLOCKS,                  /* rows of 8 x 8 blocks, a block is 2 cache lines */
+    ML_MORTON                   /* z-order */
+};
+
+struct map_chunk {
+    unsigned long used;                     /* map clock of the last access */
+    struct tile tiles[MAP_CHUNK_TILES];     /* in the layout of the map */
+};
+
+/* tile with a unit */
+struct map_unit {
+    int key;                    /* y * size.x + x */
+    handle value;
+};
+
+/* tile asked of map_get_types_at, they are sorted by row */
+struct map_tile_at {
+    int y, x;
+    int index;                  /* of the tile asked */
+};
+
+/* seeded generator the chunks are made by, see gen.h */
+struct map_gen {
+    struct perlin2d perlin;
+    float *parts;               /* stb_ds array, running sums of gen_part of the tile types */
+    int *transit;               /* transit indexes by type * 16 + quad, NULL without tileset 'landset' */
 };
 
 struct map {
-    struct vec2 size;
+    struct vec2 size;               /* in tiles */
     struct tile_t *tile_types;
-    struct tile *tiles;
+    struct vec2 chunks;             /* size in chunks */
+    int layout;                     /* enum map_layout */
+    uint16_t offset_x[MAP_CHUNK];   /* tile x, y is at offset_x[x] + offset_y[y] of its chunk */
+    uint16_t offset_y[MAP_CHUNK];
+    struct map_chunk **chunk;       /* directory row by row, NULL if the chunk is not in memory */
+    unsigned char *flags;           /* enum map_chunk_flags per chunk */
+    int resident;                   /* chunks in memory */
+    int budget;                     /* chunks kept in memory by map_stream */
+    int radius;                     /* chunks around the view and the player which are kept */
+    unsigned long clock;            /* ticks streamed */
+    int fork;                       /* the map of a fork, nothing is evicted */
+    char *swap_path;
+    SDL_RWops *swap;                /* opened on the first eviction */
+    SDL_mutex *lock;                /* guards the directory and the swap file */
+    struct map_unit *units;         /* stb_ds hash map, HANDLE_NONE by default */
+    const struct tile *cached;      /* tiles of every chunk from the world cache, NULL if none, see cache.h */
+    void *cache_base;               /* mapping of the cache file */
+    size_t cache_size;
+    struct map_gen gen;
+    struct map_chunk fallback;      /* generated tiles of a chunk which couldn't be made resident */
 };
 
 /*
@@ -110,6 +212,10 @@ enum unit_flags {
 struct unit_t {
     int id;
     char *name;         /* not strduped */
+    int speed;          /* pixels per tick */
+    int behavior;       /* behavior tree index, -1 for the default human ai */
+    co_func routine;    /* coroutine behavior, NULL if none */
+    int faction;
     float *probs;
     float *pass;
 };
@@ -125,6 +231,102 @@ struct unit {
     struct vec2 coords;
     struct innate innate;
     struct characteristics characteristics;
+    int speed;              /* pixels per tick */
+};
+
+/*
+ * movement
+ */
+
+struct move_batch {
+    int *unit;          /* unit indices within world units array */
+    int *x, *y;         /* coords in pixels, updated by the kernel */
+    int *tx, *ty;       /* targets in pixels */
+    int *speed;         /* pixels per tick */
+    int *changed;       /* batch indices of units which tile is changed */
+};
+
+/*
+ * events
+ */
+
+enum event_t {
+    EV_TILE_CHANGED = 0,    /* type or resource of the tile is changed, unit is HANDLE_NONE */
+    EV_UNIT_ENTERED,        /* unit came to the tile */
+    EV_UNIT_LEFT,           /* unit left the tile */
+    EV_UNIT_SPAWNED,        /* unit appeared at the tile */
+    EV_UNIT_DIED,           /* unit is removed, tile is where it was, the handle is already stale */
+    EV_MAX
+};
+
+struct event {
+    handle unit;
+    int unit_type;          /* type of the unit, -1 for tile events */
+    struct vec2 tile;
+};
+
+struct world_events {
+    struct event *queued[EV_MAX];   /* stb_ds arrays, pushed since the last flush */
+    struct event *ready[EV_MAX];    /* stb_ds arrays, handed over by the last world_step */
+};
+
+/*
+ * statistics, see stats.h
+ */
+
+struct world_stats {
+    int chunk_shift;            /* chunk is 1 << chunk_shift tiles */
+    int check;                  /* compare with a full recompute on every update */
+    struct vec2 chunks;         /* map size in chunks */
+    int population;
+    int *occupancy;             /* stb_ds array, units on tiles of every tile type */
+    int *chunk_units;           /* stb_ds array, units within every chunk, row by row */
+    long long assets[AT_MAX];   /* stock of every asset type over all the buildings */
+    int resources[RT_MAX];      /* tiles with every resource type */
+    unsigned long checks;       /* full recomputes done */
+    unsigned long mismatches;   /* aggregates found wrong by them */
+    /* scratch kept between the updates, stb_ds arrays */
+    struct vec2 *tiles;         /* tiles of the units counted */
+    int *tile_types;            /* types of the tiles */
+    struct map_tile_at *order;  /* for map_get_types_at */
+};
+
+/*
+ * influence, see influence.h
+ */
+
+#define INF_CHUNK_SHIFT 4
+#define INF_CHUNK       (1 << INF_CHUNK_SHIFT)
+#define INF_CHUNK_TILES (INF_CHUNK * INF_CHUNK)
+#define INF_FACTIONS    8
+#define INF_NONE        0xff    /* owner of a tile nobody has influence on */
+
+struct inf_source {
+    struct vec2 tile;
+    int faction;
+    int strength;
+};
+
+struct influence {
+    int enabled;
+    int factions;
+    int period;                 /* ticks between refreshes */
+    int unit;                   /* strength of a unit */
+    int building;               /* strength of a building */
+    int decay;                  /* influence lost per tile of passability 1.0 */
+    int pass_type;              /* unit type which passability is used */
+    int reach;                  /* tiles influence can spread to */
+    struct vec2 size;           /* map size */
+    struct vec2 chunks;         /* map size in chunks */
+    int *cost;                  /* stb_ds array, cost of a step to every tile type, 0 if impassable */
+    struct inf_source **sources;    /* stb_ds arrays, sources within every chunk */
+    unsigned char *dirty;       /* per chunk, 1 if it's to be recomputed */
+    int *dirty_list;            /* stb_ds array, dirty chunks */
+    unsigned char *values;      /* per chunk, per faction INF_CHUNK_TILES values, row by row */
+    unsigned char *owner;       /* per chunk INF_CHUNK_TILES factions with most influence, INF_NONE if none */
+    unsigned char *window;      /* scratch values of the window around a chunk */
+    int *costs;                 /* scratch step costs of the tiles of the window */
+    int *buckets[256];          /* stb_ds arrays, scratch bucket queue by value */
 };
 
 /*
@@ -150,26 +352,71 @@ struct stay {
     int cnt;
 };
 
+struct work {
+    int job;                /* job index within world job board */
+    int cnt;                /* ticks left */
+};
+
 struct action {
     enum action_t type;
     union {
         struct stay stay;
         struct walk walk;
+        struct work work;
     } act;
 };
 
 struct task {
     int i;                  /* iterator */
-    struct action *actions; /* actions array */
+    int n;                  /* number of actions */
+    struct action *actions; /* actions block acquired from world action pool */
+};
+
+
+/* locals of the lumberjack routine */
+struct chop {
+    struct vec2 wood;       /* tile being chopped */
+    handle building;        /* building the wood is carried to */
+    int carry;
 };
 
+/* state of a coroutine behavior */
+struct coroutine {
+    co_func func;
+    unsigned short line;    /* where to resume, 0 to start over */
+    struct action a;        /* the current action */
+    union {
+        struct chop chop;
+    } v;                    /* locals living across yields */
+};
 
 struct ai {
     step step;
     struct world *world;
     void *data;
-    struct unit *unit;
-    struct task task;
+    struct task task;       /* the unit of the ai has the same index, see ai_unit */
+    int quantum;            /* ticks covered by one step, more than 1 for units far from the view */
+    int job;                /* job of the current task, JOB_NONE or JOB_WAITING, see jobs.h */
+    int tree;               /* behavior tree index, -1 if none */
+    int slots;              /* offset of the node slots within world behaviors */
+    struct coroutine co;
+};
+
+/*
+ * behavior trees, see bt.h
+ */
+
+struct bt {
+    char *name;             /* not strduped */
+    int root;               /* offset of the root node within the code */
+    int slots;              /* slots per ai */
+    int *free;              /* stb_ds array, offsets of slots released by removed ais */
+};
+
+struct behaviors {
+    int *code;              /* stb_ds array, compiled nodes of all the trees */
+    struct bt *trees;       /* stb_ds array */
+    int *slots;             /* stb_ds array, slots of all the ais running trees */
 };
 
 /*
@@ -180,6 +427,7 @@ struct building {
     enum building_t type;
     struct characteristics characteristics;
     struct vec2 coords;
+    int faction;
 };
 
 /*
@@ -205,9 +453,71 @@ struct tool {
  */
 
 struct receipt {
-   enum building_t target;
-   struct tool *tools;
-   struct asset *assets;
+    char *name;                 /* not strduped */
+    enum building_t building;   /* building type which runs the receipt */
+    int time;                   /* ticks per cycle */
+    int inputs[AT_MAX];         /* assets consumed per cycle */
+    int outputs[AT_MAX];        /* assets produced per cycle */
+    int tools[TLT_MAX];         /* tools required, they are not consumed */
+};
+
+/*
+ * production, see prod.h
+ */
+
+struct production {
+    struct receipt *receipts;   /* stb_ds array */
+    /* receipt columns, index 0 is an empty receipt for idle buildings */
+    int *time;
+    int *in[AT_MAX];
+    int *out[AT_MAX];
+    int *need[TLT_MAX];
+    /* per building SoA */
+    int *receipt;               /* receipt index + 1, 0 if the building produces nothing */
+    int *progress;              /* ticks left of the current cycle, 0 if ready to start one, PROD_BLOCKED if lacking inputs */
+    int *stock[AT_MAX];         /* stock of every asset type */
+    int *pending[AT_MAX];       /* assets on the way by supply jobs, see jobs.h */
+    int *tools[TLT_MAX];        /* number of every tool type */
+    int *blocked;               /* stb_ds array, buildings blocked by the last step */
+    /* aggregates */
+    long long totals[AT_MAX];   /* stock of every asset type over all the buildings */
+    unsigned long cycles;       /* finished cycles */
+};
+
+/*
+ * jobs, see jobs.h
+ */
+
+enum job_t {
+    J_NONE = 0,             /* free slot */
+    J_SUPPLY                /* bringing assets to a building */
+};
+
+struct job {
+    enum job_t type;
+    handle building;        /* building supplied, HANDLE_NONE if none */
+    enum asset_t asset;
+    int amount;
+    int time;               /* ticks of work at the place */
+    struct vec2 coords;     /* tile where the work is done */
+    handle unit;            /* assigned unit, HANDLE_NONE if the job is open */
+    int slot;               /* index within its grid cell while open, next free job while free */
+};
+
+struct job_board {
+    struct job *jobs;       /* stb_ds array */
+    int free;               /* first free job, -1 if none */
+    int open;               /* number of open jobs */
+    int cell_shift;         /* grid cell side is 1 << cell_shift tiles */
+    int radius;             /* search radius in cells */
+    int budget;             /* max units matched per tick */
+    int work;               /* ticks of work of supply jobs */
+    struct vec2 size;       /* grid size in cells */
+    int **cells;            /* stb_ds arrays of open jobs per cell, row by row */
+    handle *idle;           /* stb_ds array, queue of units waiting for a job */
+    int idle_head;
+    unsigned long assigned; /* totals */
+    unsigned long done;
 };
 
 /*
@@ -229,21 +539,55 @@ struct tileset_hash {
     struct tileset value;
 };
 
+/* level of detail of the simulation, see lod.h */
+struct lod {
+    int enabled;
+    int chunk_shift;        /* chunk side is 1 << chunk_shift tiles */
+    int radius;             /* distance in chunks around the view and the player simulated at full rate */
+    int period;             /* units of level l are stepped every period^l ticks */
+    int levels;
+    int *periods;           /* stb_ds array, period^l for every level */
+    struct vec2 size;       /* map size in chunks */
+    unsigned char *level;   /* level per chunk, row by row */
+    struct recti view;      /* visible tiles */
+};
+
 struct world {
     struct jq_value *json;
+    char *cache;            /* directory of the generated world cache, NULL if disabled, see cache.h */
+    int cache_limit;        /* MB the cache files are kept within */
     struct mt_state *mt;
+    int rand;               /* enum rand_t, generator the world is generated and stepped with */
     float fps;
+    unsigned long tick;
+    struct lod lod;
     struct tileset_hash *tilesets;
-    struct ai *player_ai;
+    handle player;          /* unit of the player */
     struct map map;
-    struct resource *recources;
+    struct resource_layer recources;
     struct unit_t *unit_types;
+    /* dense arrays, entities are referred to by handles, see handle.h;
+     * ais are parallel to units, production columns to buildings
+     */
     struct unit *units;
     struct ai *ais;
     struct building *buildings;
     struct asset *assets;
     struct tool *tools;
-    struct receipt *receipts;
+    struct handles unit_handles;
+    struct handles building_handles;
+    struct handles asset_handles;
+    struct handles tool_handles;
+    handle *despawned;      /* stb_ds array, units removed at the end of the tick */
+    struct world_events events;
+    struct world_stats stats;
+    struct influence influence;
+    void *arena;            /* one block of fixed size data of a fork, NULL if the world is not a fork */
+    struct production prod;
+    struct job_board jobs;
+    struct behaviors bt;
+    struct action_pool pool;
+    struct move_batch moves;
 };
 
 #endif /* _TYPES_H_ */
@@ -1,10 +1,39 @@
 #include "world.h"
 #include "app.h"
 #include "serial.h"
+#include "move.h"
+#include "prof.h"
+#include "lod.h"
+#include "prod.h"
+#include "jobs.h"
+#include "res.h"
+#include "bt.h"
+#include "co.h"
+#include "ai.h"
+#include "events.h"
+#include "stats.h"
+#include "influence.h"
+#include "map.h"
+#include "cache.h"
 #include "tileset.h"
+#include "pool.h"
 #include "stb_ds.h"
+#include <malloc.h>
+#include <string.h>
+
+#define ARENA_ALIGN 64
+
+struct arena {
+    char *base;             /* NULL while only the size is counted */
+    size_t used;
+};
 
 static int get_vec2(struct jq_value *v, struct vec2 *out);
+static void remove_unit(struct world *w, handle unit);
+static void *arena_copy(struct arena *a, const void *src, size_t n);
+static void *dup_array(void *a, size_t elem);
+static void fork_bulk(struct world *f, struct world *w, struct arena *a);
+static void fork_free(struct world *w);
 
 int world_init(struct world *w, const char *fname, struct mt_state *mt) {
     char buf[4096];
@@ -12,9 +41,33 @@ int world_init(struct world *w, const char *fname, struct mt_state *mt) {
     struct jq_value *v;
 
     w->mt = mt;
+    w->cache = NULL;
+    w->cache_limit = 0;
+    w->arena = NULL;
 
     w->units = NULL;
-    w->player_ai = NULL;
+    w->player = HANDLE_NONE;
+    w->ais = NULL;
+    w->tick = 0;
+    w->buildings = NULL;
+    w->assets = NULL;
+    w->tools = NULL;
+    w->despawned = NULL;
+    handles_init(&w->unit_handles);
+    handles_init(&w->building_handles);
+    handles_init(&w->asset_handles);
+    handles_init(&w->tool_handles);
+    events_init(&w->events);
+    stats_init(&w->stats);
+    influence_init(&w->influence);
+    map_init(&w->map);
+    lod_init(&w->lod);
+    prod_init(&w->prod);
+    jobs_init(&w->jobs);
+    res_init(&w->recources);
+    bt_init(&w->bt);
+    pool_init(&w->pool);
+    move_init(&w->moves);
 
     /* Reading world json file */
     w->json = read_json(fname);
@@ -36,6 +89,40 @@ int world_init(struct world *w, const char *fname, struct mt_state *mt) {
         w->fps = 60.;
     }
 
+    /* init random number generator */
+    w->rand = RAND_MT;
+    val = jq_find(w->json, "random", 0);
+    if (val) {
+        if (jq_isstring(val) && !strcmp(val->value.string, "mt")) {
+            w->rand = RAND_MT;
+        } else if (jq_isstring(val) && !strcmp(val->value.string, "xoshiro")) {
+            w->rand = RAND_XOSHIRO;
+        } else {
+            app_warning("'random' should be one of 'mt' or 'xoshiro'");
+            return 1;
+        }
+    }
+
+    /* init generated world cache */
+    if (cache_read(w, jq_find(w->json, "cache", 0)))
+        return 1;
+
+    /* init map streaming */
+    if (map_read(&w->map, jq_find(w->json, "map", 0), w->cache))
+        return 1;
+
+    /* init level of detail */
+    if (lod_read(&w->lod, jq_find(w->json, "lod", 0)))
+        return 1;
+
+    /* init statistics */
+    if (stats_read(&w->stats, jq_find(w->json, "stats", 0)))
+        return 1;
+
+    /* init job board */
+    if (jobs_read(&w->jobs, jq_find(w->json, "jobs", 0)))
+        return 1;
+
     /* Reading tilesets */
     w->tilesets = NULL;
     val = jq_find(w->json, "tilesets", 0);
@@ -173,6 +260,14 @@ int world_init(struct world *w, const char *fname, struct mt_state *mt) {
                     return 1;
                 }
 
+                if (res_read_tile(&t, jq_find(v, "resource", 0)))
+                    return 1;
+
+                if (arrlen(w->map.tile_types) == TILE_TYPES_MAX) {
+                    app_warning("There should be %i tile types at most", TILE_TYPES_MAX);
+                    return 1;
+                }
+
                 arrput(w->map.tile_types, t);
             } else {
                 app_warning("'tile' is not an object");
@@ -184,6 +279,10 @@ int world_init(struct world *w, const char *fname, struct mt_state *mt) {
         return 1;
     }
 
+    /* Reading behavior trees, units refer to them */
+    if (bt_read(&w->bt, jq_find(w->json, "behaviors", 0)))
+        return 1;
+
     /* Reading unit types */
     w->unit_types = NULL;
     val = jq_find(w->json, "units", 0);
@@ -216,6 +315,47 @@ int world_init(struct world *w, const char *fname, struct mt_state *mt) {
                     return 1;
                 }
 
+                p = jq_find(v, "speed", 0);
+                if (p && jq_isinteger(p)) {
+                    t.speed = trim(1, TILE_SIZE, p->value.integer);
+                } else {
+                    /* setting default speed */
+                    t.speed = 1;
+                }
+
+                p = jq_find(v, "behavior", 0);
+                if (p && jq_isstring(p)) {
+                    t.behavior = bt_find(&w->bt, p->value.string);
+                    if (t.behavior < 0) {
+                        app_warning("No behavior found with name '%s'", p->value.string);
+                        return 1;
+                    }
+                } else {
+                    /* the default human ai */
+                    t.behavior = -1;
+                }
+
+                p = jq_find(v, "routine", 0);
+                if (p && jq_isstring(p)) {
+                    t.routine = co_find(p->value.string);
+                    if (!t.routine) {
+                        app_warning("No routine found with name '%s'", p->value.string);
+                        return 1;
+                    }
+                } else {
+                    t.routine = NULL;
+                }
+
+                p = jq_find(v, "faction", 0);
+                if (p && jq_isinteger(p) && p->value.integer >= 0) {
+                    t.faction = p->value.integer;
+                } else if (p) {
+                    app_warning("'faction' of unit should be a non-negative integer");
+                    return 1;
+                } else {
+                    t.faction = 0;
+                }
+
                 p = jq_find(v, "probs", 0);
                 if (p && jq_isobject(p)) {
                     struct jq_pair *a;
@@ -281,19 +421,227 @@ int world_init(struct world *w, const char *fname, struct mt_state *mt) {
         return 1;
     }
 
+    /* init influence maps, they refer to unit types */
+    if (influence_read(&w->influence, jq_find(w->json, "influence", 0), w->unit_types))
+        return 1;
+
+    /* Reading receipts */
+    if (prod_read(&w->prod, jq_find(w->json, "receipts", 0)))
+        return 1;
+
     return 0;
 }
 
 void world_free(struct world *w) {
+    if (w->arena) {
+        fork_free(w);
+        return;
+    }
 
+    pool_free(&w->pool);
+    move_free(&w->moves);
+    lod_free(&w->lod);
+    prod_free(&w->prod);
+    jobs_free(&w->jobs);
+    res_free(&w->recources);
+    bt_free(&w->bt);
+    arrfree(w->buildings);
+    arrfree(w->assets);
+    arrfree(w->tools);
+    arrfree(w->despawned);
+    handles_free(&w->unit_handles);
+    handles_free(&w->building_handles);
+    handles_free(&w->asset_handles);
+    handles_free(&w->tool_handles);
+    events_free(&w->events);
+    stats_free(&w->stats);
+    influence_free(&w->influence);
+    map_free(&w->map);
+    free(w->cache);
+    w->cache = NULL;
 }
 
 void world_step(struct world *w) {
+    prof_begin(PROF_WORLD_STEP);
+
+    lod_update(w);
+
+    prof_begin(PROF_JOBS);
+    jobs_step(w);
+    prof_end(PROF_JOBS);
+
+    prof_begin(PROF_AI);
+    int steps = 0;
     for (int i = 0, ie = arrlenu(w->ais); i != ie; ++i) {
-        w->ais[i].step(&w->ais[i]);
+        struct ai *ai = &w->ais[i];
+        int period = w->lod.periods[ lod_get_level(&w->lod, w->units[i].coords) ];
+
+        /* far units are stepped less often, staggered by index */
+        if ((w->tick + i) % period)
+            continue;
+
+        ai->quantum = period;
+        ai->step(ai);
+        ++steps;
+    }
+    prof_end(PROF_AI);
+    prof_count(PROF_AI_STEPS, steps);
+
+    prof_begin(PROF_MOVE);
+    move_step(w);
+    prof_end(PROF_MOVE);
+
+    prof_begin(PROF_PROD);
+    prod_step(&w->prod);
+    jobs_post_supplies(w);
+    prof_end(PROF_PROD);
+
+    /* nothing refers to dense indices of units anymore within the tick */
+    for (int i = 0, ie = arrlen(w->despawned); i != ie; ++i)
+        remove_unit(w, w->despawned[i]);
+    arrsetlen(w->despawned, 0);
+
+    events_flush(&w->events);
+    ++w->tick;
+
+    prof_end(PROF_WORLD_STEP);
+    prof_count(PROF_TICKS, 1);
+}
+
+/* sets up the ai of the unit at index i by the unit type */
+void world_init_ai(struct world *w, int i) {
+    struct unit_t *t = &w->unit_types[ w->units[i].type ];
+
+    w->ais[i].world = w;
+    if (w->units[i].flags == UF_PLAYER) {
+        ai_player_init(&w->ais[i]);
+        w->player = handles_at(&w->unit_handles, i);
+    } else if (t->routine) {
+        ai_co_init(&w->ais[i], t->routine);
+    } else if (t->behavior >= 0) {
+        ai_bt_init(&w->ais[i], t->behavior);
+    } else {
+        ai_human_init(&w->ais[i]);
     }
 }
 
+/* adds a unit with its ai, returns its handle;
+ * units and ais may move in memory, so not to be called from within ai steps
+ */
+handle world_spawn_unit(struct world *w, struct unit *u) {
+    handle h = handles_add(&w->unit_handles);
+    int i = arrlen(w->units);
+
+    if (h == HANDLE_NONE)
+        return HANDLE_NONE;
+
+    arrput(w->units, *u);
+    arrsetlen(w->ais, i + 1);
+    world_init_ai(w, i);
+    struct vec2 tile = { u->coords.x >> TILE_SHIFT, u->coords.y >> TILE_SHIFT };
+    map_set_unit(&w->map, tile.x, tile.y, h);
+    events_push(&w->events, EV_UNIT_SPAWNED, h, u->type, tile);
+
+    return h;
+}
+
+/* removes the unit at the end of the tick, it's safe to call from anywhere */
+void world_despawn_unit(struct world *w, handle unit) {
+    arrput(w->despawned, unit);
+}
+
+struct ai *world_get_player_ai(struct world *w) {
+    int i = handles_get(&w->unit_handles, w->player);
+    return i < 0 ? NULL : &w->ais[i];
+}
+
+/* adds a building running the first receipt of its type, returns its handle,
+ * production state of the building has the same dense index
+ */
+handle world_add_building(struct world *w, enum building_t type, struct vec2 coords, int faction) {
+    struct building b = { type, { 0, 0 }, coords, faction };
+    handle h = handles_add(&w->building_handles);
+
+    if (h == HANDLE_NONE)
+        return HANDLE_NONE;
+
+    arrput(w->buildings, b);
+    prod_add(&w->prod, prod_find_receipt(&w->prod, type));
+    influence_add_source(&w->influence, coords, faction, w->influence.building);
+    return h;
+}
+
+int world_remove_building(struct world *w, handle building) {
+    int i = handles_remove(&w->building_handles, building);
+    if (i < 0)
+        return 1;
+
+    influence_remove_source(&w->influence, w->buildings[i].coords, w->buildings[i].faction, w->influence.building);
+    jobs_remove_building(&w->jobs, building);
+    arrdelswap(w->buildings, i);
+    prod_remove(&w->prod, i);
+    return 0;
+}
+
+handle world_add_asset(struct world *w, struct asset *a) {
+    handle h = handles_add(&w->asset_handles);
+    if (h != HANDLE_NONE)
+        arrput(w->assets, *a);
+    return h;
+}
+
+int world_remove_asset(struct world *w, handle asset) {
+    int i = handles_remove(&w->asset_handles, asset);
+    if (i < 0)
+        return 1;
+
+    arrdelswap(w->assets, i);
+    return 0;
+}
+
+handle world_add_tool(struct world *w, struct tool *t) {
+    handle h = handles_add(&w->tool_handles);
+    if (h != HANDLE_NONE)
+        arrput(w->tools, *t);
+    return h;
+}
+
+int world_remove_tool(struct world *w, handle tool) {
+    int i = handles_remove(&w->tool_handles, tool);
+    if (i < 0)
+        return 1;
+
+    arrdelswap(w->tools, i);
+    return 0;
+}
+
+/* removes the unit and its ai, the last unit takes their index */
+static void
+remove_unit(struct world *w, handle unit) {
+    int i = handles_get(&w->unit_handles, unit);
+    if (i < 0)
+        return;
+
+    struct ai *ai = &w->ais[i];
+    struct unit *u = &w->units[i];
+    struct vec2 at = { u->coords.x >> TILE_SHIFT, u->coords.y >> TILE_SHIFT };
+
+    task_free(w, &ai->task);
+    if (ai->job >= 0)
+        jobs_reopen(w, ai->job);
+    if (ai->tree >= 0)
+        bt_detach(&w->bt, ai->tree, ai->slots);
+    if (map_get_unit(&w->map, at.x, at.y) == unit)
+        map_set_unit(&w->map, at.x, at.y, HANDLE_NONE);
+    if (w->player == unit)
+        w->player = HANDLE_NONE;
+
+    events_push(&w->events, EV_UNIT_DIED, unit, u->type, at);
+    handles_remove(&w->unit_handles, unit);
+    arrdelswap(w->units, i);
+    arrdelswap(w->ais, i);
+}
+
 static int
 get_vec2(struct jq_value *v, struct vec2 *out) {
     struct vec2 rv;
@@ -340,3 +688,245 @@ get_vec2(struct jq_value *v, struct vec2 *out) {
     return 0;
 }
 
+
+/* Forks
+ *
+ * A fork shares everything read only with its world: json, tile and unit
+ * types, receipts, tilesets, compiled behavior trees, the map generator and
+ * swap file. Map sized data which never changes its size (resident map
+ * chunks, resource layer, level of detail, influence maps, grid tables of
+ * the job board) is copied into one arena block, the rest of the state is
+ * copied into heap stb_ds arrays, so the fork can grow them as the world
+ * does. Actions of tasks are copied into a pool of the fork. The fork never
+ * evicts chunks, the ones it generates are its own. Stepping the fork never
+ * touches the world, world_free of the fork releases all of it at once.
+ *
+ * The world is not to be stepped while it's forked, so forks are made by
+ * the simulation thread or while the simulation is stopped. If the fork
+ * can't be made f is zeroed, it shares nothing with the world then.
+ */
+
+int world_fork(struct world *f, struct world *w) {
+    struct arena a = { NULL, 0 };
+
+    *f = *w;
+
+    /* counting the arena size, then copying; the renderer may bring
+     * chunks in meanwhile, so the map is locked for both
+     */
+    map_lock(&w->map);
+    fork_bulk(f, w, &a);
+    a.base = malloc(a.used ? a.used : 1);
+    if (!a.base) {
+        map_unlock(&w->map);
+        app_warning("Can't allocate %zu bytes for a fork", a.used);
+        memset(f, 0, sizeof(*f));
+        return 1;
+    }
+    a.used = 0;
+    fork_bulk(f, w, &a);
+    f->arena = a.base;
+    f->map.fork = 1;
+    map_unlock(&w->map);
+
+    f->map.units = NULL;
+    hmdefault(f->map.units, HANDLE_NONE);
+    for (int i = 0, ie = hmlen(w->map.units); i != ie; ++i)
+        hmput(f->map.units, w->map.units[i].key, w->map.units[i].value);
+
+    for (int i = 0, ie = w->jobs.size.x * w->jobs.size.y; i != ie; ++i)
+        f->jobs.cells[i] = dup_array(w->jobs.cells[i], sizeof(int));
+
+    for (int i = 0, ie = w->influence.sources ? w->influence.chunks.x * w->influence.chunks.y : 0; i != ie; ++i)
+        f->influence.sources[i] = dup_array(w->influence.sources[i], sizeof(struct inf_source));
+
+    f->units = dup_array(w->units, sizeof(struct unit));
+    f->ais = dup_array(w->ais, sizeof(struct ai));
+    f->buildings = dup_array(w->buildings, sizeof(struct building));
+    f->assets = dup_array(w->assets, sizeof(struct asset));
+    f->tools = dup_array(w->tools, sizeof(struct tool));
+    f->despawned = dup_array(w->despawned, sizeof(handle));
+
+    struct handles *hs[] = { &f->unit_handles, &f->building_handles, &f->asset_handles, &f->tool_handles };
+    for (int i = 0; i != sizeof(hs) / sizeof(hs[0]); ++i) {
+        hs[i]->slots = dup_array(hs[i]->slots, sizeof(uint32_t));
+        hs[i]->dense = dup_array(hs[i]->dense, sizeof(uint32_t));
+    }
+
+    struct production *p = &f->prod;
+    p->receipt = dup_array(p->receipt, sizeof(int));
+    p->progress = dup_array(p->progress, sizeof(int));
+    p->blocked = dup_array(p->blocked, sizeof(int));
+    for (int i = 0; i != AT_MAX; ++i) {
+        p->stock[i] = dup_array(p->stock[i], sizeof(int));
+        p->pending[i] = dup_array(p->pending[i], sizeof(int));
+    }
+    for (int i = 0; i != TLT_MAX; ++i)
+        p->tools[i] = dup_array(p->tools[i], sizeof(int));
+
+    f->jobs.jobs = dup_array(w->jobs.jobs, sizeof(struct job));
+    f->jobs.idle = dup_array(w->jobs.idle, sizeof(handle));
+
+    f->bt.trees = dup_array(w->bt.trees, sizeof(struct bt));
+    f->bt.slots = dup_array(w->bt.slots, sizeof(int));
+    for (int i = 0, ie = arrlen(f->bt.trees); i != ie; ++i)
+        f->bt.trees[i].free = dup_array(w->bt.trees[i].free, sizeof(int));
+
+    for (int i = 0; i != EV_MAX; ++i) {
+        f->events.queued[i] = dup_array(w->events.queued[i], sizeof(struct event));
+        f->events.ready[i] = dup_array(w->events.ready[i], sizeof(struct event));
+    }
+
+    f->stats.occupancy = dup_array(w->stats.occupancy, sizeof(int));
+    f->stats.chunk_units = dup_array(w->stats.chunk_units, sizeof(int));
+    f->stats.tiles = NULL;
+    f->stats.tile_types = NULL;
+    f->stats.order = NULL;
+    f->influence.dirty_list = dup_array(w->influence.dirty_list, sizeof(int));
+    memset(f->influence.buckets, 0, sizeof(f->influence.buckets));
+
+    /* movement batch is empty between the ticks */
+    move_init(&f->moves);
+
+    pool_init(&f->pool);
+    for (int i = 0, ie = arrlen(f->ais); i != ie; ++i) {
+        struct task *t = &f->ais[i].task;
+        f->ais[i].world = f;
+        if (t->actions) {
+            size_t cap = pool_capacity(t->actions);
+            struct action *actions = pool_acquire(&f->pool, cap);
+            if (!actions) {
+                /* the rest of the tasks still refer to actions of the world */
+                app_warning("Can't allocate actions for a fork");
+                for (; i != ie; ++i)
+                    f->ais[i].task.actions = NULL;
+                world_free(f);
+                memset(f, 0, sizeof(*f));
+                return 1;
+            }
+            memcpy(actions, t->actions, sizeof(struct action) * cap);
+            t->actions = actions;
+        }
+    }
+
+    return 0;
+}
+
+/* copies n bytes into the arena, NULL is copied as NULL; while the arena
+ * has no base only the size is counted
+ */
+static void *
+arena_copy(struct arena *a, const void *src, size_t n) {
+    void *p = a->base ? a->base + a->used : NULL;
+
+    if (!src)
+        return NULL;
+
+    a->used += (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (p)
+        memcpy(p, src, n);
+
+    return p;
+}
+
+/* returns a heap copy of stb_ds array a, an empty array is copied as NULL */
+static void *
+dup_array(void *a, size_t elem) {
+    void *b;
+
+    if (!arrlen(a))
+        return NULL;
+
+    b = stbds_arrgrowf(NULL, elem, 0, arrlen(a));
+    stbds_header(b)->length = arrlen(a);
+    memcpy(b, a, elem * arrlen(a));
+    return b;
+}
+
+/* map sized data of the fork */
+static void
+fork_bulk(struct world *f, struct world *w, struct arena *a) {
+    struct resource_layer *l = &w->recources;
+    struct influence *inf = &w->influence;
+    size_t map_chunks = (size_t)w->map.chunks.x * w->map.chunks.y;
+    size_t chunks = (size_t)inf->chunks.x * inf->chunks.y;
+    size_t side = INF_CHUNK + 2 * inf->reach;
+    int cells = w->jobs.size.x * w->jobs.size.y;     /* jobs_init allocates one cell for an empty grid */
+
+    f->mt = arena_copy(a, w->mt, sizeof(*w->mt));
+    f->map.chunk = arena_copy(a, w->map.chunk, sizeof(struct map_chunk *) * map_chunks);
+    f->map.flags = arena_copy(a, w->map.flags, map_chunks);
+    for (size_t i = 0; i != map_chunks; ++i) {
+        struct map_chunk *c = arena_copy(a, w->map.chunk[i], sizeof(struct map_chunk));
+        if (c) {
+            f->map.chunk[i] = c;
+            f->map.flags[i] |= MC_BORROWED;
+        }
+    }
+
+    for (int t = 0; t != RT_MAX; ++t) {
+        f->recources.bits[t] = arena_copy(a, l->bits[t], sizeof(uint64_t) * l->words * l->size.y);
+        f->recources.count[t] = arena_copy(a, l->count[t], sizeof(int) * l->chunks.x * l->chunks.y);
+    }
+    f->recources.amount = arena_copy(a, l->amount, sizeof(uint16_t) * l->size.x * l->size.y);
+
+    f->lod.level = arena_copy(a, w->lod.level, w->lod.size.x * w->lod.size.y);
+    f->jobs.cells = arena_copy(a, w->jobs.cells, sizeof(int *) * (cells > 0 ? cells : 1));
+
+    f->influence.sources = arena_copy(a, inf->sources, sizeof(struct inf_source *) * chunks);
+    f->influence.dirty = arena_copy(a, inf->dirty, chunks);
+    f->influence.values = arena_copy(a, inf->values, chunks * inf->factions * INF_CHUNK_TILES);
+    f->influence.owner = arena_copy(a, inf->owner, chunks * INF_CHUNK_TILES);
+    f->influence.window = arena_copy(a, inf->window, side * side);
+    f->influence.costs = arena_copy(a, inf->costs, sizeof(int) * side * side);
+}
+
+/* frees what the fork owns, shared data is left to the world */
+static void
+fork_free(struct world *w) {
+    for (int i = 0, ie = w->jobs.size.x * w->jobs.size.y; i != ie; ++i)
+        arrfree(w->jobs.cells[i]);
+    for (int i = 0, ie = w->influence.sources ? w->influence.chunks.x * w->influence.chunks.y : 0; i != ie; ++i)
+        arrfree(w->influence.sources[i]);
+    for (int i = 0; i != 256; ++i)
+        arrfree(w->influence.buckets[i]);
+    arrfree(w->influence.dirty_list);
+
+    arrfree(w->units);
+    arrfree(w->ais);
+    arrfree(w->buildings);
+    arrfree(w->assets);
+    arrfree(w->tools);
+    arrfree(w->despawned);
+    handles_free(&w->unit_handles);
+    handles_free(&w->building_handles);
+    handles_free(&w->asset_handles);
+    handles_free(&w->tool_handles);
+
+    arrfree(w->prod.receipt);
+    arrfree(w->prod.progress);
+    arrfree(w->prod.blocked);
+    for (int i = 0; i != AT_MAX; ++i) {
+        arrfree(w->prod.stock[i]);
+        arrfree(w->prod.pending[i]);
+    }
+    for (int i = 0; i != TLT_MAX; ++i)
+        arrfree(w->prod.tools[i]);
+
+    arrfree(w->jobs.jobs);
+    arrfree(w->jobs.idle);
+
+    for (int i = 0, ie = arrlen(w->bt.trees); i != ie; ++i)
+        arrfree(w->bt.trees[i].free);
+    arrfree(w->bt.trees);
+    arrfree(w->bt.slots);
+
+    events_free(&w->events);
+    stats_free(&w->stats);
+    move_free(&w->moves);
+    pool_free(&w->pool);
+    map_free(&w->map);
+
+    free(w->arena);
+    w->arena = NULL;
+}
@@ -5,7 +5,18 @@
 
 int world_init(struct world *w, const char *fname, struct mt_state *mt);
 void world_free(struct world *w);
+int world_fork(struct world *fork, struct world *w);
 void world_step(struct world *w);
+void world_init_ai(struct world *w, int i);
+handle world_spawn_unit(struct world *w, struct unit *u);
+void world_despawn_unit(struct world *w, handle unit);
+struct ai *world_get_player_ai(struct world *w);
+handle world_add_building(struct world *w, enum building_t type, struct vec2 coords, int faction);
+int world_remove_building(struct world *w, handle building);
+handle world_add_asset(struct world *w, struct asset *a);
+int world_remove_asset(struct world *w, handle asset);
+handle world_add_tool(struct world *w, struct tool *t);
+int world_remove_tool(struct world *w, handle tool);
 
 #endif /* _WORLD_H_ */
 
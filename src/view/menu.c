@@ -187,20 +187,29 @@ void new_menu_draw(struct view *view) {
             nk_layout_row_dynamic(ctx, space, 1);
             nk_spacer(ctx);
 
+            /* the world is generated in the background, app switches to
+             * the main view when it's ready
+             */
+            int progress = app_gen_progress(app);
             nk_layout_row_dynamic(ctx, space * 2, 1);
-            if (nk_button_label(ctx, "Start")) {
-                struct vec2 ws = { 1024, 1024 };
-                app_gen_world(app, ws); //TODO: it's better to move these 2 lines into app code
-                struct vec2 center = { app->cur_world->value.player_ai->unit->coords.x, app->cur_world->value.player_ai->unit->coords.y };
-                app_set_view(app, "main_view");
-                main_view_center_at(&app->cur_view->value, center);
+            if (progress < 0) {
+                if (nk_button_label(ctx, "Start")) {
+                    struct vec2 ws = { 1024, 1024 };
+                    app_gen_world(app, ws);
+                }
+            } else {
+                nk_prog(ctx, progress, 1000, NK_FIXED);
             }
 
             nk_layout_row_dynamic(ctx, space, 1);
             nk_spacer(ctx);
 
             nk_layout_row_dynamic(ctx, space * 2, 1);
-            if (nk_button_label(ctx, "Main menu")) {
+            if (progress >= 0) {
+                if (nk_button_label(ctx, "Cancel")) {
+                    app_gen_cancel(app);
+                }
+            } else if (nk_button_label(ctx, "Main menu")) {
                 app_set_view(app, "main_menu");
             }
 
@@ -14,6 +14,7 @@
 #define NK_SDL_RENDERER_IMPLEMENTATION
 #include "nuklear_sdl_renderer.h"
 #include "app.h"
+#include "prof.h"
 
 void
 run_init(struct app *app) {
@@ -131,23 +132,26 @@ run(struct app *app) {
                 nk_sdl_handle_event(&evt);
             }
         } else {
+            /* the world is stepped by the simulation thread, here we only redraw */
             if (*SDL_GetError()) {
                 SDL_Log("Error SDL_WaitEventTimeout: %s", SDL_GetError());
-            } else {
-                app_step(app);
-                /* Put animation here */
             }
         }
 
         nk_sdl_handle_grab(); /* optional grabbing behavior */
         nk_input_end(ctx);
 
+        prof_begin(PROF_DRAW);
         app_draw(app);
+        prof_end(PROF_DRAW);
 
         SDL_SetRenderDrawColor(renderer, bg.r * 255, bg.g * 255, bg.b * 255, bg.a * 255);
         SDL_RenderClear(renderer);
 
+        prof_begin(PROF_RENDER);
         nk_sdl_render(NK_ANTI_ALIASING_ON);
+        prof_end(PROF_RENDER);
+        prof_count(PROF_FRAMES, 1);
 
         SDL_RenderPresent(renderer);
     }
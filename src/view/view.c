@@ -6,7 +6,10 @@
 #include "tileset.h"
 #include "icon.h"
 #include "path.h"
-#include "ai.h"
+#include "map.h"
+#include "prof.h"
+#include "prod.h"
+#include "res.h"
 #include "stb_ds.h"
 #include <malloc.h>
 
@@ -25,15 +28,25 @@ struct main_view {
     struct vec2 mid;            /* pixel that should be shown in the middle of the map */
     struct vec2 dest_size;      /* size of shown tile */
     enum action_t action;
-    struct path path;
     struct vec2 prev_hovered_coo;
     struct nk_image minimap;
 
     struct tileset *landset;
     struct tileset *unitset;
     struct tileset *iconset;
+    int show_stats;
+#ifdef PROF_ENABLED
+    int show_prof;
+#endif
 };
 
+#define STATS_BUCKETS 12
+
+static void stats_view_draw(struct view *view, struct world_stats *stats);
+#ifdef PROF_ENABLED
+static void prof_view_draw(struct view *view);
+#endif
+
 void main_view_init(struct view *view) {
     view->data = malloc(sizeof(struct main_view));
     view->draw = main_view_draw;
@@ -42,9 +55,12 @@ void main_view_init(struct view *view) {
     data->zoom = data->mid.x = data->mid.y = 0;
     main_view_zoom(view, 0);
     data->action = A_NOTHING;
-    path_init(&data->path);
     data->prev_hovered_coo.x = -1;
     data->prev_hovered_coo.y = -1;
+    data->show_stats = 0;
+#ifdef PROF_ENABLED
+    data->show_prof = 0;
+#endif
 
     data->landset = &shgetp_null(view->app->cur_world->value.tilesets, "landset")->value;
     data->unitset = &shgetp_null(view->app->cur_world->value.tilesets, "unitset")->value;
@@ -119,8 +135,9 @@ void main_view_draw(struct view *view) {
     struct nk_style_window *s = &ctx->style.window;
     struct main_view *data = (struct main_view *)view->data;
     struct map *map = &w->map;
-    struct unit *units = w->units;
-    struct unit *player = w->player_ai->unit;
+    struct snapshot *snap = sim_acquire(&app->sim);     /* units are read from the snapshot only */
+    struct unit *units = snap->units;
+    struct unit *player = &units[snap->player];
     struct vec2 win_size = get_win_size(app);
 
     enum nk_widget_layout_states state;
@@ -131,7 +148,7 @@ void main_view_draw(struct view *view) {
     struct vec2 half_space;
     struct rect frame;
 
-    struct tile *hovered_tile = NULL;
+    int hovered_type = -1;
     struct vec2 hovered_coo;
 
     if (nk_begin(ctx, "tile_view", nk_rect(0, 0, win_size.x, win_size.y), NK_WINDOW_BACKGROUND | NK_WINDOW_NO_SCROLLBAR)) {
@@ -161,35 +178,34 @@ void main_view_draw(struct view *view) {
             /* hovered  coords and tile */
             hovered_coo.x = frame.x + ((int)mouse_pos->x + left_margin.x) / data->dest_size.x;
             hovered_coo.y = frame.y + ((int)mouse_pos->y + left_margin.y) / data->dest_size.y;
-            hovered_tile = &map->tiles[hovered_coo.y * map->size.x + hovered_coo.x];
+
+            /* chunks are not evicted while the tiles are drawn */
+            map_lock(map);
+            if (hovered_coo.x >= 0 && hovered_coo.x < map->size.x && hovered_coo.y >= 0 && hovered_coo.y < map->size.y)
+                hovered_type = map_get_tile(map, hovered_coo.x, hovered_coo.y)->type;
 
             /* drawing map */
             for (int y = frame.y; y < frame.y + frame.h; ++y) {
-                for (int i = y * map->size.x + frame.x, x = frame.x; x < frame.x + frame.w; ++i, ++x) {
+                for (int x = frame.x; x < frame.x + frame.w; ++x) {
                     /* drawing tile */
-                    struct tile *tile = &map->tiles[i];
-                    struct nk_image sub = tileset_get_image_by_index(data->landset, tile->tileset_index);
+                    struct tile *tile = map_get_tile(map, x, y);
+                    struct nk_image sub = tileset_get_image_by_index(data->landset, map_tileset_index(map, tile));
                     dest.x = (x - frame.x) * dest.w - left_margin.x;
                     dest.y = (y - frame.y) * dest.h - left_margin.y;
                     nk_draw_image(canvas, dest, &sub, nk_rgba(255, 255, 255, 255));
-                    sub = tileset_get_image_by_index(data->landset, tile->transit_index);
+                    sub = tileset_get_image_by_index(data->landset, map_transit_index(map, tile));
                     nk_draw_image(canvas, dest, &sub, nk_rgba(255, 255, 255, 255));
                 }
             }
+            map_unlock(map);
+            sim_post_view(&app->sim, frame);
 
-            /* handling mouse press the map_view */
-            if (data->action == A_WALK && (data->prev_hovered_coo.x != hovered_coo.x || data->prev_hovered_coo.y != hovered_coo.y)) {
-                if (data->path.steps)
-                    path_free(&data->path);
-                data->path = find_path(w, player, hovered_coo);
-            }
+            /* handling mouse press the map_view, paths are found by the simulation thread */
+            if (data->action == A_WALK && (data->prev_hovered_coo.x != hovered_coo.x || data->prev_hovered_coo.y != hovered_coo.y))
+                sim_post_player_aim(&app->sim, hovered_coo);
 
-            if (nk_input_is_mouse_pressed(&ctx->input, NK_BUTTON_LEFT)) {
-                if (!path_is_free(data->path)) {
-                    ai_add_task_from_path(w->player_ai, data->path);
-                    path_free(&data->path);
-                }
-            }
+            if (data->action == A_WALK && nk_input_is_mouse_pressed(&ctx->input, NK_BUTTON_LEFT))
+                sim_post_player_walk(&app->sim, hovered_coo);
         }
     }
     nk_end(ctx);
@@ -204,37 +220,35 @@ void main_view_draw(struct view *view) {
         enum nk_widget_layout_states state2 = nk_widget(&space, ctx);
         if (state && state2) {
             /* drawing units */
-            for (int y = frame.y; y < frame.y + frame.h; ++y) {
-                for (int i = y * map->size.x + frame.x, x = frame.x; x < frame.x + frame.w; ++i, ++x) {
-                    struct tile *tile = &map->tiles[i];
-                    struct nk_image sub;
-                    dest.x = (x - frame.x) * dest.w - left_margin.x;
-                    dest.y = (y - frame.y) * dest.h - left_margin.y;
-
-                    /* drawing unit if exists on current tile */
-                    if (tile->units[0] != ID_NOTHING) {
-                        struct unit *u = &units[tile->units[0]];
-                        dest.x += (u->coords.x % 64) * data->dest_size.x / 64; // it should be x * data->dest_size.x / 64
-                        dest.y += (u->coords.y % 64) * data->dest_size.y / 64; // the same but y instead of x
-                        struct nk_rect r = { dest.x, dest.y, 16, 24 };
-                        nk_fill_rect(canvas, r, 0, nk_rgba(255, 0, 0, 255));
-
-                        /* drawing circle under the player */
-                        if (u->flags & UF_PLAYER) {
-                            sub = tileset_get_image_by_index(data->iconset, 0);
-                            nk_draw_image(canvas, dest, &sub, nk_rgba(255, 255, 255, 255));
-                        }
-
-                        sub = tileset_get_image_by_index(data->unitset, 16);
-                        nk_draw_image(canvas, dest, &sub, nk_rgba(255, 255, 255, 255));
-                    }
+            for (int i = 0, ie = arrlen(units); i != ie; ++i) {
+                struct unit *u = &units[i];
+                struct vec2 coo = { u->coords.x >> TILE_SHIFT, u->coords.y >> TILE_SHIFT };
+                struct nk_image sub;
+
+                if (coo.x < frame.x || coo.x >= frame.x + frame.w || coo.y < frame.y || coo.y >= frame.y + frame.h)
+                    continue;
+
+                dest.x = (coo.x - frame.x) * dest.w - left_margin.x;
+                dest.y = (coo.y - frame.y) * dest.h - left_margin.y;
+                dest.x += (u->coords.x % 64) * data->dest_size.x / 64; // it should be x * data->dest_size.x / 64
+                dest.y += (u->coords.y % 64) * data->dest_size.y / 64; // the same but y instead of x
+                struct nk_rect r = { dest.x, dest.y, 16, 24 };
+                nk_fill_rect(canvas, r, 0, nk_rgba(255, 0, 0, 255));
+
+                /* drawing circle under the player */
+                if (u->flags & UF_PLAYER) {
+                    sub = tileset_get_image_by_index(data->iconset, 0);
+                    nk_draw_image(canvas, dest, &sub, nk_rgba(255, 255, 255, 255));
                 }
+
+                sub = tileset_get_image_by_index(data->unitset, 16);
+                nk_draw_image(canvas, dest, &sub, nk_rgba(255, 255, 255, 255));
             }
 
             /* drawing the path */
-            if (data->action == A_WALK && data->path.steps) {
+            if (data->action == A_WALK && snap->path) {
                 struct vec2 prev = { player->coords.x / 64, player->coords.y / 64 };
-                for (struct vec2 *i = data->path.steps, *ie = i + arrlenu(data->path.steps); i != ie; ++i) {
+                for (struct vec2 *i = snap->path, *ie = i + arrlenu(snap->path); i != ie; ++i) {
                     struct nk_image sub = tileset_get_image_by_index(data->iconset, 16 + get_path_icon(prev, *i));
                     prev = *i;
                     dest.x = (i->x - frame.x) * dest.w - left_margin.x;
@@ -281,14 +295,16 @@ void main_view_draw(struct view *view) {
             /* frame in the world map to draw */
             struct nk_rect frame  = { 0, 0, min(120, map->size.x), min(100, map->size.y) };
 
+            map_lock(map);
             for (int y = frame.y; y < frame.h; ++y) {
-                for (int i = y*map->size.x, x = frame.x; x < frame.w; ++i, ++x) {
-                    struct nk_image sub = tileset_get_image_by_index(data->landset, map->tiles[i].tileset_index);
+                for (int x = frame.x; x < frame.w; ++x) {
+                    struct nk_image sub = tileset_get_image_by_index(data->landset, map_tileset_index(map, map_get_tile(map, x, y)));
                     dest.x = space.x + x;
                     dest.y = space.y + y;
                     nk_draw_image(canvas, dest, &sub, nk_rgba(255, 255, 255, 255));
                 }
             }
+            map_unlock(map);
 
             /* handling mouse in the mini_map_view, now it works incorrecnly */
             if (nk_input_is_mouse_pressed(&ctx->input, NK_BUTTON_DOUBLE)) {
@@ -303,8 +319,8 @@ void main_view_draw(struct view *view) {
         char str[128];
         nk_layout_row_dynamic(ctx, 20, 1);
 
-        if (hovered_tile) {
-            snprintf(str, sizeof(str), "Terrian: %s", map->tile_types[hovered_tile->type].name);
+        if (hovered_type >= 0) {
+            snprintf(str, sizeof(str), "Terrian: %s", map->tile_types[hovered_type].name);
             nk_label(ctx, str, NK_TEXT_LEFT);
             snprintf(str, sizeof(str), "Coordinates: %i:%i", hovered_coo.x, hovered_coo.y);
             nk_label(ctx, str, NK_TEXT_LEFT);
@@ -312,15 +328,148 @@ void main_view_draw(struct view *view) {
             nk_label(ctx, "Terrian:" , NK_TEXT_LEFT);
         }
 
+        nk_checkbox_label(ctx, "Statistics", &data->show_stats);
+#ifdef PROF_ENABLED
+        nk_checkbox_label(ctx, "Profiler", &data->show_prof);
+#endif
     }
     nk_end(ctx);
 
+    if (data->show_stats)
+        stats_view_draw(view, &snap->stats);
+
+#ifdef PROF_ENABLED
+    if (data->show_prof)
+        prof_view_draw(view);
+#endif
+
     data->prev_hovered_coo.x = hovered_coo.x;
     data->prev_hovered_coo.y = hovered_coo.y;
 }
 
+/* statistics overlay: population, units by terrain, asset and resource
+ * totals and how units are spread over the chunks, log2 buckets
+ */
+static void
+stats_view_draw(struct view *view, struct world_stats *stats) {
+    struct app *app = view->app;
+    struct nk_context *ctx = app->ctx;
+    struct map *map = &app->cur_world->value.map;
+    unsigned hist[STATS_BUCKETS] = { 0 };
+    unsigned hist_max = 1;
+    int busiest = 0;
+    char str[128];
+
+    if (nk_begin(ctx, "stats_view", nk_rect(460, 150, 300, 500), NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE | NK_WINDOW_TITLE)) {
+        nk_layout_row_dynamic(ctx, 20, 1);
+        snprintf(str, sizeof(str), "Population: %i", stats->population);
+        nk_label(ctx, str, NK_TEXT_LEFT);
+
+        for (int i = 0, ie = arrlen(stats->occupancy); i != ie && i < arrlen(map->tile_types); ++i) {
+            snprintf(str, sizeof(str), "  on %s: %i", map->tile_types[i].name, stats->occupancy[i]);
+            nk_label(ctx, str, NK_TEXT_LEFT);
+        }
+
+        for (int a = 1; a != AT_MAX; ++a) {
+            snprintf(str, sizeof(str), "%s: %lli", prod_asset_name(a), stats->assets[a]);
+            nk_label(ctx, str, NK_TEXT_LEFT);
+        }
+
+        for (int t = 1; t != RT_MAX; ++t) {
+            snprintf(str, sizeof(str), "%s tiles: %i", res_type_name(t), stats->resources[t]);
+            nk_label(ctx, str, NK_TEXT_LEFT);
+        }
+
+        for (int i = 0, ie = arrlen(stats->chunk_units); i != ie; ++i) {
+            int n = stats->chunk_units[i];
+            int b = n ? 32 - __builtin_clz(n) : 0;
+            ++hist[ min(b, STATS_BUCKETS - 1) ];
+            busiest = max(busiest, n);
+        }
+
+        for (int i = 0; i != STATS_BUCKETS; ++i)
+            hist_max = max(hist_max, hist[i]);
+
+        snprintf(str, sizeof(str), "Units per chunk, busiest %i", busiest);
+        nk_label(ctx, str, NK_TEXT_LEFT);
+        nk_layout_row_dynamic(ctx, 60, 1);
+        if (nk_chart_begin(ctx, NK_CHART_COLUMN, STATS_BUCKETS, 0, hist_max)) {
+            for (int i = 0; i != STATS_BUCKETS; ++i)
+                nk_chart_push(ctx, hist[i]);
+            nk_chart_end(ctx);
+        }
+
+        if (stats->check) {
+            nk_layout_row_dynamic(ctx, 20, 1);
+            snprintf(str, sizeof(str), "Self-check: %lu mismatches in %lu checks", stats->mismatches, stats->checks);
+            nk_label(ctx, str, NK_TEXT_LEFT);
+        }
+    }
+    nk_end(ctx);
+}
+
+#ifdef PROF_ENABLED
+/* profiler overlay: per phase timings over the last PROF_SAMPLES samples,
+ * their histograms and the counters
+ */
+static void
+prof_view_draw(struct view *view) {
+    struct app *app = view->app;
+    struct nk_context *ctx = app->ctx;
+    struct world *w = &app->cur_world->value;
+    char str[128];
+
+    if (nk_begin(ctx, "prof_view", nk_rect(20, 150, 420, 600), NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE | NK_WINDOW_TITLE)) {
+        for (int p = 0; p != PROF_PHASES; ++p) {
+            struct prof_phase_stat *ph = prof_get_phase(p);
+            unsigned long num = ph->n < PROF_SAMPLES ? ph->n : PROF_SAMPLES;
+            uint64_t sum = 0, max = 0;
+            unsigned hist_max = 1;
+
+            for (unsigned long i = 0; i != num; ++i) {
+                sum += ph->samples[i].dur;
+                if (ph->samples[i].dur > max) max = ph->samples[i].dur;
+            }
+
+            nk_layout_row_dynamic(ctx, 20, 1);
+            snprintf(str, sizeof(str), "%s: avg %.1fus max %.1fus (%lu)", ph->name,
+                num ? prof_to_us(sum) / num : 0., prof_to_us(max), ph->n);
+            nk_label(ctx, str, NK_TEXT_LEFT);
+
+            for (int i = 0; i != PROF_BUCKETS; ++i)
+                if (ph->hist[i] > hist_max) hist_max = ph->hist[i];
+
+            nk_layout_row_dynamic(ctx, 40, 1);
+            if (nk_chart_begin(ctx, NK_CHART_COLUMN, PROF_BUCKETS, 0, hist_max)) {
+                for (int i = 0; i != PROF_BUCKETS; ++i)
+                    nk_chart_push(ctx, ph->hist[i]);
+                nk_chart_end(ctx);
+            }
+        }
+
+        nk_layout_row_dynamic(ctx, 20, 1);
+        for (int c = 0; c != PROF_COUNTERS; ++c) {
+            snprintf(str, sizeof(str), "%s: %llu", prof_counter_name(c), (unsigned long long)prof_get_counter(c));
+            nk_label(ctx, str, NK_TEXT_LEFT);
+        }
+
+        struct pool_stats ps = pool_get_stats(&w->pool);
+        snprintf(str, sizeof(str), "action blocks: %zu live, %zu slabs", ps.live, ps.slabs);
+        nk_label(ctx, str, NK_TEXT_LEFT);
+
+        if (nk_button_label(ctx, "Dump trace")) {
+            prof_dump_trace("society_trace.json");
+        }
+    }
+    nk_end(ctx);
+}
+#endif
+
+/* draws n rows of the minimap from row y on, the texture is made at row 0,
+ * so the minimap of a new world can be drawn a few rows a frame
+ */
 int
-gen_minimap(struct view *view) {
+gen_minimap(struct view *view, int y, int n) {
     struct main_view *data = (struct main_view *)view->data;
     struct map *map = &view->app->cur_world->value.map;
     SDL_Renderer *renderer = view->app->renderer;
@@ -329,30 +478,38 @@ gen_minimap(struct view *view) {
     struct SDL_Rect d = { 0, 0, 1, 1 };
 
     struct vec2 size = map->size;
-    void *tex = create_image(size.x, size.y);
-    if (!tex)
-        return 1;
+    if (y == 0) {
+        void *tex = create_image(size.x, size.y);
+        if (!tex)
+            return 1;
 
-    data->minimap = nk_image_ptr(tex);
+        data->minimap = nk_image_ptr(tex);
+    }
 
-    if (SDL_SetRenderTarget(renderer, tex)) {
+    if (SDL_SetRenderTarget(renderer, data->minimap.handle.ptr)) {
         app_warning(SDL_GetError());
         return 1;
     }
 
-    for (int i = 0, y = 0; y < size.y; ++y) {
-        for (int x = 0; x < size.x; ++x, ++i) {
+    /* types are read without generating the chunks */
+    int *types = malloc(sizeof(int) * size.x);
+    for (int ye = y + n < size.y ? y + n : size.y; y < ye; ++y) {
+        map_get_types(map, 0, y, size.x, types);
+        for (int x = 0; x < size.x; ++x) {
             struct rect sub;
-            tileset_get_rect_by_index(data->landset, map->tiles[i].tileset_index, &sub);
+            tileset_get_rect_by_index(data->landset, tileset_quad_get_tile_index(data->landset, types[x], 0), &sub);
             SDL_Rect s = { sub.x, sub.y, sub.w, sub.h };
             d.x = x;
             d.y = y;
             if (SDL_RenderCopy(renderer, src, &s, &d)) {
                 app_warning(SDL_GetError());
+                free(types);
+                SDL_SetRenderTarget(renderer, old_texture);
                 return 1;
             }
         }
     }
+    free(types);
 
     if (SDL_SetRenderTarget(renderer, old_texture)) {
         app_warning(SDL_GetError());